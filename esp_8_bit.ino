@@ -29,7 +29,8 @@
 //  Choose one of the video standards: PAL,NTSC
 #define VIDEO_STANDARD NTSC
 
-//  Choose one of the following emulators: EMU_NES,EMU_SMS,EMU_ATARI
+//  Every emulator is linked in and media picks the one that runs by its extension.
+//  Start with this one until something has been played: EMU_NES,EMU_SMS,EMU_ATARI
 #define EMULATOR EMU_ATARI
 
 //  Many emus work fine on a single core (S2), file system access can cause a little flickering
@@ -42,30 +43,38 @@
 // Folders will be auto-populated on first launch with a built in selection of sample media.
 // Use 'ESP32 Sketch Data Upload' from the 'Tools' menu to copy a prepared data folder to ESP32
 
-// Create a new emulator, messy ifdefs ensure that only one links at a time
-Emu* NewEmulator()
-{  
-  #if (EMULATOR==EMU_NES)
-  return NewNofrendo(VIDEO_STANDARD);
-  #endif
-  #if (EMULATOR==EMU_SMS)
-  return NewSMSPlus(VIDEO_STANDARD);
-  #endif
-  #if (EMULATOR==EMU_ATARI)
-  return NewAtari800(VIDEO_STANDARD);
-  #endif
-  printf("Must choose one of the following emulators: EMU_NES,EMU_SMS,EMU_ATARI\n");
-}
-
 Emu* _emu = 0;            // emulator running on core 0
 uint32_t _frame_time = 0;
 uint32_t _drawn = 1;
 bool _inited = false;
 
+// The gui found media for another core. Video runs black while the old core goes and
+// the arena that held its buffers is emptied for the new one
+Emu* emu_switch(const emu_core* core)
+{
+    if (_emu) {
+        if (_emu->flavor == core->flavor)
+            return _emu;
+        _lines = 0;
+        if (_inited) {
+            int f = _frame_counter;
+            while (f == _frame_counter)     // the isr may still be drawing from the old buffers
+                vTaskDelay(1);
+        }
+        battery_close();
+        delete _emu;
+    }
+    arena_begin(core->name);
+    _emu = core->create(VIDEO_STANDARD);
+    if (_inited)
+        video_switch(_emu->flavor,_emu->composite_palette());
+    arena_report();
+    return _emu;
+}
+
 void emu_init()
 {
-    std::string folder = "/" + _emu->name;
-    gui_start(_emu,folder.c_str());
+    gui_start(_emu);
     _drawn = _frame_counter;
 }
 
@@ -114,14 +123,15 @@ void setup()
 { 
   rtc_clk_cpu_freq_set(RTC_CPU_FREQ_240M);  
   mount_filesystem();                       // mount the filesystem!
-  _emu = NewEmulator();                     // create the emulator!
+  emu_switch(find_core(EMULATOR));          // create the emulator!
   hid_init("emu32");                        // bluetooth hid on core 1!
 
   #ifdef SINGLE_CORE
   emu_init();
   video_init(_emu->cc_width,_emu->flavor,_emu->composite_palette(),_emu->standard); // start the A/V pump on app core
+  _inited = true;
   #else
-  xTaskCreatePinnedToCore(emu_task, "emu_task", EMULATOR == EMU_NES ? 5*1024 : 3*1024, NULL, 0, NULL, 0); // nofrendo needs 5k word stack, start on core 0
+  xTaskCreatePinnedToCore(emu_task, "emu_task", 5*1024, NULL, 0, NULL, 0); // nofrendo needs 5k word stack, start on core 0
   #endif
 }
 
@@ -132,13 +142,22 @@ void perf()
   if (_drawn >= _next) {
     float elapsed_us = 120*1000000/(_emu->standard ? 60 : 50);
     _next = _drawn + 120;
+    uint32_t hits,misses,evictions;
+    _emu->tile_cache(&hits,&misses,&evictions);
     
-    printf("frame_time:%d drawn:%d displayed:%d blit_ticks:%d->%d, isr time:%2.2f%%\n",
-      _frame_time/240,_drawn,_frame_counter,_blit_ticks_min,_blit_ticks_max,(_isr_us*100)/elapsed_us);
+    printf("frame_time:%d drawn:%d displayed:%d blit_ticks:%d->%d, isr time:%2.2f%%, audio time:%2.2f%%, idle cycles:%d, battery flushes:%d pages:%d max:%dus, input reports:%d latency avg:%dus max:%dus, tile cache hits:%d misses:%d evictions:%d\n",
+      _frame_time/240,_drawn,_frame_counter,_blit_ticks_min,_blit_ticks_max,(_isr_us*100)/elapsed_us,(_audio_ticks/240*100)/elapsed_us,_emu->idle_cycles(),
+      _battery_flushes,_battery_pages,_battery_flush_us,
+      _input_reports,_input_reports ? _input_latency_total/_input_reports : 0,_input_latency_us,
+      hits,misses,evictions);
       
+    _input_reports = 0;
+    _input_latency_us = 0;
+    _input_latency_total = 0;
     _blit_ticks_min = 0xFFFFFFFF;
     _blit_ticks_max = 0;
     _isr_us = 0;
+    _audio_ticks = 0;
   }
 }
 #else
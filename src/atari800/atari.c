@@ -173,6 +173,9 @@ int Atari800_turbo = FALSE;
 int Atari800_start_in_monitor = FALSE;
 int Atari800_auto_frameskip = FALSE;
 
+/* Set once Atari800_Initialise has run, Atari800_Reload relies on it */
+static int initialised = FALSE;
+
 #ifdef BENCHMARK
 static double benchmark_start_time;
 #endif
@@ -947,6 +950,173 @@ int Atari800_Initialise(int *argc, char *argv[])
 	}
 #endif /* defined (SOUND) && defined(SOUND_THIN_API) */
 
+	initialised = TRUE;
+	return TRUE;
+}
+
+/* Machine model selected by one of the command line switches understood by
+   Atari800_Initialise. Returns FALSE if the switch is not a machine model. */
+static int ParseMachineModel(const char *arg, int *type, int *ram_size, int *basic, int *game)
+{
+	*basic = TRUE;
+	*game = FALSE;
+	if (strcmp(arg, "-atari") == 0) {
+		*type = Atari800_MACHINE_800;
+		*ram_size = 48;
+		*basic = FALSE;
+	}
+	else if (strcmp(arg, "-1200") == 0) {
+		*type = Atari800_MACHINE_XLXE;
+		*ram_size = 64;
+		*basic = FALSE;
+	}
+	else if (strcmp(arg, "-xl") == 0) {
+		*type = Atari800_MACHINE_XLXE;
+		*ram_size = 64;
+	}
+	else if (strcmp(arg, "-xe") == 0) {
+		*type = Atari800_MACHINE_XLXE;
+		*ram_size = 128;
+	}
+	else if (strcmp(arg, "-xegs") == 0) {
+		*type = Atari800_MACHINE_XLXE;
+		*ram_size = 64;
+		*game = TRUE;
+	}
+	else if (strcmp(arg, "-5200") == 0) {
+		*type = Atari800_MACHINE_5200;
+		*ram_size = 16;
+		*basic = FALSE;
+	}
+	else
+		return FALSE;
+	return TRUE;
+}
+
+void Atari800_Release(void)
+{
+	CARTRIDGE_Remove();
+	CASSETTE_Remove();
+	SIO_Exit();
+	if (BINLOAD_bin_file != NULL) {
+		fclose(BINLOAD_bin_file);
+		BINLOAD_bin_file = NULL;
+	}
+	Devices_Exit();
+	initialised = FALSE;
+}
+
+int Atari800_Reload(int *argc, char *argv[])
+{
+	int i;
+	int diskno = 1;
+	int type = Atari800_machine_type;
+	int ram_size = MEMORY_ram_size;
+	int basic = Atari800_builtin_basic;
+	int game = Atari800_builtin_game;
+	int disable_basic = Atari800_disable_basic;
+	int tv_mode = Atari800_tv_mode;
+	int cart_type = CARTRIDGE_UNKNOWN;
+	const char *cart = NULL;
+	const char *tape = NULL;
+	const char *h1 = NULL;
+
+	if (!initialised)
+		return FALSE;
+
+	/* Only media and the options that select the running machine are
+	   understood here, anything else needs the full Atari800_Initialise */
+	for (i = 1; i < *argc; i++) {
+		int i_a = (i + 1 < *argc);
+		if (ParseMachineModel(argv[i], &type, &ram_size, &basic, &game))
+			;
+		else if (strcmp(argv[i], "-basic") == 0)
+			disable_basic = FALSE;
+		else if (strcmp(argv[i], "-nobasic") == 0)
+			disable_basic = TRUE;
+		else if (strcmp(argv[i], "-pal") == 0)
+			tv_mode = Atari800_TV_PAL;
+		else if (strcmp(argv[i], "-ntsc") == 0)
+			tv_mode = Atari800_TV_NTSC;
+		else if (strcmp(argv[i], "-cart") == 0 && i_a)
+			cart = argv[++i];
+		else if (strcmp(argv[i], "-cart-type") == 0 && i_a)
+			cart_type = Util_sscandec(argv[++i]);
+		else if ((strcmp(argv[i], "-boottape") == 0 || strcmp(argv[i], "-tape") == 0) && i_a)
+			tape = argv[++i];
+		else if (strcmp(argv[i], "-H1") == 0 && i_a)
+			h1 = argv[++i];
+		else if (argv[i][0] == '-')
+			return FALSE;
+	}
+
+	/* A different machine means different ROMs, memory map and timing */
+	if (type != Atari800_machine_type || ram_size != MEMORY_ram_size
+		|| basic != Atari800_builtin_basic || game != Atari800_builtin_game
+		|| disable_basic != Atari800_disable_basic || tv_mode != Atari800_tv_mode)
+		return FALSE;
+
+	/* Keep memory, ROM images, palettes and POKEY tables, just swap media */
+	CARTRIDGE_Remove();
+	CASSETTE_Remove();
+	SIO_Exit();
+	if (BINLOAD_bin_file != NULL) {
+		fclose(BINLOAD_bin_file);
+		BINLOAD_bin_file = NULL;
+		BINLOAD_loading_basic = 0;
+	}
+	BINLOAD_start_binloading = FALSE;
+	if (h1 != NULL) {
+		Util_strlcpy(Devices_atari_h_dir[0], h1, FILENAME_MAX);
+		Devices_h_current_dir[0][0] = '\0';
+	}
+	Devices_H_CloseAll();
+
+	if (cart != NULL) {
+		int r = CARTRIDGE_Insert(cart);
+		if (r < 0) {
+			Log_print("Error opening cartridge \"%s\"", cart);
+			return FALSE;
+		}
+		if (r > 0)
+			CARTRIDGE_SetType(&CARTRIDGE_main, cart_type != CARTRIDGE_UNKNOWN ? cart_type : UI_SelectCartType(r));
+	}
+	if (tape != NULL) {
+		if (!CASSETTE_Insert(tape)) {
+			Log_print("Cannot open cassette image %s", tape);
+			return FALSE;
+		}
+		CASSETTE_hold_start = TRUE;
+	}
+
+	Atari800_Coldstart();
+
+	for (i = 1; i < *argc; i++) {
+		if (argv[i][0] == '-') {
+			if (strcmp(argv[i], "-cart") == 0 || strcmp(argv[i], "-cart-type") == 0
+				|| strcmp(argv[i], "-boottape") == 0 || strcmp(argv[i], "-tape") == 0
+				|| strcmp(argv[i], "-H1") == 0)
+				i++;
+			continue;
+		}
+		if (diskno > 8)
+			break;
+		switch (AFILE_OpenFile(argv[i], FALSE, diskno, FALSE)) {
+			case AFILE_ERROR:
+				Log_print("Error opening \"%s\"", argv[i]);
+				break;
+			case AFILE_ATR:
+			case AFILE_XFD:
+			case AFILE_ATR_GZ:
+			case AFILE_XFD_GZ:
+			case AFILE_DCM:
+			case AFILE_PRO:
+				diskno++;
+				break;
+			default:
+				break;
+		}
+	}
 	return TRUE;
 }
 
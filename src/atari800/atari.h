@@ -125,6 +125,15 @@ extern int Atari800_start_in_monitor;
 /* Initializes Atari800 emulation core. */
 int Atari800_Initialise(int *argc, char *argv[]);
 
+/* Swaps the media given on the command line without reinitialising the
+   emulator core, when the machine model is unchanged. Returns FALSE if the
+   options need a full Atari800_Initialise(). */
+int Atari800_Reload(int *argc, char *argv[]);
+
+/* Drops the media and forgets the core was initialised, the frontend is
+   taking back the memory it was running in. */
+void Atari800_Release(void);
+
 /* Emulates one frame (1/50sec for PAL, 1/60sec for NTSC). */
 void Atari800_Frame(void);
 
@@ -1759,7 +1759,10 @@ void CARTRIDGE_StateRead(UBYTE version)
 	StateSav_ReadINT(&saved_type, 1);
 	if (saved_type != CARTRIDGE_NONE) {
 		StateSav_ReadFNAME(filename);
-		if (filename[0]) {
+		if (filename[0] && strcmp(filename, CARTRIDGE_main.filename) == 0)
+			/* Already inserted, just take its type */
+			CARTRIDGE_main.type = saved_type;
+		else if (filename[0]) {
 			/* Insert the cartridge... */
 			if (CARTRIDGE_Insert(filename) >= 0) {
 				/* And set the type to the saved type, in case it was a raw cartridge image */
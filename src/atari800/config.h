@@ -31,6 +31,9 @@
 /* Define to allow console sound (keyboard clicks). */
 #define CONSOLE_SOUND 1
 
+/* Define to fast-forward through polling loops. */
+#define CPU_IDLE_SKIP 1
+
 /* Define to activate crash menu after CIM instruction. */
 //#define CRASH_MENU 1
 
@@ -36,6 +36,8 @@
 	Define NO_V_FLAG_VARIABLE to don't use local (static) variable V for the V flag.
 	Define PC_PTR to emulate 6502 Program Counter using UBYTE *.
 	Define PREFETCH_CODE to always fetch 2 bytes after the opcode.
+	Define CPU_IDLE_SKIP to fast-forward through polling loops
+	(requires PAGED_ATTRIB, not compatible with NEW_CYCLE_EXACT).
 	Define WRAP_64K to correctly emulate instructions that wrap at 64K.
 	Define WRAP_ZPAGE to prevent incorrect access to the address 0x0100 in zeropage
 	indirect mode.
@@ -302,6 +304,7 @@ void CPU_PutStatus(void)
 		if ((addr ^ GET_PC()) & 0xff00) \
 			ANTIC_xpos++; \
 		ANTIC_xpos++; \
+		IDLE_SKIP(addr); \
 		SET_PC(addr); \
 		DONE \
 	} \
@@ -377,6 +380,98 @@ static const int cycles[256] =
 	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7		/* Fx */
 };
 
+#ifdef CPU_IDLE_SKIP
+
+#ifndef PAGED_ATTRIB
+#error CPU_IDLE_SKIP requires PAGED_ATTRIB
+#endif
+#ifdef NEW_CYCLE_EXACT
+#error CPU_IDLE_SKIP does not support NEW_CYCLE_EXACT
+#endif
+
+ULONG CPU_idle_cycles = 0;
+
+/* Longest loop considered, in bytes from the branch target to the branch. */
+#define IDLE_MAX_BODY 5
+
+/* A loop of one read (LDA, LDX, LDY, BIT, CMP, CPX, CPY, AND or ORA zp/abs),
+   an optional AND/CMP/CPX/CPY #imm and a branch back does the same thing
+   each time round until the location read changes. Returns the cycles taken
+   by one iteration of such a loop and the location it polls, or 0. */
+static int IdleLoop(UWORD target, UWORD branch, UWORD *poll)
+{
+	UWORD pc = target;
+	UBYTE op = MEMORY_dGetByte(pc);
+	int loop;
+	switch (op) {
+	case 0x05: case 0x24: case 0x25: case 0xa4: case 0xa5: case 0xa6: case 0xc4: case 0xc5: case 0xe4:
+		*poll = MEMORY_dGetByte(pc + 1);
+		pc += 2;
+		break;
+	case 0x0d: case 0x2c: case 0x2d: case 0xac: case 0xad: case 0xae: case 0xcc: case 0xcd: case 0xec:
+		*poll = MEMORY_dGetWord(pc + 1);
+		pc += 3;
+		break;
+	default:
+		return 0;
+	}
+	loop = cycles[op];
+	op = MEMORY_dGetByte(pc);
+	if (op == 0x29 || op == 0xc0 || op == 0xc9 || op == 0xe0) {
+		loop += cycles[op];
+		pc += 2;
+	}
+	if (pc != branch)
+		return 0;
+	/* taken branch: 1 extra cycle, 2 if it crosses a page */
+	return loop + cycles[MEMORY_dGetByte(branch)] + ((((branch + 2) ^ target) & 0xff00) ? 2 : 1);
+}
+
+/* Branch and ANTIC_xpos of the last polling loop iteration seen. */
+static UWORD idle_branch = 0;
+static int idle_xpos = 0;
+
+/* Returns the cycles to skip for a polling loop ending in a branch to target,
+   a whole number of iterations that leaves the last one to the interpreter.
+   Interrupts are only taken between CPU_GO() calls, so RAM and ROM can't
+   change before ANTIC_xpos_limit; VCOUNT changes at the end of the line.
+   Any other hardware register may change at any time.
+   The flags the branch tests may predate an interrupt, so nothing is skipped
+   until a whole iteration has run back to back with the previous one. */
+static int IdleSkip(UWORD target, UWORD branch)
+{
+	UWORD poll;
+	int loop = IdleLoop(target, branch, &poll);
+	int budget = ANTIC_xpos_limit - ANTIC_xpos;
+	int n;
+	if (loop == 0)
+		return 0;
+	if (branch != idle_branch || ANTIC_xpos - idle_xpos != loop) {
+		idle_branch = branch;
+		idle_xpos = ANTIC_xpos;
+		return 0;
+	}
+	if (MEMORY_readmap[poll >> 8] != NULL) {
+		if ((poll & 0xff0f) != 0xd40b)	/* VCOUNT and its mirrors */
+			return 0;
+		if (budget > ANTIC_LINE_C - ANTIC_xpos)
+			budget = ANTIC_LINE_C - ANTIC_xpos;
+	}
+	n = (budget - 1) / loop;
+	if (n <= 0)
+		return 0;
+	CPU_idle_cycles += n * loop;
+	idle_xpos = ANTIC_xpos + n * loop;
+	return n * loop;
+}
+
+#define IDLE_SKIP(target) \
+	if ((UWORD) (GET_PC() - (target)) <= IDLE_MAX_BODY + 2) \
+		ANTIC_xpos += IdleSkip(target, (UWORD) (GET_PC() - 2));
+#else
+#define IDLE_SKIP(target)
+#endif /* CPU_IDLE_SKIP */
+
 /* 6502 emulation routine */
 #ifndef NO_GOTO
 __extension__ /* suppress -ansi -pedantic warnings */
@@ -1298,6 +1393,14 @@ void CPU_GO(int limit)
 #ifdef MONITOR_BREAK
 		CPU_remember_JMP[CPU_remember_jmp_curpos] = GET_PC() - 1;
 		CPU_remember_jmp_curpos = (CPU_remember_jmp_curpos + 1) % CPU_REMEMBER_JMP_STEPS;
+#endif
+#ifdef CPU_IDLE_SKIP
+		/* JMP to itself just waits for an interrupt */
+		if (OP_WORD == (UWORD) (GET_PC() - 1) && ANTIC_xpos_limit - ANTIC_xpos > 3) {
+			int skip = (ANTIC_xpos_limit - ANTIC_xpos - 1) / 3 * 3;
+			ANTIC_xpos += skip;
+			CPU_idle_cycles += skip;
+		}
 #endif
 		SET_PC(OP_WORD);
 		DONE
@@ -53,6 +53,11 @@ extern void (*CPU_rts_handler)(void);
 
 extern UBYTE CPU_cim_encountered;
 
+#ifdef CPU_IDLE_SKIP
+/* Cycles fast-forwarded through polling loops; reset by the caller. */
+extern ULONG CPU_idle_cycles;
+#endif
+
 #define CPU_REMEMBER_PC_STEPS 64
 extern UWORD CPU_remember_PC[CPU_REMEMBER_PC_STEPS];
 extern UBYTE CPU_remember_op[CPU_REMEMBER_PC_STEPS][3];
@@ -196,6 +196,9 @@ static int Devices_ReadDir(char *fullpath, char *filename, int *isdir,
 	return TRUE;
 }
 
+#define Devices_FlushDirCache()
+#define Devices_FreeDirCache()
+
 #define DO_DIR
 
 #elif defined(HAVE_OPENDIR)
@@ -235,66 +238,131 @@ static int match(const char *pattern, const char *filename)
 
 static char dir_path[FILENAME_MAX];
 static char filename_pattern[FILENAME_MAX];
-static DIR *dp = NULL;
+
+/* Snapshot of the last host directory listed. Every H: open, delete, rename
+   or listing walks the directory, so reading and stat()ing it once saves a
+   lot of filesystem traffic. Devices_FlushDirCache() drops it whenever H:
+   changes the directory. */
+typedef struct {
+	char *name;
+	int isdir;
+	int readonly;
+	int size;
+	long mtime;
+} dir_entry_t;
+
+static char dir_cache_path[FILENAME_MAX];
+static dir_entry_t *dir_cache = NULL;
+static int dir_cache_count = 0;
+static int dir_cache_alloc = 0;
+static int dir_cache_valid = FALSE;
+static int dir_next = 0;
+
+static void Devices_FlushDirCache(void)
+{
+	int i;
+	for (i = 0; i < dir_cache_count; i++)
+		free(dir_cache[i].name);
+	dir_cache_count = 0;
+	dir_cache_valid = FALSE;
+}
+
+static void Devices_FreeDirCache(void)
+{
+	Devices_FlushDirCache();
+	free(dir_cache);
+	dir_cache = NULL;
+	dir_cache_alloc = 0;
+}
+
+static int Devices_FillDirCache(void)
+{
+	struct dirent *entry;
+	DIR *dp = opendir(dir_path);
+	if (dp == NULL)
+		return FALSE;
+	Devices_FlushDirCache();
+	while ((entry = readdir(dp)) != NULL) {
+		dir_entry_t *e;
+#ifdef HAVE_STAT
+		char temppath[FILENAME_MAX];
+		struct stat status;
+#endif
+		if (dir_cache_count == dir_cache_alloc) {
+			dir_cache_alloc = dir_cache_alloc ? dir_cache_alloc * 2 : 32;
+			dir_cache = (dir_entry_t *) Util_realloc(dir_cache, dir_cache_alloc * sizeof(dir_entry_t));
+		}
+		e = &dir_cache[dir_cache_count++];
+		e->name = Util_strdup(entry->d_name);
+		e->isdir = FALSE;
+		e->readonly = FALSE;
+		e->size = 0;
+		e->mtime = -1;
+#ifdef HAVE_STAT
+		Util_catpath(temppath, dir_path, entry->d_name);
+		if (stat(temppath, &status) == 0) {
+			e->isdir = S_ISDIR(status.st_mode);
+			e->readonly = (status.st_mode & S_IWRITE) ? FALSE : TRUE;
+			e->size = (int) status.st_size;
+			e->mtime = (long) status.st_mtime;
+		}
+#endif /* HAVE_STAT */
+	}
+	closedir(dp);
+	strcpy(dir_cache_path, dir_path);
+	dir_cache_valid = TRUE;
+	return TRUE;
+}
 
 static int Devices_OpenDir(const char *filename)
 {
 	Util_splitpath(filename, dir_path, filename_pattern);
-	if (dp != NULL)
-		closedir(dp);
-	dp = opendir(dir_path);
-	return dp != NULL;
+	dir_next = 0;
+	if (dir_cache_valid && strcmp(dir_cache_path, dir_path) == 0)
+		return TRUE;
+	return Devices_FillDirCache();
 }
 
 static int Devices_ReadDir(char *fullpath, char *filename, int *isdir,
                           int *readonly, int *size, char *timetext)
 {
-	struct dirent *entry;
-	char temppath[FILENAME_MAX];
-#ifdef HAVE_STAT
-	struct stat status;
-#endif
+	dir_entry_t *entry;
 	for (;;) {
-		entry = readdir(dp);
-		if (entry == NULL) {
-			closedir(dp);
-			dp = NULL;
+		if (dir_next >= dir_cache_count)
 			return FALSE;
-		}
-		if (entry->d_name[0] == '.') {
+		entry = &dir_cache[dir_next++];
+		if (entry->name[0] == '.') {
 			/* don't match Unix hidden files unless specifically requested */
 			if (filename_pattern[0] != '.')
 				continue;
 			/* never match "." */
-			if (entry->d_name[1] == '\0')
+			if (entry->name[1] == '\0')
 				continue;
 			/* never match ".." */
-			if (entry->d_name[1] == '.' && entry->d_name[2] == '\0')
+			if (entry->name[1] == '.' && entry->name[2] == '\0')
 				continue;
 		}
-		if (match(filename_pattern, entry->d_name))
+		if (match(filename_pattern, entry->name))
 			break;
 	}
 	if (filename != NULL)
-		strcpy(filename, entry->d_name);
-	Util_catpath(temppath, dir_path, entry->d_name);
+		strcpy(filename, entry->name);
 	if (fullpath != NULL)
-		strcpy(fullpath, temppath);
-#ifdef HAVE_STAT
-	if (stat(temppath, &status) == 0) {
+		Util_catpath(fullpath, dir_path, entry->name);
+	if (entry->mtime != -1) {
 		if (isdir != NULL)
-			*isdir = S_ISDIR(status.st_mode);
+			*isdir = entry->isdir;
 		if (readonly != NULL)
-			*readonly = (status.st_mode & S_IWRITE) ? FALSE : TRUE;
+			*readonly = entry->readonly;
 		if (size != NULL)
-			*size = (int) status.st_size;
+			*size = entry->size;
 		if (timetext != NULL) {
 #ifdef HAVE_LOCALTIME
 			struct tm *ft;
 			int hour;
 			char ampm = 'a';
 			{
-				time_t tim = status.st_mtime;
+				time_t tim = (time_t) entry->mtime;
 				ft = localtime(&tim);
 			}
 			hour = ft->tm_hour;
@@ -313,7 +381,6 @@ static int Devices_ReadDir(char *fullpath, char *filename, int *isdir,
 		}
 	}
 	else
-#endif /* HAVE_STAT */
 	{
 		if (isdir != NULL)
 			*isdir = FALSE;
@@ -355,8 +422,16 @@ static int Devices_ReadDir(char *fullpath, char *filename, int *isdir,
 	return TRUE;
 }
 
+#define Devices_FlushDirCache()
+#define Devices_FreeDirCache()
+
 #define DO_DIR
 
+#else
+
+#define Devices_FlushDirCache()
+#define Devices_FreeDirCache()
+
 #endif /* defined(PS2) */
 
 
@@ -492,6 +567,8 @@ char Devices_atari_h_dir[4][FILENAME_MAX];
 /* read only mode for H: device */
 int Devices_h_read_only = TRUE;
 
+int Devices_h_burst = TRUE;
+
 /* ';'-separated list of Atari paths checked by the "load executable"
    command. if a path does not start with "Hn:", then the selected device
    is used. */
@@ -521,6 +598,14 @@ static char h_lastop[8];
 
 Util_tmpbufdef(static, h_tmpbuf[8])
 
+/* stdio buffer per IOCB; the C library default is too small to amortise
+   the cost of the host filesystem on byte-at-a-time CIO traffic */
+#define H_BUFFER_SIZE 1024
+static char *h_buf[8];
+
+/* stream was written to, per IOCB */
+static int h_written[8];
+
 /* IOCB #, 0-7 */
 static int h_iocb;
 
@@ -551,14 +636,36 @@ int Devices_H_CountOpen(void)
 	return r;
 }
 
+static void Devices_H_SetBuffer(FILE *fp)
+{
+	if (h_buf[h_iocb] == NULL)
+		h_buf[h_iocb] = (char *) malloc(H_BUFFER_SIZE);
+	/* stay with the default buffer if memory is tight */
+	if (h_buf[h_iocb] != NULL)
+		setvbuf(fp, h_buf[h_iocb], _IOFBF, H_BUFFER_SIZE);
+}
+
+static void Devices_H_CloseFile(int iocb)
+{
+	Util_fclose(h_fp[iocb], h_tmpbuf[iocb]);
+	h_fp[iocb] = NULL;
+	/* the buffer belongs to the stream until fclose() */
+	free(h_buf[iocb]);
+	h_buf[iocb] = NULL;
+	if (h_written[iocb]) {
+		h_written[iocb] = FALSE;
+		Devices_FlushDirCache();
+	}
+}
+
 void Devices_H_CloseAll(void)
 {
 	int i;
 	for (i = 0; i < 8; i++)
-		if (h_fp[i] != NULL) {
-			Util_fclose(h_fp[i], h_tmpbuf[i]);
-			h_fp[i] = NULL;
-		}
+		if (h_fp[i] != NULL)
+			Devices_H_CloseFile(i);
+	/* host files may have changed behind our back */
+	Devices_FlushDirCache();
 }
 
 static void Devices_H_Init(void)
@@ -609,6 +716,10 @@ int Devices_Initialise(int *argc, char *argv[])
 			Devices_h_read_only = TRUE;
 		else if (strcmp(argv[i], "-hreadwrite") == 0)
 			Devices_h_read_only = FALSE;
+		else if (strcmp(argv[i], "-hburst") == 0)
+			Devices_h_burst = TRUE;
+		else if (strcmp(argv[i], "-hnoburst") == 0)
+			Devices_h_burst = FALSE;
 		else if (strcmp(argv[i], "-devbug") == 0)
 			devbug = TRUE;
 		else {
@@ -620,6 +731,8 @@ int Devices_Initialise(int *argc, char *argv[])
 				Log_print("\t-Hpath <path>    Set path for Atari executables on the H: device");
 				Log_print("\t-hreadonly       Enable read-only mode for H: device");
 				Log_print("\t-hreadwrite      Disable read-only mode for H: device");
+				Log_print("\t-hburst          Enable block transfers for H: device");
+				Log_print("\t-hnoburst        Disable block transfers for H: device");
 				Log_print("\t-devbug          Debugging messages for H: and P: devices");
 			}
 			argv[j++] = argv[i];
@@ -638,7 +751,9 @@ int Devices_Initialise(int *argc, char *argv[])
 
 void Devices_Exit(void)
 {
+	/* closing the streams frees their buffers too */
 	Devices_H_CloseAll();
+	Devices_FreeDirCache();
 }
 
 #define IS_DIR_SEP(c) ((c) == '/' || (c) == '\\' || (c) == ':' || (c) == '>')
@@ -821,7 +936,7 @@ static void Devices_H_Open(void)
 		return;
 
 	if (h_fp[h_iocb] != NULL)
-		Util_fclose(h_fp[h_iocb], h_tmpbuf[h_iocb]);
+		Devices_H_CloseFile(h_iocb);
 
 #if 0
 	if (devbug)
@@ -839,6 +954,7 @@ static void Devices_H_Open(void)
 		   we want to support LF, CR/LF and CR, not only native EOLs */
 		fp = Util_fopen(host_path, "rb", h_tmpbuf[h_iocb]);
 		if (fp != NULL) {
+			Devices_H_SetBuffer(fp);
 			CPU_regY = 1;
 			CPU_ClrN;
 		}
@@ -957,6 +1073,10 @@ static void Devices_H_Open(void)
 			}
 		}
 		if (fp != NULL) {
+			Devices_H_SetBuffer(fp);
+			/* the file may be new, and will change size */
+			h_written[h_iocb] = TRUE;
+			Devices_FlushDirCache();
 			CPU_regY = 1;
 			CPU_ClrN;
 		}
@@ -979,14 +1099,95 @@ static void Devices_H_Close(void)
 		Log_print("HHCLOS");
 	if (!Devices_GetIOCB())
 		return;
-	if (h_fp[h_iocb] != NULL) {
-		Util_fclose(h_fp[h_iocb], h_tmpbuf[h_iocb]);
-		h_fp[h_iocb] = NULL;
-	}
+	if (h_fp[h_iocb] != NULL)
+		Devices_H_CloseFile(h_iocb);
 	CPU_regY = 1;
 	CPU_ClrN;
 }
 
+/* CIO calls the handler once per byte of a block GET/PUT, keeping the buffer
+   pointer and remaining length in the zero-page IOCB. For binary streams we
+   move all but the last byte ourselves and advance CIO's pointers, so it only
+   transfers the final byte through A.
+   That relies on the OS's CIO using ICBALZ/ICBLLZ as its loop counters, so
+   transfers stay byte-at-a-time until two calls in a row have seen the
+   pointer go up by one and the length go down by one. */
+static int h_ziocb_ok = FALSE;
+static UWORD h_ziocb_adr;
+static UWORD h_ziocb_len;
+static int h_ziocb_cmd = -1;
+
+static int Devices_H_CanBurst(UBYTE command)
+{
+	UWORD adr = MEMORY_dGetWordAligned(Devices_ICBALZ);
+	UWORD len = MEMORY_dGetWordAligned(Devices_ICBLLZ);
+	if (!Devices_h_burst || h_textmode[h_iocb]
+		|| MEMORY_dGetByte(Devices_ICCOMZ) != command)
+		return FALSE;
+	if (!h_ziocb_ok) {
+		h_ziocb_ok = h_ziocb_cmd == (h_iocb << 8 | command)
+			&& adr == (UWORD) (h_ziocb_adr + 1) && len == (UWORD) (h_ziocb_len - 1);
+		h_ziocb_cmd = h_iocb << 8 | command;
+		h_ziocb_adr = adr;
+		h_ziocb_len = len;
+		if (!h_ziocb_ok)
+			return FALSE;
+	}
+	return len > 1;
+}
+
+static void Devices_H_BurstRead(void)
+{
+	FILE *fp = h_fp[h_iocb];
+	UBYTE buf[256];
+	UWORD adr = MEMORY_dGetWordAligned(Devices_ICBALZ);
+	int left = MEMORY_dGetWordAligned(Devices_ICBLLZ);
+	int len = left;
+	int done = 0;
+	if (len > 0x10000 - adr)
+		len = 0x10000 - adr;
+	/* h_lastbyte holds the next byte; the last one goes back in A */
+	while (done < len - 1) {
+		int chunk = len - 1 - done;
+		int got;
+		if (chunk > (int) sizeof(buf) - 1)
+			chunk = (int) sizeof(buf) - 1;
+		buf[0] = (UBYTE) h_lastbyte[h_iocb];
+		got = 1 + (int) fread(buf + 1, 1, chunk, fp);
+		MEMORY_CopyToMem(buf, (UWORD) (adr + done), got - 1);
+		done += got - 1;
+		h_lastbyte[h_iocb] = buf[got - 1];
+		if (got <= chunk)
+			break;
+	}
+	/* the value may be evaluated once per byte, so it can't read ICBLLZ itself */
+	MEMORY_dPutWordAligned(Devices_ICBALZ, adr + done);
+	MEMORY_dPutWordAligned(Devices_ICBLLZ, left - done);
+}
+
+static void Devices_H_BurstWrite(void)
+{
+	FILE *fp = h_fp[h_iocb];
+	UBYTE buf[256];
+	UWORD adr = MEMORY_dGetWordAligned(Devices_ICBALZ);
+	int left = MEMORY_dGetWordAligned(Devices_ICBLLZ);
+	int len = left;
+	int done = 1;
+	if (len > 0x10000 - adr)
+		len = 0x10000 - adr;
+	/* CIO already fetched the first byte into A */
+	while (done < len) {
+		int chunk = len - done;
+		if (chunk > (int) sizeof(buf))
+			chunk = (int) sizeof(buf);
+		MEMORY_CopyFromMem((UWORD) (adr + done), buf, chunk);
+		fwrite(buf, 1, chunk, fp);
+		done += chunk;
+	}
+	MEMORY_dPutWordAligned(Devices_ICBALZ, adr + done - 1);
+	MEMORY_dPutWordAligned(Devices_ICBLLZ, left - done + 1);
+}
+
 static void Devices_H_Read(void)
 {
 	if (devbug)
@@ -1001,6 +1202,8 @@ static void Devices_H_Read(void)
 			h_lastbyte[h_iocb] = fgetc(h_fp[h_iocb]);
 			h_lastop[h_iocb] = 'r';
 		}
+		if (h_lastbyte[h_iocb] != EOF && Devices_H_CanBurst(7))
+			Devices_H_BurstRead();
 		ch = h_lastbyte[h_iocb];
 		if (ch != EOF) {
 			if (h_textmode[h_iocb]) {
@@ -1068,6 +1271,9 @@ static void Devices_H_Write(void)
 		if (ch == 0x9b && h_textmode[h_iocb])
 			ch = '\n';
 		fputc(ch, h_fp[h_iocb]);
+		if (Devices_H_CanBurst(11))
+			Devices_H_BurstWrite();
+		h_written[h_iocb] = TRUE;
 		CPU_regY = 1;
 		CPU_ClrN;
 	}
@@ -1195,6 +1401,7 @@ static void Devices_H_Rename(void)
 				num_failed++;
 		}
 	}
+	Devices_FlushDirCache();
 
 	if (devbug)
 		Log_print("%d renamed, %d failed, %d locked",
@@ -1253,6 +1460,7 @@ static void Devices_H_Delete(void)
 			else
 				num_failed++;
 	}
+	Devices_FlushDirCache();
 
 	if (devbug)
 		Log_print("%d deleted, %d failed, %d locked",
@@ -1300,6 +1508,7 @@ static void Devices_H_LockUnlock(int readonly)
 		else
 			num_failed++;
 	}
+	Devices_FlushDirCache();
 
 	if (devbug)
 		Log_print("%d changed, %d failed",
@@ -1640,6 +1849,7 @@ static void Devices_H_MakeDirectory(void)
 	if (Devices_GetHostPath(FALSE) == 0)
 		return;
 
+	Devices_FlushDirCache();
 	if (Devices_MakeDirectory(host_path)) {
 		CPU_regY = 1;
 		CPU_ClrN;
@@ -1661,6 +1871,7 @@ static void Devices_H_RemoveDirectory(void)
 	if (Devices_GetHostPath(FALSE) == 0)
 		return;
 
+	Devices_FlushDirCache();
 	CPU_regY = Devices_RemoveDirectory(host_path);
 	if (CPU_regY >= 128)
 		CPU_SetN;
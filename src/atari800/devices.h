@@ -20,6 +20,7 @@ extern int Devices_enable_b_patch;
 //extern char Devices_atari_h_dir[4][FILENAME_MAX];
 extern char Devices_atari_h_dir[4][64];
 extern int Devices_h_read_only;
+extern int Devices_h_burst;
 
 //extern char Devices_h_exe_path[FILENAME_MAX];
 extern char Devices_h_exe_path[64];
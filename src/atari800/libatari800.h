@@ -191,12 +191,18 @@ extern int libatari800_error_code;
 
 int libatari800_init(int argc, char **argv);
 
+int libatari800_reload(int argc, char **argv);
+
+void libatari800_exit(void);
+
 char *libatari800_error_message();
 
 void libatari800_clear_input_array(input_template_t *input);
 
 int libatari800_next_frame(input_template_t *input);
 
+int libatari800_skip_frame(void);
+
 int libatari800_mount_disk_image(int diskno, const char *filename, int readonly);
 
 int libatari800_reboot_with_file(const char *filename);
@@ -66,6 +66,9 @@
 
 extern int debug_sound;
 
+/* Cleared while warping, frames are emulated but not drawn */
+static int draw_display = TRUE;
+
 int PLATFORM_Configure(char *option, char *parameters)
 {
 	return TRUE;
@@ -139,7 +142,7 @@ void LIBATARI800_Frame(void)
 	Devices_Frame();
 	INPUT_Frame();
 	GTIA_Frame();
-	ANTIC_Frame(TRUE);
+	ANTIC_Frame(draw_display);
 	INPUT_DrawMousePointer();
 	Screen_DrawAtariSpeed(Util_time());
 	Screen_DrawDiskLED();
@@ -188,6 +191,18 @@ int libatari800_init(int argc, char **argv) {
 	return Atari800_Initialise(&argc, argv);
 }
 
+int libatari800_reload(int argc, char **argv) {
+	CPU_cim_encountered = 0;
+	libatari800_error_code = 0;
+	Atari800_nframes = 0;
+	MEMORY_selftest_enabled = 0;
+	return Atari800_Reload(&argc, argv);
+}
+
+void libatari800_exit(void) {
+	Atari800_Release();
+}
+
 char *error_messages[] = {
 	"no error",
 	"unidentified cartridge",
@@ -244,6 +259,16 @@ int libatari800_next_frame(input_template_t *input)
 	return !libatari800_error_code;
 }
 
+int libatari800_skip_frame(void)
+{
+	draw_display = FALSE;
+	LIBATARI800_Frame();
+	draw_display = TRUE;
+	if (CPU_cim_encountered)
+		libatari800_error_code = LIBATARI800_CPU_CRASH;
+	return !libatari800_error_code;
+}
+
 int libatari800_mount_disk_image(int diskno, const char *filename, int readonly)
 {
 	return SIO_Mount(diskno, filename, readonly);
@@ -272,13 +297,13 @@ UBYTE *libatari800_get_screen_ptr()
 
 void libatari800_get_current_state(emulator_state_t *state)
 {
-	LIBATARI800_StateSave(state->state, &state->tags);
+	LIBATARI800_StateSave(state->state, STATESAV_MAX_SIZE, &state->tags);
 	state->flags.selftest_enabled = MEMORY_selftest_enabled;
 }
 
 void libatari800_restore_state(emulator_state_t *state)
 {
-	LIBATARI800_StateLoad(state->state);
+	LIBATARI800_StateLoad(state->state, STATESAV_MAX_SIZE);
 }
 
 /*
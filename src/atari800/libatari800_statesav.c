@@ -31,16 +31,20 @@
 #include "libatari800_init.h"
 
 UBYTE *LIBATARI800_StateSav_buffer = NULL;
+ULONG LIBATARI800_StateSav_size = STATESAV_MAX_SIZE;
 statesav_tags_t *LIBATARI800_StateSav_tags = NULL;
 
 
-void LIBATARI800_StateSave(UBYTE *buffer, statesav_tags_t *tags) {
+/* size is the room in buffer, saving fails rather than overrun it */
+int LIBATARI800_StateSave(UBYTE *buffer, ULONG size, statesav_tags_t *tags) {
     LIBATARI800_StateSav_buffer = buffer;
+    LIBATARI800_StateSav_size = size;
     LIBATARI800_StateSav_tags = tags;
-	StateSav_SaveAtariState(NULL, NULL, 0);
+	return StateSav_SaveAtariState(NULL, NULL, 0);
 }
 
-void LIBATARI800_StateLoad(UBYTE *buffer) {
+int LIBATARI800_StateLoad(UBYTE *buffer, ULONG size) {
     LIBATARI800_StateSav_buffer = buffer;
-	StateSav_ReadAtariState(NULL, NULL);
+    LIBATARI800_StateSav_size = size;
+	return StateSav_ReadAtariState(NULL, NULL);
 }
@@ -10,9 +10,10 @@
 #include "libatari800.h"
 
 extern UBYTE *LIBATARI800_StateSav_buffer;
+extern ULONG LIBATARI800_StateSav_size;
 extern statesav_tags_t *LIBATARI800_StateSav_tags;
 
-void LIBATARI800_StateSave(UBYTE *buffer, statesav_tags_t *tags);
-void LIBATARI800_StateLoad(UBYTE *buffer);
+int LIBATARI800_StateSave(UBYTE *buffer, ULONG size, statesav_tags_t *tags);
+int LIBATARI800_StateLoad(UBYTE *buffer, ULONG size);
 
 #endif /* LIBATARI800_STATESAV_H_ */
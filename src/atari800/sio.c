@@ -1706,6 +1706,10 @@ void SIO_StateRead(void)
 		if (filename[0] == 0)
 			continue;
 
+		/* Still mounted, don't go back to the filesystem */
+		if (strcmp(filename, SIO_filename[i]) == 0)
+			continue;
+
 		/* If the disk drive wasn't empty or off when saved,
 		   mount the disk */
 		switch (saved_drive_status) {
@@ -129,7 +129,7 @@ static void GetGZErrorText(void)
 /* Value is memory location of data, num is number of type to save */
 void StateSav_SaveUBYTE(const UBYTE *data, int num)
 {
-	if (!StateFile || nFileError != Z_OK)
+	if (!StateFile || nFileError != Z_OK || num <= 0)
 		return;
 
 	/* Assumption is that UBYTE = 8bits and the pointer passed in refers
@@ -143,7 +143,7 @@ void StateSav_SaveUBYTE(const UBYTE *data, int num)
 /* Value is memory location of data, num is number of type to save */
 void StateSav_ReadUBYTE(UBYTE *data, int num)
 {
-	if (!StateFile || nFileError != Z_OK)
+	if (!StateFile || nFileError != Z_OK || num <= 0)
 		return;
 
 	if (GZREAD(StateFile, data, num) == 0)
@@ -303,7 +303,7 @@ void StateSav_ReadINT(int *data, int num)
 void StateSav_SaveFNAME(const char *filename)
 {
 	UWORD namelen;
-#ifdef HAVE_GETCWD
+#if defined(HAVE_GETCWD) && !defined(LIBATARI800)
 	char dirname[FILENAME_MAX]="";
 
 	/* Check to see if file is in application tree, if so, just save as
@@ -659,7 +659,7 @@ static gzFile mem_open(const char *name, const char *mode)
 {
 	plainmembuf = (char *)LIBATARI800_StateSav_buffer;
 	plainmemoff = 0; /*HDR_LEN;*/
-	unclen = STATESAV_MAX_SIZE;
+	unclen = LIBATARI800_StateSav_size;
 	return (gzFile) plainmembuf;
 }
 
@@ -679,7 +679,10 @@ ULONG StateSav_Tell()
 /* replacement for GZREAD */
 static size_t mem_read(void *buf, size_t len, gzFile stream)
 {
-	if (plainmemoff + len > unclen) return 0;  /* shouldn't happen */
+	if (plainmemoff + len > unclen) {
+		nFileError = !Z_OK;  /* past the end of the buffer, fail the whole state */
+		return 0;
+	}
 	memcpy(buf, plainmembuf + plainmemoff, len);
 	plainmemoff += len;
 	return len;
@@ -688,7 +691,10 @@ static size_t mem_read(void *buf, size_t len, gzFile stream)
 /* replacement for GZWRITE */
 static size_t mem_write(const void *buf, size_t len, gzFile stream)
 {
-	if (plainmemoff + len > unclen) return 0;  /* shouldn't happen */
+	if (plainmemoff + len > unclen) {
+		nFileError = !Z_OK;  /* past the end of the buffer, fail the whole state */
+		return 0;
+	}
 	memcpy(plainmembuf + plainmemoff, buf, len);
 	plainmemoff += len;
 	return len;
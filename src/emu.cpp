@@ -27,6 +27,10 @@ using namespace std;
 #include <esp_attr.h>
 #include <esp_partition.h>
 #include "rom/miniz.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 // only map 1 file at a time
 spi_flash_mmap_handle_t _file_handle = 0;
@@ -247,15 +251,30 @@ FILE* mkfile(const char* path)
 
 #endif
 
-// map one bit array to another
-uint32_t generic_map(uint32_t bits, const uint32_t* m)
+// precompute every combination of each group of 4 bits
+InputMap::InputMap(const uint32_t* m)
 {
-    uint32_t b = 0;
-    for (int i = 0; i < 16; i++) {
-        if ((0x8000 >> i) & bits)
-            b |= m[i];
+    for (int n = 0; n < 4; n++) {
+        for (int i = 0; i < 16; i++) {
+            uint32_t b = 0;
+            for (int j = 0; j < 4; j++)
+                if (i & (8 >> j))
+                    b |= m[n*4 + j];
+            _nibble[n][i] = b;
+        }
     }
-    return b;
+}
+
+// map wii controller keys
+uint32_t wii_map(int index, const InputMap& common, const InputMap& classic)
+{
+    uint32_t f = wii_states[index].flags;
+    if (!(f & wiimote))
+        return 0;
+    uint32_t r = common(wii_states[index].common());
+    if (f & classic_controller)
+        r |= classic(wii_states[index].classic());
+    return r;
 }
 
 // unpack file and write to FS, use rom miniz on esp32
@@ -316,6 +335,35 @@ Emu::~Emu()
 {
 }
 
+extern const char* _atari_ext[];
+extern const char* _nes_ext[];
+extern const char* _sms_ext[];
+
+const emu_core _emu_cores[] = {
+    {EMU_ATARI,"atari800",_atari_ext,NewAtari800},
+    {EMU_NES,"nofrendo",_nes_ext,NewNofrendo},
+    {EMU_SMS,"smsplus",_sms_ext,NewSMSPlus},
+    {0,0,0,0}
+};
+
+const emu_core* find_core(int flavor)
+{
+    for (const emu_core* c = _emu_cores; c->name; c++)
+        if (c->flavor == flavor)
+            return c;
+    return 0;
+}
+
+const emu_core* media_core(const std::string& path)
+{
+    string ext = get_ext(path);
+    for (const emu_core* c = _emu_cores; c->name; c++)
+        for (int i = 0; c->ext[i]; i++)
+            if (ext == c->ext[i])
+                return c;
+    return 0;
+}
+
 int Emu::frame_sample_count()
 {
     int n = audio_frame_samples + audio_fraction;
@@ -372,3 +420,792 @@ int Emu::load(const std::string& path, uint8_t** data, int* len)
     *len = fsize;
     return 0;
 }
+
+//====================================================================================================
+// Battery backed cart RAM, saved next to the cart as .sav
+// Cores report every changed byte, we keep a flag per 256 byte page and once the game has stopped
+// writing for a couple of seconds only the dirty pages are rewritten. Flash gets one write per
+// save point rather than one per frame, and the emulator never waits for the filesystem.
+// Flags are bytes so the core setting them and the flush task clearing them never share a word.
+
+#define BATTERY_PAGE    256
+#define BATTERY_MAX     0x8000      // 32k SMS cart RAM
+#define BATTERY_QUIET   120         // frames without writes before flushing
+
+static uint8_t* _battery = 0;
+static int _battery_len = 0;
+static std::string _battery_path;
+static volatile uint8_t _battery_dirty[BATTERY_MAX/BATTERY_PAGE];
+static int _battery_quiet = 0;      // frames since the last write
+static volatile bool _battery_busy = false;
+
+uint32_t _battery_flushes = 0;
+uint32_t _battery_pages = 0;
+uint32_t _battery_flush_us = 0;
+
+void battery_write(int offset)
+{
+    _battery_dirty[offset/BATTERY_PAGE] = 1;
+    _battery_quiet = 0;
+}
+
+// the whole of cart RAM was replaced by a save state
+static void battery_write_all()
+{
+    for (int i = 0; i < _battery_len; i += BATTERY_PAGE)
+        battery_write(i);
+}
+
+static bool battery_pending()
+{
+    for (int i = 0; i < _battery_len/BATTERY_PAGE; i++)
+        if (_battery_dirty[i])
+            return true;
+    return false;
+}
+
+// rewrite the dirty pages in place, the first save writes the whole image
+static void battery_flush()
+{
+    uint8_t page[BATTERY_PAGE];
+    uint32_t t = cpu_ticks();
+    FILE* f = fopen(_battery_path.c_str(),"r+b");
+    if (!f) {
+        f = mkfile(_battery_path.c_str());
+        if (!f) {
+            printf("battery_flush can't create %s\n",_battery_path.c_str());
+            return;
+        }
+        for (int i = 0; i < _battery_len/BATTERY_PAGE; i++)
+            _battery_dirty[i] = 1;
+    }
+
+    for (int i = 0; i < _battery_len/BATTERY_PAGE; i++) {
+        if (!_battery_dirty[i])
+            continue;
+        _battery_dirty[i] = 0;          // clear before copying, a write during the copy marks it again
+        memcpy(page,_battery + i*BATTERY_PAGE,BATTERY_PAGE);
+        fseek(f,i*BATTERY_PAGE,SEEK_SET);
+        fwrite(page,1,BATTERY_PAGE,f);
+        _battery_pages++;
+    }
+    fclose(f);
+
+    t = (cpu_ticks() - t)/240;
+    if (t > _battery_flush_us)
+        _battery_flush_us = t;
+    _battery_flushes++;
+}
+
+#ifdef ESP_PLATFORM
+static TaskHandle_t _battery_task = 0;
+
+static void battery_task(void* arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE,portMAX_DELAY);
+        battery_flush();
+        _battery_busy = false;
+    }
+}
+#endif
+
+// called once a frame from the emulation loop
+void battery_update()
+{
+    if (!_battery || _battery_busy)
+        return;
+    if (_battery_quiet < BATTERY_QUIET) {
+        _battery_quiet++;
+        return;
+    }
+    if (!battery_pending())
+        return;
+#ifdef ESP_PLATFORM
+    if (!_battery_task)
+        xTaskCreatePinnedToCore(battery_task,"battery",3*1024,NULL,1,&_battery_task,1);   // off the emulator core
+    _battery_busy = true;
+    xTaskNotifyGive(_battery_task);
+#else
+    battery_flush();
+#endif
+}
+
+// save anything outstanding and forget the cart
+void battery_close()
+{
+    while (_battery_busy)
+        usleep(1000);
+    if (_battery && battery_pending())
+        battery_flush();
+    _battery = 0;
+    _battery_len = 0;
+}
+
+// load the .sav for a cart if there is one, otherwise the ram is left as the core initialized it
+void battery_open(const std::string& path, uint8_t* data, int len)
+{
+    battery_close();
+    _battery_path = path.substr(0,path.find_last_of(".")) + ".sav";
+    _battery = data;
+    _battery_len = len < BATTERY_MAX ? len : BATTERY_MAX;
+    _battery_quiet = 0;
+    memset((void*)_battery_dirty,0,sizeof(_battery_dirty));
+
+    FILE* f = fopen(_battery_path.c_str(),"rb");
+    if (f) {
+        fread(data,1,_battery_len,f);
+        fclose(f);
+        printf("battery_open loaded %s\n",_battery_path.c_str());
+    }
+}
+
+//====================================================================================================
+// Save states, in RAM supplied by the caller so saving never waits on the filesystem.
+// A header naming the emulator is followed by chunks, each tagged and versioned by the core that
+// wrote it. Readers look chunks up by tag so a core can add chunks without breaking older states,
+// and refuse a chunk from a newer build rather than misread it. Buffers must be 32 bit aligned.
+
+#define STATE_MAGIC     ('E' | ('8' << 8) | ('S' << 16) | ('T' << 24))
+#define STATE_VERSION   1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t len;           // header and all chunks
+    char emu[12];
+} state_header;
+
+typedef struct {
+    char tag[4];
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t len;           // data following, chunks are padded to 4 bytes
+} state_chunk;
+
+static uint8_t* _state = 0;         // state being saved or loaded, only valid inside save_state/load_state
+static int _state_len = 0;          // room when saving, size when loading
+static int _state_pos = 0;          // end of the chunks written so far
+static state_chunk* _state_open = 0;
+static bool _state_full = false;
+
+extern "C"
+uint8_t* state_begin(const char* tag, int version, int* room)
+{
+    if (!_state || _state_open || _state_len - _state_pos < (int)sizeof(state_chunk)) {
+        _state_full = true;
+        return NULL;
+    }
+    _state_open = (state_chunk*)(_state + _state_pos);
+    memcpy(_state_open->tag,tag,4);
+    _state_open->version = version;
+    _state_open->reserved = 0;
+    _state_open->len = 0;
+    *room = _state_len - _state_pos - sizeof(state_chunk);
+    return (uint8_t*)(_state_open + 1);
+}
+
+extern "C"
+int state_end(int len)
+{
+    if (!_state_open)
+        return -1;
+    int end = _state_pos + sizeof(state_chunk) + ((len + 3) & ~3);
+    _state_open = 0;
+    if (len < 0 || end > _state_len) {
+        _state_full = true;
+        return -1;
+    }
+    ((state_chunk*)(_state + _state_pos))->len = len;
+    _state_pos = end;
+    return 0;
+}
+
+extern "C"
+int state_put(const char* tag, int version, const void* data, int len)
+{
+    int room;
+    uint8_t* d = state_begin(tag,version,&room);
+    if (!d || len > room) {
+        state_end(-1);
+        return -1;
+    }
+    memcpy(d,data,len);
+    return state_end(len);
+}
+
+extern "C"
+const uint8_t* state_find(const char* tag, int* version, int* len)
+{
+    int pos = sizeof(state_header);
+    while (_state && pos + (int)sizeof(state_chunk) <= _state_len) {
+        const state_chunk* c = (const state_chunk*)(_state + pos);
+        int end = pos + sizeof(state_chunk) + ((c->len + 3) & ~3);
+        if (end > _state_len)
+            break;
+        if (memcmp(c->tag,tag,4) == 0) {
+            *version = c->version;
+            *len = c->len;
+            return (const uint8_t*)(c + 1);
+        }
+        pos = end;
+    }
+    return NULL;
+}
+
+// copy a chunk of exactly len bytes written by this version or an older one
+extern "C"
+int state_get(const char* tag, int version, void* data, int len)
+{
+    int v,n;
+    const uint8_t* d = state_find(tag,&v,&n);
+    if (!d || v > version || n != len)
+        return -1;
+    memcpy(data,d,len);
+    return 0;
+}
+
+int Emu::save_state(uint8_t* buf, int len)
+{
+    if (len < (int)sizeof(state_header))
+        return -1;
+    _state = buf;
+    _state_len = len;
+    _state_pos = sizeof(state_header);
+    _state_open = 0;
+    _state_full = false;
+    int r = save_chunks();
+    _state = 0;
+    if (r < 0 || _state_full)
+        return -1;
+
+    state_header* h = (state_header*)buf;
+    h->magic = STATE_MAGIC;
+    h->version = STATE_VERSION;
+    h->len = _state_pos;
+    memset(h->emu,0,sizeof(h->emu));
+    strncpy(h->emu,name.c_str(),sizeof(h->emu)-1);
+    return _state_pos;
+}
+
+int Emu::load_state(const uint8_t* buf, int len, bool battery)
+{
+    const state_header* h = (const state_header*)buf;
+    if (len < (int)sizeof(state_header) || h->magic != STATE_MAGIC || h->version > STATE_VERSION ||
+        (int)h->len > len || strncmp(h->emu,name.c_str(),sizeof(h->emu)-1))
+        return -1;
+    _state = (uint8_t*)buf;
+    _state_len = h->len;
+    int r = load_chunks();
+    _state = 0;
+    if (r == 0 && battery)
+        battery_write_all();
+    return r;
+}
+
+//====================================================================================================
+// Rewind. Every REWIND_INTERVAL frames the state is saved and XORed against the snapshot before it.
+// Almost none of it changes between snapshots, so each delta is mostly zero words and is stored as
+// runs in a fixed ring. The newest snapshot is kept whole; XORing the newest delta into it gives the
+// one before, so holding the rewind key walks back through history while new deltas push the oldest
+// off the ring. The ring and both snapshots come from the media arena and go with it on eject.
+
+#ifdef REWIND
+
+#define REWIND_INTERVAL     10              // frames between snapshots
+#define REWIND_STEP         3               // frames each snapshot is shown for while rewinding
+#define REWIND_RING         (48*1024)       // bytes of deltas, and the most a state may take
+#define REWIND_ENTRIES      256
+#define REWIND_HEAP_MIN     (32*1024)       // heap left for the rest of the firmware, or no rewind
+
+typedef struct {
+    uint32_t pos;           // words into the ring
+    uint32_t len;
+} rewind_entry;
+
+static bool media_fits(int size, int spare);
+
+static uint32_t* _rewind_state = 0;         // newest snapshot
+static uint32_t* _rewind_scratch = 0;       // the one being taken, then its delta, just after it
+static int _rewind_words = 0;               // size of both
+static int _rewind_room = 0;                // words they have space for, from the media arena
+static bool _rewind_valid = false;          // _rewind_state holds a snapshot
+static uint32_t* _rewind_ring = 0;
+static rewind_entry _rewind_entries[REWIND_ENTRIES];
+static int _rewind_first = 0;               // oldest delta
+static int _rewind_count = 0;
+static int _rewind_frames = 0;              // since the last snapshot
+static int _rewind_shown = 0;               // frames the current snapshot has been shown for
+static const char* _rewind_off = 0;         // why there is no history for this media, don't keep trying
+
+// code a delta as (zero words << 16 | literal words) headers followed by the literals
+// returns the coded length in words, out may be NULL to just measure it
+static int rewind_code(const uint32_t* d, int n, uint32_t* out)
+{
+    int len = 0;
+    int i = 0;
+    while (i < n) {
+        int z = i;
+        while (i < n && !d[i] && i - z < 0xFFFF)
+            i++;
+        int l = i;
+        while (i < n && d[i] && i - l < 0xFFFF)
+            i++;
+        if (out) {
+            out[len] = ((uint32_t)(l - z) << 16) | (i - l);
+            for (int j = l; j < i; j++)
+                out[len + 1 + j - l] = d[j];
+        }
+        len += 1 + i - l;
+    }
+    return len;
+}
+
+// xor a coded delta into a snapshot
+static void rewind_apply(uint32_t* s, const uint32_t* c, int len)
+{
+    int i = 0;
+    while (len > 0) {
+        uint32_t h = *c++;
+        int n = h & 0xFFFF;
+        i += h >> 16;
+        len -= 1 + n;
+        while (n--)
+            s[i++] ^= *c++;
+    }
+}
+
+// the buffers stay in the media arena until eject, the next open reuses them if they are big enough
+static void rewind_free()
+{
+    _rewind_words = 0;
+    _rewind_valid = false;
+    _rewind_count = 0;
+}
+
+// the first snapshot is saved into the empty ring, which sizes the other two buffers
+static bool rewind_open(Emu* emu)
+{
+    if (!_rewind_ring) {
+        if (media_fits(REWIND_RING,REWIND_HEAP_MIN))
+            _rewind_ring = (uint32_t*)MALLOC_MEDIA(REWIND_RING,"rewind_ring");
+        if (!_rewind_ring) {
+            _rewind_off = "rewind off, not enough memory";
+            return false;
+        }
+    }
+
+    int n = emu->save_state((uint8_t*)_rewind_ring,REWIND_RING);
+    if (n <= 0) {
+        _rewind_off = "rewind off, state too big";
+        return false;
+    }
+    int words = (n + 3) >> 2;
+    if (words > _rewind_room) {
+        if (media_fits(words*8,REWIND_HEAP_MIN))
+            _rewind_state = (uint32_t*)MALLOC_MEDIA(words*8,"rewind_state");
+        if (!_rewind_state) {
+            _rewind_off = "rewind off, not enough memory";
+            return false;
+        }
+        _rewind_scratch = _rewind_state + words;
+        _rewind_room = words;
+    }
+    _rewind_words = words;
+    memcpy(_rewind_state,_rewind_ring,n);
+    memset((uint8_t*)_rewind_state + n,0,words*4 - n);
+    _rewind_valid = true;
+    return true;
+}
+
+static bool rewind_overlaps(int pos, int len)
+{
+    for (int i = 0; i < _rewind_count; i++) {
+        const rewind_entry& e = _rewind_entries[(_rewind_first + i) % REWIND_ENTRIES];
+        if ((int)e.pos < pos + len && pos < (int)(e.pos + e.len))
+            return true;
+    }
+    return false;
+}
+
+// find room for len words after the newest delta, dropping the oldest ones in the way
+static int rewind_alloc(int len)
+{
+    if (len > REWIND_RING/4) {
+        _rewind_count = 0;      // can't store it, and the older deltas don't lead anywhere without it
+        return -1;
+    }
+    int pos = 0;
+    if (_rewind_count) {
+        const rewind_entry& e = _rewind_entries[(_rewind_first + _rewind_count - 1) % REWIND_ENTRIES];
+        pos = e.pos + e.len;
+        if (pos + len > REWIND_RING/4)
+            pos = 0;
+    }
+    while (_rewind_count && (_rewind_count == REWIND_ENTRIES || rewind_overlaps(pos,len))) {
+        _rewind_first = (_rewind_first + 1) % REWIND_ENTRIES;
+        _rewind_count--;
+    }
+    rewind_entry& e = _rewind_entries[(_rewind_first + _rewind_count++) % REWIND_ENTRIES];
+    e.pos = pos;
+    e.len = len;
+    return pos;
+}
+
+static void rewind_snapshot(Emu* emu)
+{
+    if (!_rewind_words) {
+        if (_rewind_off)
+            return;
+        if (!rewind_open(emu))
+            printf("%s for %s\n",_rewind_off,emu->name.c_str());
+        return;
+    }
+
+    int n = emu->save_state((uint8_t*)_rewind_scratch,_rewind_words*4);
+    if (n < 0) {
+        rewind_free();          // grew, resize next time around
+        return;
+    }
+    memset((uint8_t*)_rewind_scratch + n,0,_rewind_words*4 - n);
+
+    if (!_rewind_valid) {
+        memcpy(_rewind_state,_rewind_scratch,_rewind_words*4);
+        _rewind_valid = true;
+        return;
+    }
+
+    // scratch becomes the delta back to the previous snapshot, state the new one
+    uint32_t* s = _rewind_state;
+    uint32_t* d = _rewind_scratch;
+    for (int i = 0; i < _rewind_words; i++) {
+        uint32_t x = d[i];
+        d[i] = x ^ s[i];
+        s[i] = x;
+    }
+
+    int len = rewind_code(d,_rewind_words,NULL);
+    int pos = rewind_alloc(len);
+    if (pos >= 0)
+        rewind_code(d,_rewind_words,_rewind_ring + pos);
+}
+
+// show each snapshot for a few frames then step back to the one before
+static void rewind_back(Emu* emu)
+{
+    if (!_rewind_valid)
+        return;
+    if (_rewind_shown >= REWIND_STEP && _rewind_count) {
+        const rewind_entry& e = _rewind_entries[(_rewind_first + --_rewind_count) % REWIND_ENTRIES];
+        rewind_apply(_rewind_state,_rewind_ring + e.pos,e.len);
+        _rewind_shown = 0;
+    }
+    if (emu->load_state((uint8_t*)_rewind_state,_rewind_words*4,false) < 0) {   // the same few frames, no .sav flush
+        rewind_free();
+        return;
+    }
+    _rewind_shown++;
+    _rewind_frames = 0;
+}
+
+// called once a frame before the emulator runs, back while the rewind key is held
+void rewind_update(Emu* emu, bool back)
+{
+    if (back) {
+        rewind_back(emu);
+        return;
+    }
+    _rewind_shown = 0;
+    if (++_rewind_frames >= REWIND_INTERVAL) {
+        _rewind_frames = 0;
+        rewind_snapshot(emu);
+    }
+}
+
+// new media, history from the old one can't be loaded
+void rewind_reset()
+{
+    rewind_free();
+    _rewind_first = 0;
+    _rewind_frames = 0;
+    _rewind_shown = 0;
+    _rewind_off = 0;
+}
+
+// why holding the rewind key does nothing, 0 if there is history
+const char* rewind_off()
+{
+    return _rewind_off;
+}
+
+// the media arena is about to be emptied, the buffers go with it
+static void rewind_release()
+{
+    rewind_reset();
+    _rewind_state = _rewind_scratch = _rewind_ring = 0;
+    _rewind_room = 0;
+}
+#else
+void rewind_update(Emu* emu, bool back) {}
+void rewind_reset() {}
+const char* rewind_off() { return "rewind is not built in"; }
+static void rewind_release() {}
+#endif
+
+//====================================================================================================
+// Arenas. Big buffers are carved out of a few blocks that are kept for the life of the firmware and
+// emptied in one go rather than freed a piece at a time. The core arena holds the running core and is
+// emptied by arena_begin when switching cores, so peak RAM is the biggest core rather than the sum.
+// The media arena holds whatever belongs to the cart or disk (cart RAM, mapper state, rewind buffers)
+// and is emptied by arena_eject. The heap never sees the large allocations come and go.
+// Blocks are byte addressable, nofrendo and smsplus write a byte at a time. The Atari's buffers
+// always came from MALLOC_CAP_32BIT memory, so MALLOC32_IRAM lets them take blocks from the IRAM heap
+// once byte addressable memory runs out, rather than restart.
+
+#define ARENA_BLOCKS    8
+#define ARENA_BLOCK_MIN (16*1024)   // small buffers share blocks at least this big
+#define ARENA_LABELS    16
+#define ARENA_CORES     4
+
+class Arena {
+    struct Block {
+        uint8_t* base;
+        int size;
+        int used;
+        bool words;         // from the IRAM heap, 32 bit access only
+    };
+    struct Label {
+        const char* name;
+        int used;
+        int peak;
+    };
+    Block _blocks[ARENA_BLOCKS];
+    Label _labels[ARENA_LABELS];
+    int _block_count;
+    int _used;
+    int _peak;
+
+    static uint8_t* grow(int size, bool* words)
+    {
+#ifdef ESP_PLATFORM
+        uint8_t* p = (uint8_t*)heap_caps_malloc(size,MALLOC_CAP_8BIT);
+        if (!p && *words)
+            return (uint8_t*)heap_caps_malloc(size,MALLOC_CAP_32BIT);
+        *words = false;
+        return p;
+#else
+        *words = false;
+        return (uint8_t*)malloc(size);
+#endif
+    }
+
+    // best fit in the blocks we have, otherwise another block
+    Block* find(int size, bool words)
+    {
+        Block* b = 0;
+        for (int i = 0; i < _block_count; i++) {
+            int room = _blocks[i].size - _blocks[i].used;
+            if (room >= size && (words || !_blocks[i].words) && (!b || room < b->size - b->used))
+                b = _blocks + i;
+        }
+        if (b || _block_count == ARENA_BLOCKS)
+            return b;
+        int n = max(size,ARENA_BLOCK_MIN);
+        uint8_t* p = grow(n,&words);
+        if (!p)
+            return 0;
+        b = _blocks + _block_count++;
+        b->base = p;
+        b->size = n;
+        b->used = 0;
+        b->words = words;
+        return b;
+    }
+
+    // labels are string literals that are kept, the last slot takes any overflow
+    void count(const char* name, int size)
+    {
+        int i;
+        for (i = 0; i < ARENA_LABELS-1 && _labels[i].name && strcmp(_labels[i].name,name); i++)
+            ;
+        Label& l = _labels[i];
+        l.name = i == ARENA_LABELS-1 ? "other" : name;
+        l.used += size;
+        l.peak = max(l.peak,l.used);
+    }
+
+public:
+    const char* name;
+
+    Arena(const char* n) : _block_count(0), _used(0), _peak(0), name(n)
+    {
+        memset(_labels,0,sizeof(_labels));
+    }
+
+    // 32 bit aligned, 0 if there is no room. words if the buffer may live in 32 bit only memory
+    void* alloc(int size, const char* label, bool words = false)
+    {
+        size = (size + 3) & ~3;
+        Block* b = find(size,words);
+        if (!b)
+            return 0;
+        void* r = b->base + b->used;
+        b->used += size;
+        _used += size;
+        _peak = max(_peak,_used);
+        count(label,size);
+        return r;
+    }
+
+    // whether alloc(size) would succeed without leaving the heap less than spare bytes
+    bool fits(int size, int spare) const
+    {
+        size = (size + 3) & ~3;
+        for (int i = 0; i < _block_count; i++)
+            if (!_blocks[i].words && _blocks[i].size - _blocks[i].used >= size)
+                return true;
+        if (_block_count == ARENA_BLOCKS)
+            return false;
+#ifdef ESP_PLATFORM
+        int n = max(size,ARENA_BLOCK_MIN);
+        return (int)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) >= n &&
+            (int)heap_caps_get_free_size(MALLOC_CAP_8BIT) - n >= spare;
+#else
+        return true;
+#endif
+    }
+
+    bool owns(const void* p) const
+    {
+        for (int i = 0; i < _block_count; i++)
+            if ((const uint8_t*)p >= _blocks[i].base && (const uint8_t*)p < _blocks[i].base + _blocks[i].size)
+                return true;
+        return false;
+    }
+
+    // nothing allocated since the last reset may be touched after this
+    void reset()
+    {
+        for (int i = 0; i < _block_count; i++)
+            _blocks[i].used = 0;
+        for (int i = 0; i < ARENA_LABELS; i++)
+            _labels[i].used = 0;
+        _used = 0;
+    }
+
+    int used() const { return _used; }
+
+    // what is held by each label now and at most, and the room left at the end of each block
+    void report() const
+    {
+        int reserved = 0;
+        int largest = 0;
+        int words = 0;
+        for (int i = 0; i < _block_count; i++) {
+            reserved += _blocks[i].size;
+            largest = max(largest,_blocks[i].size - _blocks[i].used);
+            words += _blocks[i].words;
+        }
+        printf("%s arena %dk in %d blocks (%d 32 bit only), %dk used, %dk peak, %dk free (largest %dk)\n",
+            name,reserved/1024,_block_count,words,_used/1024,_peak/1024,(reserved-_used)/1024,largest/1024);
+        for (int i = 0; i < ARENA_LABELS && _labels[i].name; i++)
+            printf("  %s %d (peak %d)\n",_labels[i].name,_labels[i].used,_labels[i].peak);
+    }
+};
+
+static Arena _core_arena("core");
+static Arena _media_arena("media");
+static const char* _arena_core = "";
+static const char* _arena_names[ARENA_CORES];
+static int _arena_high[ARENA_CORES];    // most each core has had at once, media included
+
+static void arena_high()
+{
+    int i;
+    for (i = 0; i < ARENA_CORES-1 && _arena_names[i] && strcmp(_arena_names[i],_arena_core); i++)
+        ;
+    _arena_names[i] = _arena_core;
+    _arena_high[i] = max(_arena_high[i],_core_arena.used() + _media_arena.used());
+}
+
+static void* core_alloc(int size, const char* name, bool words)
+{
+    void* r = _core_arena.alloc(size,name,words);
+    if (!r) {
+        printf("MALLOC32 FAILED allocation of %s:%d for %s!!!!####################\n",name,size,_arena_core);
+        arena_report();
+#ifdef ESP_PLATFORM
+        esp_restart();
+#else
+        abort();
+#endif
+    }
+    arena_high();
+    printf("MALLOC32 allocation of %s:%d %p\n",name,size,r);
+    return r;
+}
+
+void* MALLOC32(int size, const char* name)
+{
+    return core_alloc(size,name,false);
+}
+
+void* MALLOC32_IRAM(int size, const char* name)
+{
+    return core_alloc(size,name,true);
+}
+
+void* MALLOC_MEDIA(int size, const char* name)
+{
+    void* r = _media_arena.alloc(size,name);
+    if (!r) {
+        printf("MALLOC_MEDIA failed allocation of %s:%d for %s\n",name,size,_arena_core);
+        return 0;
+    }
+    arena_high();
+    return r;
+}
+
+// optional media buffers, like the rewind history, leave spare bytes of heap for everything else
+static bool media_fits(int size, int spare)
+{
+    return _media_arena.fits(size,spare);
+}
+
+void FREE32(void* p)
+{
+    if (!p || _core_arena.owns(p) || _media_arena.owns(p))
+        return;
+    free(p);
+}
+
+// the cart is going away: save its RAM, drop the rewind history and everything it allocated
+void arena_eject()
+{
+    battery_close();
+    rewind_release();
+    _media_arena.reset();
+}
+
+// nothing allocated for the last core may be touched after this
+void arena_begin(const char* core)
+{
+    arena_eject();
+    _core_arena.reset();
+    _arena_core = core;
+}
+
+void arena_report()
+{
+    _core_arena.report();
+    _media_arena.report();
+    printf("arena high water");
+    for (int i = 0; i < ARENA_CORES && _arena_names[i]; i++)
+        printf(" %s:%dk",_arena_names[i],_arena_high[i]/1024);
+    printf("\n");
+#ifdef ESP_PLATFORM
+    int heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    int block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    printf("heap %dk free, largest block %dk\n",heap/1024,block/1024);
+#endif
+}
@@ -47,8 +47,16 @@ enum {
 #define GRAY_LEVEL       IRE((100-7.5)/2)
 #define WHITE_LEVEL      IRE(100)
 
-extern "C"
-void* MALLOC32(int size, const char* name);
+// The running core's big buffers come from an arena that is emptied when the gui switches cores,
+// so the same memory serves whichever core is running. Whatever belongs to the cart comes from a
+// second arena that is emptied on eject. Names are string literals, usage is reported per name.
+extern "C" void* MALLOC32(int size, const char* name);  // 32 bit aligned, restarts if there is no room
+extern "C" void* MALLOC32_IRAM(int size, const char* name);    // same, may fall back to the 32 bit only IRAM heap
+extern "C" void* MALLOC_MEDIA(int size, const char* name);  // 32 bit aligned, 0 if there is no room
+extern "C" void FREE32(void* p);                         // arena memory waits for a reset, the rest is free()d
+void arena_begin(const char* core);                      // empty both arenas for the next core
+void arena_eject();                                      // save cart RAM and empty the media arena
+void arena_report();                                     // usage by name, peaks, free space and high water of every core
 
 class Emu {
 public:
@@ -125,6 +133,14 @@ public:
     virtual int update() = 0;
     virtual uint8_t** video_buffer() = 0;
     virtual int audio_buffer(int16_t* b, int max_len) = 0;
+    virtual int idle_cycles() { return 0; };   // cpu cycles fast-forwarded in polling loops since last call
+    virtual void tile_cache(uint32_t* hits, uint32_t* misses, uint32_t* evictions) { *hits = *misses = *evictions = 0; };  // pattern cache counters since last call
+
+    // save states live in caller supplied, 32 bit aligned RAM and never touch the filesystem
+    int save_state(uint8_t* buf, int len);          // bytes used or -1 if the state didn't fit
+    int load_state(const uint8_t* buf, int len, bool battery = true);  // 0 or -1 if buf doesn't hold a state for this emulator, battery marks cart RAM for saving
+    virtual int save_chunks() { return -1; };       // core state, written with state_put/state_begin
+    virtual int load_chunks() { return -1; };       // and read back with state_get/state_find
 
     virtual const uint32_t* ntsc_palette() { return NULL; };
     virtual const uint32_t* pal_palette() { return NULL; };
@@ -132,9 +148,11 @@ public:
     virtual const uint32_t* composite_palette();
 };
 
-void gui_start(Emu* emu, const char* path);
+void gui_start(Emu* emu);                  // media for every core is listed, the newest is inserted
 void gui_hid(const uint8_t* hid, int len);  // Parse HID event
 void gui_update();
+uint8_t* gui_line(uint8_t* src, int y);    // from the video isr, src or a copy of it with the menu composited
+extern uint32_t _audio_ticks;           // cpu ticks spent producing emulator audio
 void gui_key(int keycode, int pressed, int mod);
 
 extern "C"
@@ -147,12 +165,66 @@ extern "C" void unmap_file(uint8_t* ptr);
 extern "C" FILE* mkfile(const char* path);
 extern "C" int unpack(const char* dst_path, const uint8_t* d, int len);
 
+// battery backed cart RAM, dirty pages are saved to a .sav next to the cart in the background
+void battery_open(const std::string& path, uint8_t* data, int len);
+void battery_close();
+void battery_update();                  // once a frame
+extern "C" void battery_write(int offset);
+extern uint32_t _battery_flushes;       // profiling
+extern uint32_t _battery_pages;
+extern uint32_t _battery_flush_us;      // slowest flush
+
+// input reports are drained and applied once a frame, before the emulator runs
+extern uint32_t _input_reports;         // profiling
+extern uint32_t _input_latency_us;      // slowest from arrival to the end of the frame that used it
+extern uint32_t _input_latency_total;
+
+// rewind, snapshots every few frames kept as compressed deltas in a fixed ring, held on F12
+// a 48KB ring and two copies of the state in the media arena, off for media it doesn't fit
+#define REWIND
+void rewind_update(Emu* emu, bool back);    // once a frame before the emulator runs, back while rewinding
+void rewind_reset();                    // new media, forget the history
+const char* rewind_off();               // why there is no history, 0 if there is
+
+// save state chunks, only valid inside Emu::save_state/load_state
+extern "C" uint8_t* state_begin(const char* tag, int version, int* room);   // start a chunk with room bytes free
+extern "C" int state_end(int len);                                          // close it with len bytes used
+extern "C" int state_put(const char* tag, int version, const void* data, int len);
+extern "C" const uint8_t* state_find(const char* tag, int* version, int* len);
+extern "C" int state_get(const char* tag, int version, void* data, int len); // exact size, same or older version
+
 void audio_write_16(const int16_t* s, int len, int channels);
+uint32_t cpu_ticks();
 int get_hid_ir(uint8_t* dst);
-uint32_t generic_map(uint32_t m, const uint32_t* target);
+
+// maps a 16 bit controller mask to emulator bits with a table per nibble
+class InputMap {
+    uint32_t _nibble[4][16];
+public:
+    InputMap(const uint32_t* m);    // m[0] is what 0x8000 maps to
+    uint32_t operator()(uint32_t bits) const
+    {
+        return _nibble[0][(bits >> 12) & 0xF] | _nibble[1][(bits >> 8) & 0xF] |
+            _nibble[2][(bits >> 4) & 0xF] | _nibble[3][bits & 0xF];
+    }
+};
+uint32_t wii_map(int index, const InputMap& common, const InputMap& classic);
 
 Emu* NewAtari800(int ntsc = 1);
 Emu* NewNofrendo(int ntsc = 1);
 Emu* NewSMSPlus(int ntsc = 1);
 
+// every core is linked in, media picks the one that runs by its extension
+typedef struct {
+    int flavor;                 // EMU_ATARI,EMU_NES,EMU_SMS
+    const char* name;           // also the folder holding its media
+    const char** ext;
+    Emu* (*create)(int ntsc);
+} emu_core;
+
+extern const emu_core _emu_cores[];             // ends with a null name
+const emu_core* find_core(int flavor);
+const emu_core* media_core(const std::string& path);   // 0 if no core plays it
+Emu* emu_switch(const emu_core* core);          // in the sketch, replaces the running core under the video
+
 #endif /* emu_hpp */
@@ -24,6 +24,9 @@ extern "C" {
 #include "atari800/sound.h"
 #include "atari800/akey.h"
 #include "atari800/memory.h"
+#include "atari800/cassette.h"
+#include "atari800/cpu.h"
+#include "atari800/libatari800_statesav.h"
 }
 
 
@@ -649,6 +652,7 @@ const char* _atari_help[] = {
     "  Shift+F5   - Cold Reset",
     "  F6         - Help (XL/XE)",
     "  F7         - Break",
+    "  F12        - Rewind (hold)",
     "",
     "Wiimote (held sideways):",
     "  D Pad      - Joystick",
@@ -940,17 +944,32 @@ Sound_setup_t Sound_desired = {
     0
 };
 
+// frames run (undrawn and silent) per displayed frame while a tape is loading, 0 to disable
+#define TAPE_WARP_FRAMES 8
+
 class EmuAtari800 : public Emu {
     uint8_t** _lines;
+    int _tape_block;
 public:
     EmuAtari800(int ntsc) : Emu("atari800",384,240,ntsc,(16 | (1 << 8)),4,EMU_ATARI)
     {
         _lines = 0;
+        _tape_block = 0;
         _ext = _atari_ext;
         _help = _atari_help;
         Sound_desired.freq = audio_frequency;
     }
 
+    virtual ~EmuAtari800()
+    {
+        if (!_lines)
+            return;
+        libatari800_exit();     // buffers go with the arena, the next Atari800 starts over
+        Screen_atari = 0;
+        MEMORY_mem = 0;
+        under_atarixl_os = under_cart809F = under_cartA0BF = 0;
+    }
+
     virtual void gen_palettes()
     {
         make_atari_rgb_palette();
@@ -1051,6 +1070,10 @@ public:
         0,                  //GENERIC_MENU    0x0001
     };
 
+    const InputMap _common_map{_common_atari};
+    const InputMap _classic_map{_classic_atari};
+    const InputMap _generic_map{_generic_atari};
+
     // raw HID data. handle WII mappings
     virtual void hid(const uint8_t* d, int len)
     {
@@ -1062,10 +1085,10 @@ public:
             uint32_t p;
             if (ir) {
                 uint16_t m =  i < 2 ? (d[0] + (d[1] << 8)) : 0;
-                p = generic_map(m,_generic_atari);
+                p = _generic_map(m);
                 d += 2;
             } else
-                p = wii_map(i,_common_atari,_classic_atari);
+                p = wii_map(i,_common_map,_classic_map);
             _joy[i] = p & 0x0F;
             _trig[i] = (p >> 4) & 1;
             if (i == 0)
@@ -1153,20 +1176,20 @@ public:
             INPUT_key_code = keycode;
     }
 
-    // allocate most of the big stuff in 32 bit  mem
+    // allocate most of the big stuff in 32 bit  mem, IRAM if that's all there is
     void init_screen()
     {
-        Screen_atari = (ULONG*)MALLOC32(Screen_WIDTH*Screen_HEIGHT,"Screen_atari");    // 32 bit access plz
-        MEMORY_mem = (uint8_t*)MALLOC32(64*1024 + 4,"MEMORY_mem");
-        _lines = (uint8_t**)MALLOC32(height*sizeof(uint8_t*),"_lines");
+        Screen_atari = (ULONG*)MALLOC32_IRAM(Screen_WIDTH*Screen_HEIGHT,"Screen_atari");    // 32 bit access plz
+        MEMORY_mem = (uint8_t*)MALLOC32_IRAM(64*1024 + 4,"MEMORY_mem");
+        _lines = (uint8_t**)MALLOC32_IRAM(height*sizeof(uint8_t*),"_lines");
         const uint8_t* s = (uint8_t*)Screen_atari;
         for (int y = 0; y < height; y++) {
             _lines[y] = (uint8_t*)s;
             s += width;
         }
-        under_atarixl_os = (uint8_t*)MALLOC32(16*1024,"under_atarixl_os");
-        under_cart809F = (uint8_t*)MALLOC32(8*1024,"under_cart809F");
-        under_cartA0BF = (uint8_t*)MALLOC32(8*1024,"under_cartA0BF");
+        under_atarixl_os = (uint8_t*)MALLOC32_IRAM(16*1024,"under_atarixl_os");
+        under_cart809F = (uint8_t*)MALLOC32_IRAM(8*1024,"under_cart809F");
+        under_cartA0BF = (uint8_t*)MALLOC32_IRAM(8*1024,"under_cartA0BF");
         clear_screen();
     }
 
@@ -1311,15 +1334,76 @@ public:
         string cfg = get_cfg(path);
         cfg = patch_cfg(cfg,flags);
         int argc = parse_cfg(cfg,s,argv);
+
+        // same machine? just swap the media and coldstart
+        if (libatari800_reload(argc,&argv[0]))
+            return 0;
         libatari800_init(argc,&argv[0]);
         return 0;
     }
 
+    // Standard OS loads are already trapped by the SIO patch and copied a block at a time.
+    // Custom loaders read POKEY serial in real time, so run them flat out while the motor is on
+    void warp_tape()
+    {
+        if (!CASSETTE_readable || CASSETTE_record) {
+            _tape_block = 0;
+            return;
+        }
+        for (int i = 0; i < TAPE_WARP_FRAMES && CASSETTE_readable; i++)
+            if (!libatari800_skip_frame())
+                break;
+
+        int block = CASSETTE_GetPosition();
+        if (block != _tape_block) {
+            _tape_block = block;
+            char buf[32];
+            sprintf(buf,"LOADING %d/%d",block,CASSETTE_GetSize());
+            gui_msg(buf);
+        }
+    }
+
     virtual int update()
     {
+        if (TAPE_WARP_FRAMES)
+            warp_tape();
         return libatari800_next_frame(NULL);
     }
 
+    // atari800's own versioned state format, written straight into the chunk
+    virtual int save_chunks()
+    {
+        int room;
+        statesav_tags_t tags;
+        uint8_t* d = state_begin("A800",1,&room);
+        if (!d || !LIBATARI800_StateSave(d,room,&tags))
+            return state_end(-1);
+        return state_end(tags.size);
+    }
+
+    // atari800 applies the state as it reads it, after checking the header and its version. Check those
+    // here so a chunk that isn't a state is turned away untouched. One cut short or damaged past the
+    // header fails part way through, so start the machine over rather than leave it half loaded
+    virtual int load_chunks()
+    {
+        int version,len;
+        const uint8_t* d = state_find("A800",&version,&len);
+        if (!d || version > 1 || len < 10 || memcmp(d,"ATARI800",8))
+            return -1;
+        if (!LIBATARI800_StateLoad((UBYTE*)d,len)) {
+            Atari800_Coldstart();
+            return -1;
+        }
+        return 0;
+    }
+
+    virtual int idle_cycles()
+    {
+        int n = CPU_idle_cycles;
+        CPU_idle_cycles = 0;
+        return n;
+    }
+
     virtual uint8_t** video_buffer()
     {
         return _lines;
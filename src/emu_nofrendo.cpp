@@ -106,6 +106,7 @@ void make_yuv_palette(const char* name, const uint32_t* pal, int len);
 
 extern rgb_t nes_palette[64];
 extern "C" void pal_generate();
+extern "C" void input_fourscore(int enable, int pad2, int pad3);
 void make_alt_pal()
 {
     pal_generate();
@@ -165,6 +166,21 @@ int nes_emulate_init(const char* path, int width, int height);
 extern "C"
 uint8_t** nes_emulate_frame(bool draw_flag);
 
+extern "C"
+void nes_emulate_exit();
+
+extern "C"
+int nes_idle_cycles();
+
+extern "C"
+uint8_t* nes_battery_ram(int* len);
+
+extern "C"
+int nes_save_state();
+
+extern "C"
+int nes_load_state();
+
 static void (*nes_sound_cb)(void *buffer, int length) = 0;
 
 extern uint32_t nes_pal[256];
@@ -176,6 +192,7 @@ const char* _nes_help[] = {
     "  Option     - Button B",
     "  Return     - Start",
     "  Tab        - Select",
+    "  F12        - Rewind (hold)",
     "",
     "Wiimote (held sideways):",
     "  +          - Start",
@@ -196,7 +213,7 @@ extern "C"
 void osd_getsoundinfo(sndinfo_t *info)
 {
     info->sample_rate = _audio_frequency;
-    info->bps = 8;
+    info->bps = 16;
 }
 
 extern "C"
@@ -217,6 +234,14 @@ public:
         _audio_frequency = audio_frequency;
     }
 
+    virtual ~EmuNofrendo()
+    {
+        nes_emulate_exit();     // buffers go with the arena
+        unmap_file(_nofrendo_rom);
+        _nofrendo_rom = 0;
+        nes_sound_cb = 0;
+    }
+
     virtual void gen_palettes()
     {
         make_nes_palette(3);
@@ -358,21 +383,47 @@ public:
         0,                      //GENERIC_MENU    0x0001
     };
 
+    // event_joypad1_ bits to the INP_PAD_ bits the four score shifts out
+    const uint32_t _fourscore_nes[16] = {
+        0,0,0,0,0,0,0,0,
+        0x02,   // b
+        0x01,   // a
+        0x04,   // select
+        0x08,   // start
+        0x80,   // right
+        0x40,   // left
+        0x20,   // down
+        0x10,   // up
+    };
+
+    const InputMap _common_map{_common_nes};
+    const InputMap _classic_map{_classic_nes};
+    const InputMap _generic_map{_generic_nes};
+    const InputMap _fourscore_map{_fourscore_nes};
+
     // raw HID data. handle WII/IR mappings
+    // wiimotes 3 and 4 go through a four score
     virtual void hid(const uint8_t* d, int len)
     {
         if (d[0] != 0x32 && d[0] != 0x42)
             return;
         bool ir = *d++ == 0x42;
 
+        if (!ir) {
+            bool four = wii_states[2].flags || wii_states[3].flags;
+            input_fourscore(four,
+                _fourscore_map(wii_map(2,_common_map,_classic_map) & 0xFF),
+                _fourscore_map(wii_map(3,_common_map,_classic_map) & 0xFF));
+        }
+
         for (int i = 0; i < 2; i++) {
             uint32_t p;
             if (ir) {
                 int m = d[0] + (d[1] << 8);
-                p = generic_map(m,_generic_nes);
+                p = _generic_map(m);
                 d += 2;
             } else
-                p = wii_map(i,_common_nes,_classic_nes);
+                p = wii_map(i,_common_map,_classic_map);
 
             // reset on select + start held at the same time
             if ((p & event_joypad1_select_) && (p & event_joypad1_start_))
@@ -437,7 +488,12 @@ public:
             return -1;
         }
 
+        battery_close();                    // old cart's RAM goes with the media arena
         nes_emulate_init(path.c_str(),width,height);
+        int sram_len;
+        uint8_t* sram = nes_battery_ram(&sram_len);
+        if (sram)
+            battery_open(path,sram,sram_len);
         _lines = nes_emulate_frame(true);   // first frame!
         return 0;
     }
@@ -449,6 +505,21 @@ public:
         return 0;
     }
 
+    virtual int save_chunks()
+    {
+        return _nofrendo_rom ? nes_save_state() : -1;
+    }
+
+    virtual int load_chunks()
+    {
+        return _nofrendo_rom ? nes_load_state() : -1;
+    }
+
+    virtual int idle_cycles()
+    {
+        return nes_idle_cycles();
+    }
+
     virtual uint8_t** video_buffer()
     {
         return _lines;
@@ -457,12 +528,8 @@ public:
     virtual int audio_buffer(int16_t* b, int len)
     {
         int n = frame_sample_count();
-        if (nes_sound_cb) {
-            nes_sound_cb(b,n);  // 8 bit unsigned
-            uint8_t* b8 = (uint8_t*)b;
-            for (int i = n-1; i >= 0; i--)
-                b[i] = (b8[i] ^ 0x80) << 8;  // turn it back into signed 16
-        }
+        if (nes_sound_cb)
+            nes_sound_cb(b,n);  // signed 16 bit
         else
             memset(b,0,2*n);
         return n;
@@ -26,6 +26,10 @@ extern "C" {
 
 using namespace std;
 
+// Mark III / Japanese SMS FM unit for .sms games that look for it on port $F2. Games that don't probe $F2
+// never see it and it is only rendered while they keep it enabled, comment out to drop it
+#define SMS_FM
+
 // used by sim, rgb332 to rgb888
 const uint32_t sms_palette_rgb[0x100] = {
     0x00000000,0x00000048,0x000000B4,0x000000FF,0x00002400,0x00002448,0x000024B4,0x000024FF,
@@ -296,6 +300,7 @@ const char* _sms_help[] = {
     "  Option     - Button 2",
     "  Return     - Start",
     "  Tab        - Select",
+    "  F12        - Rewind (hold)",
     "",
     "Wiimote (held sideways):",
     "  +          - Start",
@@ -319,6 +324,17 @@ public:
         _help = _sms_help;
     }
 
+    virtual ~EmuSMSPlus()
+    {
+        if (!_lines)
+            return;
+        unmap_file(_smsplus_rom);   // buffers go with the arena
+        _smsplus_rom = 0;
+        cart.rom = 0;
+        sms_videodata = 0;
+        cacheStore = 0;
+    }
+
     virtual void gen_palettes()
     {
         gen_rgb_palette();
@@ -345,7 +361,8 @@ public:
     void init_screen()
     {
         printf("init_screen\n");
-        sms_videodata = new uint8_t[256*240];
+        sms_videodata = (uint8_t*)MALLOC32(256*240,"sms_videodata");
+        cacheStore = (uint8_t*)MALLOC32(CACHEDTILES*64,"cacheStore");
         bitmap.data = sms_videodata + 24*256;
         bitmap.width = 256;
         bitmap.height = 192;
@@ -355,7 +372,7 @@ public:
         sms.sram = sms_sram;
 
         // center on 240?
-        _lines = new uint8_t*[240];
+        _lines = (uint8_t**)MALLOC32(240*sizeof(uint8_t*),"_lines");
         const uint8_t* s = sms_videodata;
         for (int y = 0; y < 240; y++) {
             _lines[y] = (uint8_t*)s;
@@ -389,7 +406,14 @@ public:
         cart.type = get_ext(path) == "sms" ? TYPE_SMS : TYPE_GG;
 
         emu_system_init(audio_frequency);
+#ifdef SMS_FM
+        sms.use_fm = cart.type == TYPE_SMS;     // games still have to detect and enable it on $F2
+#endif
         sms_init();
+
+        battery_close();                        // save the last cart before clearing its RAM
+        memset(sms_sram,0,sizeof(sms_sram));
+        battery_open(path,sms_sram,sizeof(sms_sram));
         return 0;
     }
 
@@ -465,6 +489,10 @@ public:
         0,                  //GENERIC_MENU    0x0001
     };
 
+    const InputMap _common_map{_common_sms};
+    const InputMap _classic_map{_classic_sms};
+    const InputMap _generic_map{_generic_sms};
+
     // raw HID data. handle WII/IR mappings
     virtual void hid(const uint8_t* d, int len)
     {
@@ -476,10 +504,10 @@ public:
             uint32_t p;
             if (ir) {
                 int m = d[0] + (d[1] << 8);
-                p = generic_map(m,_generic_sms);
+                p = _generic_map(m);
                 d += 2;
             } else
-                p = wii_map(i,_common_sms,_classic_sms);
+                p = wii_map(i,_common_map,_classic_map);
             input.pad[i] = p & 0xFF;
             if (i == 0)
                 input.system = p >> 8;
@@ -523,32 +551,45 @@ public:
         return 0;
     }
 
-    virtual uint8_t** video_buffer()
+    virtual int save_chunks()
     {
-        return _lines;
+        return _smsplus_rom ? system_save_state() : -1;
+    }
+
+    virtual int load_chunks()
+    {
+        return _smsplus_rom ? system_load_state() : -1;
+    }
+
+    virtual int idle_cycles()
+    {
+        int n = z80_idle_cycles;
+        z80_idle_cycles = 0;
+        return n;
     }
 
-    static int16_t S16(int i)
+    virtual void tile_cache(uint32_t* hits, uint32_t* misses, uint32_t* evictions)
     {
-        return (i << 1) ^ 0x8000;
+        *hits = tile_cache_stats.hits;
+        *misses = tile_cache_stats.misses;
+        *evictions = tile_cache_stats.evictions;
+        tile_cache_stats.hits = tile_cache_stats.misses = tile_cache_stats.evictions = 0;
+    }
+
+    virtual uint8_t** video_buffer()
+    {
+        return _lines;
     }
 
-    int _lp;
     virtual int audio_buffer(int16_t* b, int len)
     {
         int n = frame_sample_count();
-        for (int i = 0; i < n; i++) {
-            /*
-            *b++ = S16(snd.buffer[0][i]);        // produces +ve only samples 0..32767
-            *b++ = S16(snd.buffer[1][i]);
-            */
-            int s = (snd.buffer[0][i] + snd.buffer[1][i]) >> 1;
-            _lp = (_lp*31 + s) >> 5;    // lo pass
-            s -= _lp;                   // signed
-            if (s < -32767) s = -32767; // clip
-            if (s > 32767) s = 32767;
-            *b++ = s;                   // centered signed 1 channel
-        }
+        if (snd.enabled) {
+            SN76496Update(0,b,n,sms.psg_mask);  // centered signed 1 channel
+            if (sms.use_fm && (sms.port_F2 & 1))
+                ym2413_update(b,n);             // FM mixed on top once the game has enabled it
+        } else
+            memset(b,0,2*n);
         return n;
     }
 
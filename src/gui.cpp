@@ -16,6 +16,15 @@
 */
 
 #include "emu.h"
+#include <algorithm>
+#include <unordered_map>
+#include <strings.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
 
 using namespace std;
 
@@ -313,20 +322,51 @@ const char* _menu[] = {
     NULL
 };
 
+// The menu and messages live in their own plane: character cells, a 1 bit raster of the cells
+// that is only redrawn where a cell changed, and a list of shading spans per line for the frame.
+// The video isr composites it over a copy of each line so the game framebuffer is never touched.
+
+typedef struct {
+    int16_t x0;
+    int16_t x1;
+    int16_t c;      // < 0 is luma scale, otherwise a color
+} overlay_span;
+
+#define OVERLAY_CELLS (34*22)   // the biggest of the cores, so switching cores never touches the heap
+
 class Overlay {
 public:
-    uint8_t* _buf;
+    uint8_t _buf[OVERLAY_CELLS];    // cells as the gui wants them
+    uint8_t _shown[OVERLAY_CELLS];  // cells as they are in _bits
+    uint8_t _bits[OVERLAY_CELLS*8]; // 8 lines of OVERLAY_WIDTH bytes per row of cells
     uint32_t _blit[16];
 
-    uint8_t** _lines;
+    vector<overlay_span> _spans;    // frame shading, sorted by line
+    vector<uint16_t> _span_index;   // first span for each line from _top-1, one extra at the end
+    const overlay_span* _span_list; // the same for the isr
+    const uint16_t* _span_first;
+    int _span_lines;
+
+    uint8_t _msg_bits[8*48];        // message row, one byte per cell
+    string _msg;
+    int _msg_x0;                    // cells covered by the message
+    int _msg_x1;
+    int _msg_top;
+    volatile bool _msg_visible;
+    volatile bool _visible;
+
+    uint32_t _line[384/4];          // composited line handed to blit
+
     int _width;
     int _height;
+    int _left;              // in pixels
+    int _top;
     int _hilite;
     int _flavor;
     int OVERLAY_WIDTH;
     int OVERLAY_HEIGHT;
 
-    Overlay() : _hilite(0),_buf(0)
+    Overlay() : _span_lines(0),_msg_visible(false),_visible(false),_width(0),_height(0),_hilite(0)
     {
     }
 
@@ -345,9 +385,8 @@ public:
         }
     }
 
-    void init(uint8_t** lines, int width, int height, int flavor)
+    void init(int width, int height, int flavor)
     {
-        _lines = lines;
         _width = width;
         _height = height;
         _flavor = flavor;
@@ -368,9 +407,17 @@ public:
                 set_colors(7<<2,1<<3);  // sms - 332 rgb
                 break;
         }
-
-        _buf = new uint8_t[OVERLAY_WIDTH*OVERLAY_HEIGHT];
-        memset(_buf,0,OVERLAY_WIDTH*OVERLAY_HEIGHT);
+        _left = (_width-OVERLAY_WIDTH*8)/2;
+        _top = (_height-OVERLAY_HEIGHT*8)/2;
+        _msg_top = (_height/8-2)*8;
+
+        int n = OVERLAY_WIDTH*OVERLAY_HEIGHT;   // cleared again for each core that runs, sizes differ
+        erase_msg();
+        memset(_buf,0,n);
+        memset(_shown,0,n);
+        for (int i = 0; i < n; i++)
+            raster(_bits + (i/OVERLAY_WIDTH)*OVERLAY_WIDTH*8 + i%OVERLAY_WIDTH,OVERLAY_WIDTH,0);
+        frame();
     }
 
     void set_hilite(int c)
@@ -378,63 +425,45 @@ public:
         _hilite = c;
     }
 
-    void draw_char(int c, int x, int y)
+    // 8 lines of a glyph, stride bytes apart
+    void raster(uint8_t* dst, int stride, int c)
     {
-        x *= 8;
-        y *= 8;
         const uint8_t* src = _font + c;
         for (int line = 0; line < 8; line++) {
-            uint32_t* dst = (uint32_t*)(x + _lines[y++]);
-            uint8_t b = src[0];
-            dst[0] = _blit[b >> 4]; // long words
-            dst[1] = _blit[b & 0xF];
+            *dst = *src;
+            dst += stride;
             src += 256;
         }
     }
 
-    // draw a note at bottom of screen
+    // draw a note at bottom of screen, over the game or the menu
     void draw_msg(const string& msg)
     {
-        int n = (int)msg.size();
-        for (int i = 0; i < n; i++) {
-            int x = i - n/2 + _width/16;
-            if (x >= _width)
-                break;
-            if (x >= 0)
-                draw_char(msg[i],x,_height/8-2);
+        if (msg != _msg) {
+            _msg = msg;
+            int n = (int)msg.size();
+            int cells = _width/8;
+            _msg_x0 = max(0,-n/2 + _width/16);
+            _msg_x1 = min(cells,n - n/2 + _width/16);
+            for (int x = _msg_x0; x < _msg_x1; x++)
+                raster(_msg_bits + x,cells,(uint8_t)msg[x + n/2 - _width/16]);
         }
+        _msg_visible = true;
     }
 
     void erase_msg()
     {
-        for (int i = _height-16; i < _height-8; i++)
-        {
-            uint32_t* d = (uint32_t*)_lines[i];
-            int n = _width/4;
-            while (n--)
-                *d++ = 0;
-        }
+        _msg_visible = false;
+        _msg.clear();
     }
 
-
-    // 32 bit aligned access
-    inline uint8_t getp(const uint8_t* src)
-    {
-        size_t s = (size_t)src;
-        return *((uint32_t*)(s & ~3)) >> ((s & 3) << 3);
-    }
-
-    inline void setp(uint8_t* dst, uint8_t p)
+    void show(bool visible)
     {
-        size_t s = (size_t)dst;
-        size_t shift = (s & 3) << 3;
-        uint32_t* d = (uint32_t*)(s & ~3);
-        d[0] = (d[0] & ~(0xFF << shift)) | (p << shift);
+        _visible = visible;
     }
 
-    inline void luma(uint8_t* dst, int c)
+    inline uint8_t IRAM_ATTR luma(uint8_t p, int c)
     {
-        uint8_t p = getp(dst);
         uint8_t r,g,b;
         switch (_flavor) {
             case EMU_NES:
@@ -452,60 +481,117 @@ public:
                 p = r | g | b;
                 break;
         }
-        setp(dst,p);
+        return p;
     }
 
-    void hline(int c, int x0, int x1, int y)
+    // shading is recorded per line in the order it is drawn
+    typedef vector<pair<int,overlay_span>> span_list;
+
+    void hline(span_list& s, int c, int x0, int x1, int y)
     {
-        uint8_t* dst = _lines[y] + x0;
-        if (c < 0) {
-            for (int x = x0; x < x1; x++)
-                 luma(dst++,-c);
-        } else {
-            for (int x = x0; x < x1; x++)
-                 setp(dst++,c);
-        }
+        s.push_back({y,{(int16_t)x0,(int16_t)x1,(int16_t)c}});
     }
 
-    void vline(int c, int x, int y0, int y1)
+    void vline(span_list& s, int c, int x, int y0, int y1)
     {
-        if (c < 0) {
-            for (int y = y0; y < y1; y++)
-                 luma(_lines[y] + x,-c);
-        } else {
-            for (int y = y0; y < y1; y++)
-                 setp(_lines[y] + x,c);
-        }
+        for (int y = y0; y < y1; y++)
+            hline(s,c,x,x+1,y);
     }
 
+    // drop shadow around the menu, built once
     void frame()
     {
-        int left = (_width-OVERLAY_WIDTH*8)/2;    // in pixels
-        int top = (_height-OVERLAY_HEIGHT*8)/2;
+        int left = _left;
+        int top = _top;
         int bottom = top + OVERLAY_HEIGHT*8;
         int right = left + OVERLAY_WIDTH*8;
 
+        span_list s;
+        _spans.clear();
+        _span_index.clear();
         for (int i = 0; i < 4; i++) {
             int c = -(i*32 + 16);
-            hline(c,left+i-1,right+i+1,bottom+i);
-            vline(c,right+i,top+i,bottom+i);
+            hline(s,c,left+i-1,right+i+1,bottom+i);
+            vline(s,c,right+i,top+i,bottom+i);
         }
-        hline(-32,left-1,right+1,top-1);
-        vline(-32,left-1,top-1,bottom+1);
+        hline(s,-32,left-1,right+1,top-1);
+        vline(s,-32,left-1,top-1,bottom+1);
+
+        // overlapping spans darken twice, keep the drawing order within a line
+        stable_sort(s.begin(),s.end(),[](const pair<int,overlay_span>& a, const pair<int,overlay_span>& b) {
+            return a.first < b.first;
+        });
+        int k = 0;
+        for (int y = top-1; y < bottom+4; y++) {
+            _span_index.push_back(_spans.size());
+            while (k < (int)s.size() && s[k].first == y)
+                _spans.push_back(s[k++].second);
+        }
+        _span_index.push_back(_spans.size());
+        _span_list = &_spans[0];
+        _span_first = &_span_index[0];
+        _span_lines = (int)_span_index.size()-1;
     }
 
+    // re-rasterize only the cells that changed since the last frame
     void update()
     {
-        uint8_t* s = _buf;
-        int xx = (_width-OVERLAY_WIDTH*8) >> 4;
-        int yy = (_height-OVERLAY_HEIGHT*8) >> 4;
-        for (int y = 0; y < OVERLAY_HEIGHT; y++) {
-            for (int x = 0; x < OVERLAY_WIDTH; x++) {
-                draw_char(*s++,x+xx,y+yy);
+        int n = OVERLAY_WIDTH*OVERLAY_HEIGHT;
+        for (int i = 0; i < n; i++) {
+            if (_buf[i] != _shown[i]) {
+                _shown[i] = _buf[i];
+                int y = i/OVERLAY_WIDTH;
+                raster(_bits + y*OVERLAY_WIDTH*8 + i%OVERLAY_WIDTH,OVERLAY_WIDTH,_buf[i]);
             }
         }
     }
 
+    inline void IRAM_ATTR text(const uint8_t* bits, uint8_t* dst, int n)
+    {
+        uint32_t* d = (uint32_t*)dst;
+        while (n--) {
+            uint8_t b = *bits++;
+            d[0] = _blit[b >> 4]; // long words
+            d[1] = _blit[b & 0xF];
+            d += 2;
+        }
+    }
+
+    // called from the video isr for every active line
+    uint8_t* IRAM_ATTR composite(uint8_t* src, int y)
+    {
+        if (!_width)
+            return src;
+        bool msg = _msg_visible && y >= _msg_top && y < _msg_top + 8;
+        bool menu = _visible && y >= _top-1 && y < _top-1 + _span_lines;
+        if (!msg && !menu)
+            return src;
+
+        const uint32_t* s = (const uint32_t*)src;  // screen may be in 32 bit mem
+        int n = _width >> 2;
+        for (int i = 0; i < n; i++)
+            _line[i] = s[i];
+        uint8_t* dst = (uint8_t*)_line;
+
+        if (menu) {
+            int i = y - (_top-1);
+            for (int k = _span_first[i]; k < _span_first[i+1]; k++) {
+                const overlay_span& sp = _span_list[k];
+                if (sp.c < 0) {
+                    for (int x = sp.x0; x < sp.x1; x++)
+                        dst[x] = luma(dst[x],-sp.c);
+                } else
+                    memset(dst + sp.x0,sp.c,sp.x1-sp.x0);
+            }
+            int row = y - _top;
+            if (row >= 0 && row < OVERLAY_HEIGHT*8)
+                text(_bits + row*OVERLAY_WIDTH,dst + _left,OVERLAY_WIDTH);
+        }
+        if (msg)
+            text(_msg_bits + (y-_msg_top)*(_width/8) + _msg_x0,dst + _msg_x0*8,_msg_x1-_msg_x0);
+        return dst;
+    }
+
     void plot_char(int c, int x, int y)
     {
         if (x < 0 || x >= OVERLAY_WIDTH)   //
@@ -534,8 +620,11 @@ string get_ext(const string& s);
 class GUI {
 public:
 
-    string _path;
-    vector<string> _files;
+    vector<string> _files;                      // core folder/name
+    unordered_multimap<size_t,uint16_t> _file_index;    // hash of name to index in _files
+    vector<uint16_t> _file_prefix;              // indices in _files by name ignoring case, for type-ahead
+    string _typed;                              // type-ahead so far
+    int _typed_ticks;
     vector<string> _info;
     int _disks[2];
     int _tab_hilited[3];
@@ -547,13 +636,14 @@ public:
     int _visible;
     bool _dirty;
     int _click;
+    bool _rewinding;
     Emu* _emu;
     Overlay* _overlay;
 
     string _msg;
     uint32_t _msg_ticks;
 
-    GUI() : _active(0),_hilited(0),_tab(0),_visible(0),_dirty(true),_click(0),_emu(0)
+    GUI() : _typed_ticks(0),_active(0),_hilited(0),_tab(0),_visible(0),_dirty(true),_click(0),_rewinding(false),_emu(0)
     {
         _disks[0] = _disks[1] = -1;
         _tab_hilited[0] = _tab_hilited[1] = _tab_hilited[2] = 0;
@@ -566,38 +656,109 @@ public:
         _msg_ticks = 120;
     }
 
-    int want(const char* ext)
+    int want(const emu_core* core, const char* ext)
     {
-        auto exts = _emu->_ext;
+        auto exts = core->ext;
         for (int i = 0; exts[i]; i++)
             if (strcmp(ext,exts[i]) == 0)
                 return i;
         return -1;
     }
 
-    // map to sort
-    void read_directory(const char* name)
+    // map to sort, media from every core's folder
+    void read_media()
     {
-        _path = name;
         _files.clear();
-        map<string,int> files;  // sort by name
-        DIR* dirp = opendir(name);
-        if (!dirp)
-            return;             // no folder yet
-        struct dirent * dp;
-        while ((dp = readdir(dirp)) != NULL) {
-            if (dp->d_type == DT_DIR) {
-                // directory
-            } else {
-                string ext = get_ext(dp->d_name);
-                int e = want(ext.c_str());
-                if (e != -1)
-                    files[dp->d_name] = e;
+        map<string,int> files;  // sort by name, grouped by core
+        for (const emu_core* c = _emu_cores; c->name; c++) {
+            DIR* dirp = opendir((string("/") + c->name).c_str());
+            if (!dirp)
+                continue;       // no folder yet
+            struct dirent * dp;
+            while ((dp = readdir(dirp)) != NULL) {
+                if (dp->d_type == DT_DIR) {
+                    // directory
+                } else {
+                    string ext = get_ext(dp->d_name);
+                    int e = want(c,ext.c_str());
+                    if (e != -1)
+                        files[string(c->name) + "/" + dp->d_name] = e;
+                }
             }
+            closedir(dirp);
         }
         for (auto& p : files)
             _files.push_back(p.first);
-        closedir(dirp);
+        index_files();
+    }
+
+    bool has_media(const emu_core* core)
+    {
+        string folder = string(core->name) + "/";
+        for (auto& f : _files)
+            if (f.compare(0,folder.size(),folder) == 0)
+                return true;
+        return false;
+    }
+
+    // name without the core folder
+    const char* file_name(int i)
+    {
+        return _files[i].c_str() + _files[i].find('/') + 1;
+    }
+
+    // the running core if it plays the file, otherwise switch to the one that does
+    Emu* core(const string& file)
+    {
+        const emu_core* c = media_core(file);
+        if (c && c->flavor != _emu->flavor) {
+            _emu = emu_switch(c);
+            _overlay->init(_emu->width,_emu->height,_emu->flavor);
+        }
+        return _emu;
+    }
+
+    // a core to look at media with, without switching to it
+    Emu* borrow(const emu_core* c)
+    {
+        return c->flavor == _emu->flavor ? _emu : c->create(_emu->standard);
+    }
+
+    void release(Emu* emu)
+    {
+        if (emu != _emu)
+            delete emu;
+    }
+
+    // lookups by name and by typed prefix without walking the whole folder, names stay in _files
+    void index_files()
+    {
+        _file_index.clear();
+        _file_prefix.clear();
+        _file_index.reserve(_files.size());
+        _file_prefix.reserve(_files.size());
+        for (int i = 0; i < (int)_files.size(); i++) {
+            _file_index.insert({hash<string>()(_files[i]),(uint16_t)i});
+            _file_prefix.push_back(i);
+        }
+        sort(_file_prefix.begin(),_file_prefix.end(),[this](uint16_t a, uint16_t b) {
+            int c = strcasecmp(file_name(a),file_name(b));
+            return c ? c < 0 : a < b;
+        });
+    }
+
+    // jump to the first file starting with what has been typed in the last second
+    void type_ahead(char c)
+    {
+        if (!_typed_ticks)
+            _typed.clear();
+        _typed += c;
+        _typed_ticks = 60;
+        auto i = lower_bound(_file_prefix.begin(),_file_prefix.end(),_typed,[this](uint16_t a, const string& t) {
+            return strcasecmp(file_name(a),t.c_str()) < 0;
+        });
+        if (i != _file_prefix.end() && strncasecmp(file_name(*i),_typed.c_str(),_typed.size()) == 0)
+            _hilited = *i;
     }
 
     void draw_menu(int x, const char* name, bool selected)
@@ -663,7 +824,8 @@ public:
     void insert(const string& path, int flags)
     {
         set_pref("recent",path);
-        _emu->insert(_path + "/" + path,flags);
+        arena_eject();
+        core(path)->insert("/" + path,flags);
     }
 
     void insert_disk(int dindex, int findex, int reboot = 0)
@@ -674,7 +836,11 @@ public:
         set_pref(disk_name(dindex),file);
         if (dindex == 0)
             set_pref("recent",file);
-        _emu->insert(_path + "/" + file,reboot,dindex);
+        if (reboot)
+            arena_eject();
+        else
+            rewind_reset();
+        core(file)->insert("/" + file,reboot,dindex);
     }
 
     void enter(int mods)
@@ -689,10 +855,10 @@ public:
             insert_disk(0,_hilited,flags);
         else {
             insert(_files[_hilited],flags);
-            if (_disks[0] != -1)
+            if (_disks[0] != -1 && _emu->flavor == EMU_ATARI)
                 insert_disk(0,_disks[0]);   // reinsert disk 1 after restart
         }
-        if (_disks[1] != -1)
+        if (_disks[1] != -1 && _emu->flavor == EMU_ATARI)
             insert_disk(1,_disks[1]);       // reinsert disk 2 after restart
         _visible = false;
     }
@@ -710,20 +876,17 @@ public:
 
     int find_file(const string& file)
     {
-        for (auto i = 0; i < _files.size(); i++) {
-            if (_files[i] == file)
-                return i;
-        }
+        auto r = _file_index.equal_range(hash<string>()(file));
+        for (auto i = r.first; i != r.second; i++)
+            if (_files[i->second] == file)
+                return i->second;
         return -1;
     }
 
+    // mounted by enter once the machine has started
     int find_disk(int index)
     {
-        string n = get_pref(disk_name(index));
-        int i = find_file(n);
-        if (i >= 0)
-            insert_disk(index,i);
-        return i;
+        return find_file(get_pref(disk_name(index)));
     }
 
     void disk_key(int dindex)
@@ -748,11 +911,17 @@ public:
 
         if (pressed && keycode == 58) { // F1 - GUI key
             _visible = !_visible;       // toggle GUi
-            if (_visible)
-                _overlay->frame();      // draw the frame when it first appears
             _click = 1;
             return true;
         }
+#ifdef REWIND
+        if (keycode == 69) {            // F12 - rewind while held
+            _rewinding = pressed && !_visible;
+            if (_rewinding && rewind_off())
+                msg(rewind_off());
+            return true;
+        }
+#endif
         if (!_visible)
             return false;
 
@@ -780,6 +949,10 @@ public:
                     break;
                 case 224:   // left control key
                     break;  // FIRE
+                default:
+                    if (keycode >= 4 && keycode <= 29 && _tab == 0)
+                        type_ahead('a' + keycode - 4);  // a-z
+                    break;
             }
         }
         return true;
@@ -861,11 +1034,13 @@ public:
         }
     }
 
+    // only the rows in view, the folder can hold thousands
     void draw_files()
     {
         int i;
-        for (i = 0; i < (int)_files.size(); i++) {
-            string c = _files[i];
+        int end = min((int)_files.size(),_scroll + _overlay->OVERLAY_HEIGHT-2);
+        for (i = _scroll; i < end; i++) {
+            string c = file_name(i);
             int w = _overlay->OVERLAY_WIDTH-2;
             if (c.length() > w)
                 c.resize(w);
@@ -888,7 +1063,7 @@ public:
 
     void clear(int i)
     {
-        while (i < _overlay->OVERLAY_HEIGHT - 2)
+        while (i < _scroll + _overlay->OVERLAY_HEIGHT - 2)
             draw_item(i++," ",false);
     }
 
@@ -898,7 +1073,10 @@ public:
             _dirty = false;
             _info.clear();
             int index = _tab_hilited[0];
-            _emu->info(_path + "/" + _files[index],_info);
+            const emu_core* c = media_core(_files[index]);
+            Emu* emu = borrow(c);
+            emu->info("/" + _files[index],_info);
+            release(emu);
         }
         int i;
         for (i = 0; i < (int)_info.size(); i++)
@@ -909,22 +1087,29 @@ public:
     string get_pref(const string& key)
     {
         char buf[256] = {0};
-        sys_get_pref((_path[1]+key).c_str(),buf,sizeof(buf)-1); // keys are limited to 15 bytes. great
+        sys_get_pref(key.c_str(),buf,sizeof(buf)-1);   // keys are limited to 15 bytes. great
         return buf;
     }
 
     void set_pref(const string& key, const string& value)
     {
-        sys_set_pref((_path[1]+key).c_str(),value.c_str());     // first char discrminates current emus at least
+        sys_set_pref(key.c_str(),value.c_str());        // one menu for every core
     }
 
-    void insert_default(const char* path)
+    void insert_default()
     {
-        read_directory(path);
-        if (_files.empty()) {
-            _emu->make_default_media(_path);
-            read_directory(path);
+        read_media();
+        bool made = false;
+        for (const emu_core* c = _emu_cores; c->name; c++) {
+            if (!has_media(c)) {
+                Emu* emu = borrow(c);
+                emu->make_default_media(string("/") + c->name);
+                release(emu);
+                made = true;
+            }
         }
+        if (made)
+            read_media();
 
         int recent = find_file(get_pref("recent"));
 
@@ -942,6 +1127,9 @@ public:
 
     void update_video()
     {
+        _overlay->show(_visible);
+        if (_typed_ticks)
+            _typed_ticks--;
         if (_visible) {
             menu();
             scrollbar();
@@ -952,6 +1140,7 @@ public:
             }
             _overlay->update();
         } else {
+            rewind_update(_emu,_rewinding);
             _emu->update();
         }
 
@@ -985,7 +1174,11 @@ public:
             } else
               memset(abuffer,0,sizeof(abuffer));
         } else {
+            uint32_t t = cpu_ticks();
             sample_count = _emu->audio_buffer(abuffer,sizeof(abuffer));
+            _audio_ticks += cpu_ticks() - t;
+            if (_rewinding)
+                memset(abuffer,0,sizeof(abuffer));  // the same few frames over and over
         }
         audio_write_16(abuffer,sample_count,format);
     }
@@ -993,27 +1186,81 @@ public:
 
 Overlay _overlay;
 GUI _gui;
-void gui_start(Emu* emu, const char* path)
+uint32_t _audio_ticks = 0;
+void gui_start(Emu* emu)
 {
     _gui._emu = emu;
     _gui._overlay = &_overlay;
-    _gui.insert_default(path);
-    _overlay.init(emu->video_buffer(),emu->width,emu->height,emu->flavor);
+    _overlay.init(emu->width,emu->height,emu->flavor);
+    _gui.insert_default();
 }
 
-void gui_update()
+// composite the menu and messages over a line of the game on its way out
+uint8_t* IRAM_ATTR gui_line(uint8_t* src, int y)
 {
-    _gui.update_audio();
-    _gui.update_video();
+    return _overlay.composite(src,y);
+}
+
+//==================================================================
+//==================================================================
+// Input reports are all drained and applied before the frame is emulated, so a burst of reports is
+// handled at once and none wait behind the others for frames of their own. Between frames is also
+// the only safe place for the keys that reset the machine or bring up the GUI. Replaying reports at
+// the line they arrived on would hold back any that came in after the game polled by a whole frame.
+
+#define INPUT_EVENTS 32      // four wiimotes and a keyboard in one frame
 
+static uint32_t _input_t[INPUT_EVENTS];    // arrival of each report applied this frame, hid_time_us()
+static int _input_count = 0;
+
+uint32_t _input_reports = 0;
+uint32_t _input_latency_us = 0;
+uint32_t _input_latency_total = 0;
+
+static void input_drain()
+{
     uint8_t buf[64];
-    int n = hid_get(buf,sizeof(buf));    // called from emulation loop
-    if (n > 0)
-        gui_hid(buf,n);
-    
-    n = get_hid_ir(buf);
-    if (n > 0)
+    _input_count = 0;
+
+    // every bluetooth report
+    while (_input_count < INPUT_EVENTS) {
+        int n = hid_get(buf,sizeof(buf),&_input_t[_input_count]);   // called from emulation loop
+        if (n <= 0)
+            break;
+        _input_count++;
         gui_hid(buf,n);
+    }
+
+    // ir is polled, it could have come in any time since the last frame
+    if (_input_count < INPUT_EVENTS) {
+        int n = get_hid_ir(buf);
+        if (n > 0) {
+            _input_t[_input_count++] = hid_time_us();
+            gui_hid(buf,n);
+        }
+    }
+}
+
+// how long the frame took to show what it got
+static void input_frame()
+{
+    uint32_t now = hid_time_us();
+    for (int i = 0; i < _input_count; i++) {
+        uint32_t t = now - _input_t[i];
+        if (t > _input_latency_us)
+            _input_latency_us = t;
+        _input_latency_total += t;
+        _input_reports++;
+    }
+}
+
+void gui_update()
+{
+    input_drain();
+    _gui.update_audio();
+    _gui.update_video();
+    input_frame();
+    battery_update();
 }
 
 void gui_key(int keycode, int pressed, int mods)
@@ -1078,6 +1325,9 @@ static void ir(const uint8_t* j, int len)
     pad_key(GENERIC_RIGHT,pad,79);   // right
     pad_key(GENERIC_LEFT,pad,80);     // left
     pad_key(GENERIC_RESET | GENERIC_FIRE_Z,pad,58);   // home/gui
+#ifdef REWIND
+    pad_key(GENERIC_MENU,pad,69);   // rewind
+#endif
     pad_key(GENERIC_FIRE | GENERIC_FIRE_C | GENERIC_FIRE_B | GENERIC_FIRE_A,pad,40); // enter (A)
     _last_pad = pad;
 }
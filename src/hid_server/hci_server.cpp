@@ -25,6 +25,7 @@
 #include <map>
 #include <vector>
 #include <mutex>
+#include <atomic>
 using namespace std;
 
 #include "hci_transport.h"
@@ -327,45 +328,87 @@ const char* batostr(const bdaddr_t& a)
     return buf;
 }
 
+// Packets queued between one producer and one consumer thread without locks or allocation.
+// Each packet is a 32 bit length followed by its bytes padded to 4, packed into a fixed ring so
+// small HID reports don't each reserve room for the biggest ACL packet. A length of ~0 marks the
+// unused tail of the ring when a packet didn't fit before the end.
+template <int QBYTES>
 class PacketQ
 {
-    uint32_t _read;
-    uint32_t _write;
-    enum {QSIZE = 32};
-    vector<uint8_t> _data[QSIZE];
-    mutex _mutex;
+    enum {WRAP = 0xFFFFFFFF};
+    atomic<uint32_t> _read;         // byte counts, only ever increase
+    atomic<uint32_t> _write;
+    atomic<uint32_t> _overflows;    // packets dropped because the ring was full
+    uint32_t _data[QBYTES/4];
+
+    uint8_t* at(uint32_t pos)
+    {
+        return (uint8_t*)_data + (pos & (QBYTES-1));
+    }
+
 public:
-    PacketQ() : _read(0),_write(0) {};
+    PacketQ() : _read(0),_write(0),_overflows(0) {};
 
     bool empty()
     {
-        return _read == _write;
+        return _read.load(memory_order_acquire) == _write.load(memory_order_relaxed);
     }
-    bool read(vector<uint8_t>& d)
+
+    uint32_t overflows()
     {
-        lock_guard<mutex> lock(_mutex);
-        assert(_read <= _write);
-        if (_read == _write)
-            return false;
-        d = _data[_read++ & (QSIZE-1)];
-        return true;
+        return _overflows.load(memory_order_relaxed);
     }
 
-    bool write(const vector<uint8_t>& d)
+    // oldest packet, stays valid until pop()
+    const uint8_t* front(int* len)
     {
-        lock_guard<mutex> lock(_mutex);
-        assert(_read <= _write && (_write - _read <= QSIZE));
-        if (_write - _read == QSIZE)
-            return false;
-        _data[_write++ & (QSIZE-1)] = d;
-        return true;
+        uint32_t r = _read.load(memory_order_relaxed);
+        if (r == _write.load(memory_order_acquire))
+            return NULL;
+        uint32_t n = *(uint32_t*)at(r);
+        if (n == WRAP) {
+            r += QBYTES - (r & (QBYTES-1));
+            _read.store(r,memory_order_release);
+            if (r == _write.load(memory_order_acquire))
+                return NULL;
+            n = *(uint32_t*)at(r);
+        }
+        *len = n;
+        return at(r) + 4;
+    }
+
+    void pop()
+    {
+        uint32_t r = _read.load(memory_order_relaxed);
+        uint32_t n = *(uint32_t*)at(r);
+        _read.store(r + 4 + ((n + 3) & ~3),memory_order_release);
     }
 
-    bool write(const uint8_t* data, int len)
+    // a packet gathered from a header and a payload
+    bool write(const void* hdr, int hdr_len, const void* data = 0, int len = 0)
     {
-        vector<uint8_t> buf(len);
-        memcpy(&buf[0],data,len);
-        return write(buf);
+        uint32_t w = _write.load(memory_order_relaxed);
+        uint32_t free = QBYTES - (w - _read.load(memory_order_acquire));
+        uint32_t need = 4 + ((hdr_len + len + 3) & ~3);
+        uint32_t tail = QBYTES - (w & (QBYTES-1));
+        if (need > tail && free >= tail) {  // start again at the beginning
+            *(uint32_t*)at(w) = WRAP;
+            w += tail;
+            free -= tail;
+            _write.store(w,memory_order_release);
+            tail = QBYTES;
+        }
+        if (need > free || need > tail) {
+            _overflows.fetch_add(1,memory_order_relaxed);
+            return false;
+        }
+        uint8_t* d = at(w);
+        *(uint32_t*)d = hdr_len + len;
+        memcpy(d + 4,hdr,hdr_len);
+        if (len)
+            memcpy(d + 4 + hdr_len,data,len);
+        _write.store(w + need,memory_order_release);
+        return true;
     }
 };
 
@@ -391,25 +434,33 @@ static void from_hex(uint8_t* dst, const char* src, int len)
     }
 }
 
+// link keys by address in hex, empty if there isn't one. prefs are slow to read while a device waits
+static map<string,string> _link_keys;
+
 int read_link_key(const bdaddr_t* addr, uint8_t* key)
 {
-    char s[64] = {0};
     char ba[12+1] = {0};
     to_hex(ba,addr->b,6);
-    if (sys_get_pref(ba,s,sizeof(s)-1)) {
-        from_hex(key,s,16);
-        return 0;
+    auto i = _link_keys.find(ba);
+    if (i == _link_keys.end()) {
+        char s[64] = {0};
+        sys_get_pref(ba,s,sizeof(s)-1);
+        i = _link_keys.insert({ba,s}).first;
     }
-    return -1;
+    if (i->second.size() < 32)
+        return -1;
+    from_hex(key,i->second.c_str(),16);
+    return 0;
 }
 
 static void write_link_key(const bdaddr_t* addr, const uint8_t* key)
 {
-    char buf[64];
+    char buf[64] = {0};
     char ba[12+1] = {0};
     to_hex(ba,addr->b,6);
     to_hex(buf,key,16);
     sys_set_pref(ba,buf);
+    _link_keys[ba] = buf;
 }
 
 class BTDevice;
@@ -419,7 +470,7 @@ public:
     uint16_t _psm;
     uint16_t _scid;
     uint16_t _dcid;
-    PacketQ _q;
+    PacketQ<1024> _q;               // filled by the hci thread, read by hid_get on the emu thread, stamped with arrival
     BTDevice* _device;
 
     L2CAPSocket() : _state(0) {};
@@ -430,7 +481,8 @@ public:
 };
 
 // forward
-int hci_write(vector<uint8_t>& buf);
+int hci_write(const void* hdr, int hdr_len, const void* data = 0, int len = 0);
+static uint32_t _rx_us = 0;         // when the controller handed over the inbound packet being handled
 
 enum {
     SLAVE = 1,
@@ -549,7 +601,7 @@ public:
             else {
                 auto s = get_socket(_packet_cid);
                 if (s) {
-                    s->_q.write(&_packet[0],_packet_pos);
+                    s->_q.write(&_rx_us,4,&_packet[0],_packet_pos);    // arrival time, then the payload
                 } else {
                     _packet_pos = 0;
                     return false;   // did not have a socket for this data.
@@ -670,17 +722,13 @@ public:
     // l2cap data
     int send(const void* data = 0, int len = 0, int cid = 1)
     {
-        int n = sizeof(l2cap_data) + len;
-        vector<uint8_t> buf(n);
-        l2cap_data* d = (l2cap_data*)&buf[0];
-        d->type = 0x02;                 // acl
-        d->handle = _handle | 0x2000;
-        d->length = len + 4;            // includes l2cap header
-        d->l2capLength = len;
-        d->cid = cid;
-        if (data)
-            memcpy(d->data,data,len);   // l2cap payload
-        return hci_write(buf);          // send to outbound q.
+        l2cap_data d;
+        d.type = 0x02;                  // acl
+        d.handle = _handle | 0x2000;
+        d.length = len + 4;             // includes l2cap header
+        d.l2capLength = len;
+        d.cid = cid;
+        return hci_write(&d,sizeof(d),data,len);    // header and l2cap payload to outbound q.
     }
 
     int l2cap(uint8_t cmd, uint8_t id, u16* params, int count)
@@ -784,8 +832,10 @@ class HCI {
     hci_buffer_size _buffer_size;
 
     int _cid; // connection id
-    PacketQ _rx;
-    PacketQ _tx;
+    PacketQ<4096> _rx;              // from the controller's task
+    PacketQ<2048> _tx;              // from the hci thread and the emu thread (wii leds, sdp)
+    mutex _tx_mutex;                // so writers take turns, the reader doesn't lock
+    uint32_t _rx_overflows;
 
 public:
     hci_callback _callback;
@@ -809,16 +859,20 @@ public:
     }
 
     // recv from packet queue
-    int l2_recv(int scid, uint8_t* dst, int len)
+    int l2_recv(int scid, uint8_t* dst, int len, uint32_t* arrival_us)
     {
         auto* s = get_socket(scid);
         if (!s)
             return -1;
-        vector<uint8_t> d;
-        if (!s->_q.read(d))
+        int n;
+        const uint8_t* d = s->_q.front(&n);
+        if (!d)
             return 0;
-        len = min(len,(int)d.size());
-        memcpy(dst,&d[0],len);
+        if (arrival_us)
+            *arrival_us = *(const uint32_t*)d;
+        len = min(len,n-4);
+        memcpy(dst,d+4,len);
+        s->_q.pop();
         return len;
     }
 
@@ -849,7 +903,7 @@ public:
         return create_connection(*d);
     }
 
-    HCI(const char* localname) : _localname(localname),_state(-1),_cid(0x40)
+    HCI(const char* localname) : _localname(localname),_state(-1),_cid(0x40),_rx_overflows(0)
     {
         _hci = hci_open();
         if (!_hci)
@@ -891,30 +945,42 @@ public:
     int update()
     {
         // send any pending
-        vector<uint8_t> buf;
-        while (hci_send_available(_hci) && _tx.read(buf))
+        const uint8_t* buf;
+        int len;
+        while (hci_send_available(_hci) && (buf = _tx.front(&len)))
         {
-            TRACE(1,&buf[0],(int)buf.size());
-            hci_send(_hci,&buf[0],(int)buf.size());
+            TRACE(1,buf,len);
+            hci_send(_hci,buf,len);
+            _tx.pop();
         }
 
-        // handle any inbound.
+        // handle any inbound, in place
         // hcl/acl ordering challenge. TODO.
-        while (_rx.read(buf)) {
-            TRACE(0,&buf[0],(int)buf.size());
+        while ((buf = _rx.front(&len))) {
+            _rx_us = *(const uint32_t*)buf;
+            buf += 4;
+            len -= 4;
+            TRACE(0,buf,len);
             switch (buf[0]) {
-                case 0x2: acl(&buf[0],(int)buf.size()); break;
+                case 0x2: acl(buf,len); break;
                 case 0x4: hci(buf[1],&buf[3],buf[2]); break;
                 default:
                     PRINTF("bad hci packet\n");
             }
+            _rx.pop();
+        }
+
+        if (_rx.overflows() != _rx_overflows) {
+            _rx_overflows = _rx.overflows();
+            printf("hci rx overflows:%d\n",_rx_overflows);
         }
         return 0;
     }
 
-    int write(vector<uint8_t>& buf)
+    int write(const void* hdr, int hdr_len, const void* data = 0, int len = 0)
     {
-        return _tx.write(buf) ? 0 : -1; // send to outbound q.
+        lock_guard<mutex> lock(_tx_mutex);
+        return _tx.write(hdr,hdr_len,data,len) ? 0 : -1; // send to outbound q.
     }
 
 private:
@@ -931,7 +997,8 @@ private:
     // inbound packet from hci, queue it
     void packet(const uint8_t* data, int len)
     {
-        _rx.write(data,len);
+        uint32_t t = hci_time_us();     // stamped on arrival so input latency can be measured end to end
+        _rx.write(&t,4,data,len);       // no locks or allocation on the controller's task
     }
 
     void ready_to_send()
@@ -945,14 +1012,12 @@ private:
     // hci command
     int cmd(uint16_t c, const void* data = 0, int len = 0)
     {
-        vector<uint8_t> buf(len+4);
-        if (data)
-            memcpy(&buf[4],data,len);
+        uint8_t buf[4];
         buf[0] = 0x01;         // hci Command
         buf[1] = (uint8_t)c;
         buf[2] = (uint8_t)(c >> 8);
         buf[3] = len;
-        return write(buf); // send to outbound q.
+        return write(buf,4,data,len); // send to outbound q.
     }
 
     // look for devices
@@ -1409,9 +1474,9 @@ int l2_send(int s, const uint8_t* data, int len)
     return _hci->l2_send(s, data, len);
 }
 
-int l2_recv(int s, uint8_t* data, int len)
+int l2_recv(int s, uint8_t* data, int len, uint32_t* arrival_us)
 {
-    return _hci->l2_recv(s, data, len);
+    return _hci->l2_recv(s, data, len, arrival_us);
 }
 
 int l2_close(int s)
@@ -1461,7 +1526,7 @@ int hci_connect(const bdaddr_t* addr)
     return _hci->connect(addr);
 }
 
-int hci_write(vector<uint8_t>& buf)
+int hci_write(const void* hdr, int hdr_len, const void* data, int len)
 {
-    return _hci->write(buf); // send to outbound q.
+    return _hci->write(hdr,hdr_len,data,len); // send to outbound q.
 }
@@ -127,7 +127,7 @@ int hci_update();
 // l2cap
 int l2_open(const bdaddr_t* addr, int psm, bool listen = false);
 int l2_send(int s, const uint8_t* data, int len);
-int l2_recv(int s, uint8_t* data, int len);
+int l2_recv(int s, uint8_t* data, int len, uint32_t* arrival_us = 0);   // hci_time_us() when it came in
 int l2_close(int s);
 int l2_state(int s);
 
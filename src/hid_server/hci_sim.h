@@ -0,0 +1,40 @@
+
+/* Copyright (c) 2020, Peter Barrett
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+#ifndef hci_sim_h
+#define hci_sim_h
+
+//==================================================================
+//==================================================================
+//  simulated controller for running the hci/l2cap/hid stack on a host
+//  see hci_transport_sim.cpp
+
+enum {
+    HCI_SIM_KEYBOARD,
+    HCI_SIM_WIIMOTE,    // with a classic controller plugged in
+    HCI_SIM_GAMEPAD
+};
+
+int  hci_sim_add(int type, const char* name = 0);   // a controller in range, found by the next inquiry
+void hci_sim_connect(int dev);                      // a paired controller waking up and paging us
+void hci_sim_disconnect(int dev);                   // out of range or powered off
+bool hci_sim_open(int dev);                         // interrupt channel is up, reports will be delivered
+int  hci_sim_report(int dev, const uint8_t* report, int len);  // input report (0xA1 ...) on the interrupt channel
+void hci_sim_update();                              // controller side of hid_update, tells the stack it can send
+int  hci_sim_commands();                            // commands the stack has sent so far
+
+#endif
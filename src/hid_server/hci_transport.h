@@ -32,6 +32,7 @@ void        hci_set_packet_handler(hci_handle h, hci_on_packet_handler p, void*
 void        hci_set_ready_to_send_handler(hci_handle h, hci_on_ready_to_send_handler p, void* ref);
 int         hci_send(hci_handle h, const uint8_t* d, int len);
 int         hci_send_available(hci_handle h);
+uint32_t    hci_time_us();      // microseconds, the same clock on every core
 
 #ifdef __cplusplus
 }
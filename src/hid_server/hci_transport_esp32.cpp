@@ -1,4 +1,5 @@
 #include <esp_bt.h>
+#include <esp_timer.h>
 #include <esp32-hal-log.h>
 #include <esp32-hal-bt.h>
 #include <nvs.h>
@@ -71,6 +72,12 @@ int  hci_send_available(hci_handle h)
     return esp_vhci_host_check_send_available();
 }
 
+// ccount is per core, the controller and the emulator run on different ones
+uint32_t hci_time_us()
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
 // store and load link keys
 uint32_t _nvs_handle = 0;
 static uint32_t open_nvs()
@@ -0,0 +1,859 @@
+
+/* Copyright (c) 2020, Peter Barrett
+**
+** Permission to use, copy, modify, and/or distribute this software for
+** any purpose with or without fee is hereby granted, provided that the
+** above copyright notice and this permission notice appear in all copies.
+**
+** THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+** WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+** WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+** BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+** OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+** WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+** ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+** SOFTWARE.
+*/
+
+// hci transport for a host: a simulated controller with scripted keyboards, wiimotes and gamepads
+// behind it, so hci_server and hid_server can be run and timed without bluetooth hardware.
+// Pairing goes through inquiry, sdp, pin and link key just like the real thing.
+//
+// g++ -O2 -DHCI_SIM_MAIN hci_server.cpp hid_server.cpp hci_transport_sim.cpp -o hci_sim -lpthread
+// ./hci_sim [reports]
+
+#ifndef ESP_PLATFORM
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "hci_transport.h"
+#include "hci_server.h"
+#include "hci_sim.h"
+
+#define SIM_ACL_MAX     64      // controller to host fragments, small enough to split sdp replies
+#define SIM_SDP_CHUNK   32      // sdp attribute bytes per response, the rest needs a continuation
+
+// opcodes and events the controller answers, same values as hci_server.cpp
+enum {
+    INQUIRY = 0x0401,
+    INQUIRY_CANCEL = 0x0402,
+    CREATE_CONNECTION = 0x0405,
+    DISCONNECT = 0x0406,
+    ACCEPT_CONNECTION_REQUEST = 0x0409,
+    LINK_KEY_REQUEST_REPLY = 0x040B,
+    LINK_KEY_REQUEST_NEG_REPLY = 0x040C,
+    PIN_CODE_REQUEST_REPLY = 0x040D,
+    AUTHENTICATION_REQUESTED = 0x0411,
+    REMOTE_NAME_REQUEST = 0x0419,
+    READ_BUFFER_SIZE = 0x1005,
+    READ_BD_ADDR = 0x1009,
+
+    INQUIRY_COMP_EVT = 0x01,
+    INQUIRY_RESULT_EVT = 0x02,
+    CONNECTION_COMP_EVT = 0x03,
+    CONNECTION_REQUEST_EVT = 0x04,
+    DISCONNECTION_COMP_EVT = 0x05,
+    AUTHENTICATION_COMP_EVT = 0x06,
+    RMT_NAME_REQUEST_COMP_EVT = 0x07,
+    COMMAND_COMPLETE_EVT = 0x0E,
+    COMMAND_STATUS_EVT = 0x0F,
+    PIN_CODE_REQUEST_EVT = 0x16,
+    LINK_KEY_REQUEST_EVT = 0x17,
+    LINK_KEY_NOTIFICATION_EVT = 0x18,
+
+    CONN_REQ = 0x02,
+    CONN_RSP = 0x03,
+    CONF_REQ = 0x04,
+    CONF_RSP = 0x05,
+    DISCONN_REQ = 0x06,
+    DISCONN_RSP = 0x07,
+
+    SDP_PSM = 0x0001,
+    CONTROL_PSM = 0x0011,
+    INTERRUPT_PSM = 0x0013,
+};
+
+struct SimChannel {
+    uint16_t psm;
+    uint16_t cid;           // this end
+    uint16_t host_cid;
+};
+
+struct SimDevice {
+    int type;
+    bdaddr_t addr;
+    uint8_t dev_class[3];
+    string name;
+    int handle;             // 0 if not connected
+    bool paging;            // we connected to the host, it listens for our channels
+    uint8_t txid;
+    uint8_t wii_mode;       // report selected by the host
+    vector<SimChannel> channels;
+
+    SimChannel* channel(int cid)
+    {
+        for (auto& c : channels)
+            if (c.cid == cid)
+                return &c;
+        return NULL;
+    }
+
+    SimChannel* psm(int psm)
+    {
+        for (auto& c : channels)
+            if (c.psm == psm)
+                return &c;
+        return NULL;
+    }
+};
+
+class HCISim {
+    hci_on_packet_handler _handler;
+    void* _handler_ref;
+    hci_on_ready_to_send_handler _ready_handler;
+    void* _ready_handler_ref;
+
+    vector<SimDevice> _devices;
+    uint16_t _next_handle;
+    uint16_t _next_cid;
+
+public:
+    map<string,string> _prefs;  // link keys live here instead of nvs
+    uint32_t _to_host;          // packets sent to the stack
+    uint32_t _commands;         // commands from the stack, each one a radio round trip on a real controller
+
+    HCISim() : _handler(0),_ready_handler(0),_next_handle(0x80),_next_cid(0x40),_to_host(0),_commands(0) {}
+
+    void set_packet_handler(hci_on_packet_handler p, void* ref)
+    {
+        _handler = p;
+        _handler_ref = ref;
+    }
+
+    void set_ready_to_send_handler(hci_on_ready_to_send_handler p, void* ref)
+    {
+        _ready_handler = p;
+        _ready_handler_ref = ref;
+    }
+
+    void update()
+    {
+        if (_ready_handler)
+            _ready_handler(this,_ready_handler_ref);
+    }
+
+    int add(int type, const char* name)
+    {
+        SimDevice d = {0};
+        d.type = type;
+        int n = (int)_devices.size();
+        uint8_t a[6] = {(uint8_t)(0x10+n),0x32,0x54,0x76,0x98,0x00};  // stored backwards like the air
+        memcpy(d.addr.b,a,6);
+        switch (type) {
+            case HCI_SIM_KEYBOARD:  d.dev_class[0] = 0x40; d.name = "Sim Keyboard"; break;    // peripheral, keyboard
+            case HCI_SIM_WIIMOTE:   d.dev_class[0] = 0x04; d.name = "Nintendo RVL-CNT-01"; break;
+            default:                d.dev_class[0] = 0x08; d.name = "Sim Gamepad"; break;
+        }
+        d.dev_class[1] = 0x25;
+        if (name)
+            d.name = name;
+        d.txid = 1;
+        _devices.push_back(d);
+        return n;
+    }
+
+    SimDevice* device(int i)
+    {
+        return (i >= 0 && i < (int)_devices.size()) ? &_devices[i] : NULL;
+    }
+
+    SimDevice* device(const uint8_t* addr)
+    {
+        for (auto& d : _devices)
+            if (memcmp(d.addr.b,addr,6) == 0)
+                return &d;
+        return NULL;
+    }
+
+    SimDevice* device_by_handle(int handle)
+    {
+        for (auto& d : _devices)
+            if (d.handle && d.handle == handle)
+                return &d;
+        return NULL;
+    }
+
+    //==================================================================
+    // to the host
+
+    void to_host(const uint8_t* data, int len)
+    {
+        _to_host++;
+        if (_handler)
+            _handler(this,data,len,_handler_ref);
+    }
+
+    void event(uint8_t evt, const void* params, int len)
+    {
+        uint8_t buf[3 + 255];
+        buf[0] = 0x04;
+        buf[1] = evt;
+        buf[2] = len;
+        memcpy(buf+3,params,len);
+        to_host(buf,3+len);
+    }
+
+    void complete(uint16_t op, uint8_t status = 0, const void* ret = 0, int len = 0)
+    {
+        uint8_t buf[4 + 32] = {1,(uint8_t)op,(uint8_t)(op >> 8),status};
+        if (len)
+            memcpy(buf+4,ret,len);
+        event(COMMAND_COMPLETE_EVT,buf,4+len);
+    }
+
+    void status(uint16_t op, uint8_t status = 0)
+    {
+        uint8_t buf[4] = {status,1,(uint8_t)op,(uint8_t)(op >> 8)};
+        event(COMMAND_STATUS_EVT,buf,4);
+    }
+
+    // l2cap frame, split into acl fragments
+    void l2cap(SimDevice& d, uint16_t cid, const void* data, int len)
+    {
+        vector<uint8_t> f(4 + len);
+        f[0] = len;
+        f[1] = len >> 8;
+        f[2] = cid;
+        f[3] = cid >> 8;
+        if (len > 0)
+            memcpy(&f[4],data,len);
+
+        uint8_t buf[5 + SIM_ACL_MAX];
+        for (int pos = 0; pos < (int)f.size(); pos += SIM_ACL_MAX) {
+            int n = min(SIM_ACL_MAX,(int)f.size() - pos);
+            uint16_t h = d.handle | (pos ? 0x1000 : 0x2000);    // continuation or start
+            buf[0] = 0x02;
+            buf[1] = h;
+            buf[2] = h >> 8;
+            buf[3] = n;
+            buf[4] = n >> 8;
+            memcpy(buf+5,&f[pos],n);
+            to_host(buf,5+n);
+        }
+    }
+
+    void signal(SimDevice& d, uint8_t code, uint8_t id, const uint16_t* params, int count)
+    {
+        uint8_t buf[4 + 16];
+        buf[0] = code;
+        buf[1] = id;
+        buf[2] = count*2;
+        buf[3] = 0;
+        memcpy(buf+4,params,count*2);
+        l2cap(d,1,buf,4+count*2);
+    }
+
+    void connection_complete(SimDevice& d)
+    {
+        d.handle = _next_handle++;
+        uint8_t cc[11] = {0,(uint8_t)d.handle,(uint8_t)(d.handle >> 8)};
+        memcpy(cc+3,d.addr.b,6);
+        cc[9] = 1;      // acl
+        event(CONNECTION_COMP_EVT,cc,sizeof(cc));
+        if (d.paging) {   // reconnecting, open control and interrupt ourselves
+            open(d,CONTROL_PSM);
+            open(d,INTERRUPT_PSM);
+        }
+    }
+
+    void disconnected(SimDevice& d)
+    {
+        uint8_t dc[4] = {0,(uint8_t)d.handle,(uint8_t)(d.handle >> 8),0x13};  // remote user terminated
+        event(DISCONNECTION_COMP_EVT,dc,sizeof(dc));
+        d.handle = 0;
+        d.paging = false;
+        d.channels.clear();
+    }
+
+    // the device opens a channel to the listening host
+    void open(SimDevice& d, uint16_t psm)
+    {
+        SimChannel c = {psm,_next_cid++,0};
+        d.channels.push_back(c);
+        uint16_t p[2] = {psm,c.cid};
+        signal(d,CONN_REQ,d.txid++,p,2);
+    }
+
+    void connect(SimDevice& d)
+    {
+        if (d.handle)
+            return;
+        d.paging = true;
+        uint8_t cr[10];
+        memcpy(cr,d.addr.b,6);
+        memcpy(cr+6,d.dev_class,3);
+        cr[9] = 1;
+        event(CONNECTION_REQUEST_EVT,cr,sizeof(cr));
+    }
+
+    void disconnect(SimDevice& d)
+    {
+        if (d.handle)
+            disconnected(d);
+    }
+
+    //==================================================================
+    // from the host
+
+    void send(const uint8_t* data, int len)
+    {
+        switch (data[0]) {
+            case 0x01: command(data[1] | (data[2] << 8),data+4,data[3]); break;
+            case 0x02: acl(data+1,len-1); break;
+            default:
+                printf("hci_sim: bad packet type %d\n",data[0]);
+        }
+    }
+
+    void command(uint16_t op, const uint8_t* p, int len)
+    {
+        SimDevice* d;
+        _commands++;
+        switch (op) {
+            case READ_BUFFER_SIZE:
+            {
+                uint8_t bs[7] = {0xFD,0x03,0,0x08,0,0,0};   // 1021 byte acl, 8 of them
+                complete(op,0,bs,sizeof(bs));
+            }
+                break;
+
+            case READ_BD_ADDR:
+            {
+                uint8_t a[6] = {0x01,0xEE,0xDD,0xCC,0xBB,0xAA};
+                complete(op,0,a,6);
+            }
+                break;
+
+            case INQUIRY:
+                status(op);
+                for (auto& dv : _devices) {
+                    if (dv.handle)
+                        continue;
+                    uint8_t ir[1+14] = {1};
+                    memcpy(ir+1,dv.addr.b,6);
+                    memcpy(ir+10,dv.dev_class,3);
+                    event(INQUIRY_RESULT_EVT,ir,sizeof(ir));
+                }
+                {
+                    uint8_t s = 0;
+                    event(INQUIRY_COMP_EVT,&s,1);
+                }
+                break;
+
+            case CREATE_CONNECTION:
+                status(op);
+                if ((d = device(p)))
+                    connection_complete(*d);
+                else {
+                    uint8_t cc[11] = {0x04};    // page timeout
+                    memcpy(cc+3,p,6);
+                    event(CONNECTION_COMP_EVT,cc,sizeof(cc));
+                }
+                break;
+
+            case ACCEPT_CONNECTION_REQUEST:
+                status(op);
+                if ((d = device(p)))
+                    connection_complete(*d);
+                break;
+
+            case DISCONNECT:
+                status(op);
+                if ((d = device_by_handle(p[0] | (p[1] << 8))))
+                    disconnected(*d);
+                break;
+
+            case REMOTE_NAME_REQUEST:
+                status(op);
+                if ((d = device(p))) {
+                    uint8_t rn[1+6+248] = {0};
+                    memcpy(rn+1,d->addr.b,6);
+                    strncpy((char*)rn+7,d->name.c_str(),247);
+                    event(RMT_NAME_REQUEST_COMP_EVT,rn,sizeof(rn));
+                }
+                break;
+
+            // ask the host for a key, fall back to a pin
+            case AUTHENTICATION_REQUESTED:
+                status(op);
+                if ((d = device_by_handle(p[0] | (p[1] << 8))))
+                    event(LINK_KEY_REQUEST_EVT,d->addr.b,6);
+                break;
+
+            case LINK_KEY_REQUEST_NEG_REPLY:
+                complete(op,0,p,6);
+                event(PIN_CODE_REQUEST_EVT,p,6);
+                break;
+
+            case LINK_KEY_REQUEST_REPLY:
+                complete(op,0,p,6);
+                authenticated(p,false);
+                break;
+
+            case PIN_CODE_REQUEST_REPLY:
+                complete(op,0,p,6);
+                authenticated(p,true);
+                break;
+
+            default:
+                complete(op);   // WRITE_SCAN_ENABLE et al, nothing to simulate
+        }
+    }
+
+    void authenticated(const uint8_t* addr, bool new_key)
+    {
+        SimDevice* d = device(addr);
+        if (!d)
+            return;
+        if (new_key) {
+            uint8_t lk[6+16+1];
+            memcpy(lk,addr,6);
+            for (int i = 0; i < 16; i++)
+                lk[6+i] = addr[i % 6] ^ i;
+            lk[22] = 0;
+            event(LINK_KEY_NOTIFICATION_EVT,lk,sizeof(lk));
+        }
+        uint8_t ac[3] = {0,(uint8_t)d->handle,(uint8_t)(d->handle >> 8)};
+        event(AUTHENTICATION_COMP_EVT,ac,sizeof(ac));
+    }
+
+    // the host never fragments, everything fits in its 1021 byte buffers
+    void acl(const uint8_t* data, int len)
+    {
+        SimDevice* d = device_by_handle((data[0] | (data[1] << 8)) & 0x0FFF);
+        if (!d)
+            return;
+        int n = data[4] | (data[5] << 8);
+        int cid = data[6] | (data[7] << 8);
+        data += 8;
+        if (cid == 1) {
+            control(*d,data,n);
+            return;
+        }
+        SimChannel* c = d->channel(cid);
+        if (!c)
+            return;
+        switch (c->psm) {
+            case SDP_PSM:       sdp(*d,*c,data,n); break;
+            case INTERRUPT_PSM: output(*d,*c,data,n); break;
+        }
+    }
+
+    void control(SimDevice& d, const uint8_t* data, int len)
+    {
+        uint8_t code = data[0];
+        uint8_t id = data[1];
+        const uint8_t* p = data + 4;
+        #define P(_i) (p[(_i)*2] | (p[(_i)*2+1] << 8))
+        SimChannel* c;
+        switch (code) {
+            case CONN_REQ:      // host opens sdp, control or interrupt
+            {
+                SimChannel nc = {(uint16_t)P(0),_next_cid++,(uint16_t)P(1)};
+                d.channels.push_back(nc);
+                uint16_t r[4] = {nc.cid,nc.host_cid,0,0};
+                signal(d,CONN_RSP,id,r,4);
+                uint16_t q[4] = {nc.host_cid,0,0x0201,672};    // mtu option
+                signal(d,CONF_REQ,d.txid++,q,4);
+            }
+                break;
+
+            case CONN_RSP:      // host accepted one we opened
+                if ((c = d.channel(P(1)))) {
+                    c->host_cid = P(0);
+                    uint16_t q[4] = {c->host_cid,0,0x0201,672};
+                    signal(d,CONF_REQ,d.txid++,q,4);
+                }
+                break;
+
+            case CONF_REQ:
+                if ((c = d.channel(P(0)))) {
+                    uint16_t r[3] = {c->host_cid,0,0};
+                    signal(d,CONF_RSP,id,r,3);
+                    if (c->psm == INTERRUPT_PSM && d.type == HCI_SIM_WIIMOTE) {
+                        uint8_t hello[4] = {0xA1,0x30,0,0};     // buttons, gets the host to set leds
+                        l2cap(d,c->host_cid,hello,4);
+                    }
+                }
+                break;
+
+            case DISCONN_REQ:
+                for (size_t i = 0; i < d.channels.size(); i++) {
+                    if (d.channels[i].cid == P(0)) {
+                        uint16_t r[2] = {(uint16_t)P(0),(uint16_t)P(1)};
+                        d.channels.erase(d.channels.begin() + i);
+                        signal(d,DISCONN_RSP,id,r,2);
+                        break;
+                    }
+                }
+                break;
+        }
+        #undef P
+    }
+
+    // service search attribute request, answered in pieces to exercise continuations
+    void sdp(SimDevice& d, SimChannel& c, const uint8_t* data, int len)
+    {
+        if (data[0] != 0x06 || len < 20)
+            return;
+        int offset = data[19] ? (data[20] | (data[21] << 8)) : 0;
+
+        static const uint8_t desc[] = {     // boot keyboard-ish report descriptor
+            0x05,0x01,0x09,0x06,0xA1,0x01,0x85,0x01,0x05,0x07,0x19,0xE0,0x29,0xE7,0x15,0x00,
+            0x25,0x01,0x75,0x01,0x95,0x08,0x81,0x02,0x95,0x06,0x75,0x08,0x26,0xFF,0x00,0x05,
+            0x07,0x19,0x00,0x29,0xFF,0x81,0x00,0xC0
+        };
+        vector<uint8_t> a;
+        const uint8_t cls[] = {0x09,0x00,0x01, 0x35,0x03,0x19,0x11,0x24};   // ServiceClassIDList: HID
+        a.insert(a.end(),cls,cls+sizeof(cls));
+        a.insert(a.end(),{0x09,0x01,0x00,0x25,(uint8_t)d.name.size()});     // ServiceName
+        a.insert(a.end(),d.name.begin(),d.name.end());
+        a.insert(a.end(),{0x09,0x02,0x06,0x35,(uint8_t)(sizeof(desc)+6),    // HIDDescriptorList
+            0x35,(uint8_t)(sizeof(desc)+4),0x08,0x22,0x25,(uint8_t)sizeof(desc)});
+        a.insert(a.end(),desc,desc+sizeof(desc));
+        a.insert(a.begin(),{0x35,(uint8_t)a.size()});   // one record
+        a.insert(a.begin(),{0x35,(uint8_t)a.size()});   // attribute lists
+
+        int n = min(SIM_SDP_CHUNK,(int)a.size() - offset);
+        int next = offset + n;
+        bool more = next < (int)a.size();
+        vector<uint8_t> r = {0x07,data[1],data[2],0,0,(uint8_t)(n >> 8),(uint8_t)n};
+        r.insert(r.end(),a.begin()+offset,a.begin()+next);
+        r.push_back(more ? 2 : 0);
+        if (more) {
+            r.push_back(next);
+            r.push_back(next >> 8);
+        }
+        r[3] = (r.size() - 5) >> 8;
+        r[4] = r.size() - 5;
+        l2cap(d,c.host_cid,&r[0],(int)r.size());
+    }
+
+    // wiimote output reports
+    void output(SimDevice& d, SimChannel& c, const uint8_t* data, int len)
+    {
+        if (d.type != HCI_SIM_WIIMOTE || len < 3 || data[0] != 0xA2)
+            return;
+        uint8_t r[23] = {0xA1};
+        switch (data[1]) {
+            case 0x15:  // status: extension plugged in, battery good
+                r[1] = 0x20;
+                r[4] = 0x02;
+                r[7] = 0xC0;
+                l2cap(d,c.host_cid,r,8);
+                break;
+
+            case 0x17:  // read: extension id is classic controller
+            {
+                static const uint8_t id[6] = {0x00,0x00,0xA4,0x20,0x01,0x01};
+                r[1] = 0x21;
+                r[4] = (((data[6] << 8) | data[7]) - 1) << 4;
+                r[5] = data[4];
+                r[6] = data[5];
+                memcpy(r+7,id,6);
+                l2cap(d,c.host_cid,r,23);
+            }
+                break;
+
+            case 0x12:  // report mode
+                d.wii_mode = data[3];
+                // fall through
+            case 0x16:  // write
+                r[1] = 0x22;
+                r[4] = data[1];
+                l2cap(d,c.host_cid,r,6);
+                break;
+        }
+    }
+
+    int report(SimDevice& d, const uint8_t* data, int len)
+    {
+        SimChannel* c = d.psm(INTERRUPT_PSM);
+        if (!d.handle || !c || !c->host_cid)
+            return -1;
+        l2cap(d,c->host_cid,data,len);
+        return 0;
+    }
+};
+
+static HCISim _sim;
+
+//==================================================================
+//==================================================================
+//  hci_transport.h
+
+hci_handle hci_open()
+{
+    return &_sim;
+}
+
+int hci_close(hci_handle h)
+{
+    return 0;
+}
+
+void hci_set_packet_handler(hci_handle h, hci_on_packet_handler p, void* ref)
+{
+    _sim.set_packet_handler(p,ref);
+}
+
+void hci_set_ready_to_send_handler(hci_handle h, hci_on_ready_to_send_handler p, void* ref)
+{
+    _sim.set_ready_to_send_handler(p,ref);
+}
+
+int hci_send(hci_handle h, const uint8_t* data, int len)
+{
+    _sim.send(data,len);
+    return 0;
+}
+
+int hci_send_available(hci_handle h)
+{
+    return 1;
+}
+
+uint32_t hci_time_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return (uint32_t)(t.tv_sec*1000000ULL + t.tv_nsec/1000);
+}
+
+int sys_get_pref(const char* key, char* value, int max_len)
+{
+    value[0] = 0;
+    auto it = _sim._prefs.find(key);
+    if (it == _sim._prefs.end())
+        return 0;
+    strncpy(value,it->second.c_str(),max_len);
+    return (int)strlen(value);
+}
+
+void sys_set_pref(const char* key, const char* value)
+{
+    _sim._prefs[key] = value;
+}
+
+//==================================================================
+//==================================================================
+//  scripting
+
+int hci_sim_add(int type, const char* name)
+{
+    return _sim.add(type,name);
+}
+
+void hci_sim_connect(int dev)
+{
+    if (auto* d = _sim.device(dev))
+        _sim.connect(*d);
+}
+
+void hci_sim_disconnect(int dev)
+{
+    if (auto* d = _sim.device(dev))
+        _sim.disconnect(*d);
+}
+
+bool hci_sim_open(int dev)
+{
+    auto* d = _sim.device(dev);
+    if (!d || !d->handle)
+        return false;
+    auto* c = d->psm(INTERRUPT_PSM);
+    return c && c->host_cid;
+}
+
+int hci_sim_report(int dev, const uint8_t* report, int len)
+{
+    auto* d = _sim.device(dev);
+    return d ? _sim.report(*d,report,len) : -1;
+}
+
+void hci_sim_update()
+{
+    _sim.update();
+}
+
+int hci_sim_commands()
+{
+    return _sim._commands;
+}
+
+#ifdef HCI_SIM_MAIN
+//==================================================================
+//==================================================================
+//  pair a keyboard, a wiimote and a gamepad, then time reports through the stack
+
+#include "hid_server.h"
+
+void gui_msg(const char* msg)
+{
+    printf("gui_msg: %s\n",msg);
+}
+
+void sys_msg(const char* msg)
+{
+    gui_msg(msg);
+}
+
+// run the stack until every device is open and the wiimote setup chatter has died down
+static int _pump_open;      // update where the last device opened
+
+static int pump(int max_updates, int devices)
+{
+    uint8_t buf[64];
+    int quiet = 0;
+    _pump_open = -1;
+    for (int i = 0; i < max_updates; i++) {
+        hci_sim_update();
+        hid_update();
+        int n = 0;
+        while (hid_get(buf,sizeof(buf)) > 0)
+            n++;
+        int open = 0;
+        for (int d = 0; d < devices; d++)
+            open += hci_sim_open(d);
+        if (open == devices && _pump_open < 0)
+            _pump_open = i + 1;
+        quiet = (open == devices && !n) ? quiet + 1 : 0;
+        if (quiet == 4)
+            return i + 1;
+    }
+    return -1;
+}
+
+// one report per device type, a counter in the buttons
+static int make_report(int type, uint32_t n, uint8_t* r)
+{
+    switch (type) {
+        case HCI_SIM_KEYBOARD:
+            memset(r,0,10);
+            r[0] = 0xA1;
+            r[1] = 0x01;
+            r[4] = 4 + (n % 26);    // a..z
+            return 10;
+        case HCI_SIM_WIIMOTE:       // big report, classic controller buttons at the end
+            memset(r,0,23);
+            r[0] = 0xA1;
+            r[1] = 0x37;
+            r[2] = n;
+            r[3] = n >> 8;
+            r[21] = ~(n >> 8);      // active low
+            r[22] = ~n;
+            return 23;
+        default:
+            r[0] = 0xA1;
+            r[1] = 0x01;
+            r[2] = n;
+            r[3] = n >> 8;
+            r[4] = 0x80;
+            r[5] = 0x80;
+            return 6;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int reports = argc > 1 ? atoi(argv[1]) : 300000;
+    const int types[] = {HCI_SIM_KEYBOARD,HCI_SIM_WIIMOTE,HCI_SIM_GAMEPAD};
+    const int devices = 3;
+    for (int i = 0; i < devices; i++)
+        hci_sim_add(types[i]);
+
+    // inquiry, sdp, pin and link keys
+    hid_init("emu32");
+    uint32_t t = hci_time_us();
+    int n = pump(1000,devices);
+    printf("hci_sim: %d devices paired in %d updates, open after %d, %dus\n",devices,n,_pump_open,hci_time_us()-t);
+    if (n < 0)
+        return 1;
+
+    // drop the wiimote and let it page back in with its link key
+    hci_sim_disconnect(1);
+    hci_sim_connect(1);
+    t = hci_time_us();
+    int c = hci_sim_commands();
+    n = pump(1000,devices);
+    printf("hci_sim: wiimote reconnected in %d updates, open after %d, %d hci commands, %dus\n",n,_pump_open,hci_sim_commands()-c,hci_time_us()-t);
+    if (n < 0)
+        return 1;
+
+    // power cycle us, the devices are found again by a stack that only has prefs to go on
+    for (int i = 0; i < devices; i++)
+        hci_sim_disconnect(i);
+    pump(4,0);
+    hid_close();
+    t = hci_time_us();
+    c = hci_sim_commands();
+    hid_init("emu32");
+    n = pump(1000,devices);
+    printf("hci_sim: restarted and reconnected in %d updates, open after %d, %d hci commands, %dus\n",n,_pump_open,hci_sim_commands()-c,hci_time_us()-t);
+    if (n < 0)
+        return 1;
+
+    // batches small enough not to overflow the rx and socket queues
+    const int batch = 8;
+    uint8_t r[32],buf[64];
+    uint32_t sent = 0,got = 0,bytes = 0,wii = 0;
+    uint32_t stack_us = 0;
+    uint32_t start = hci_time_us();
+    while (sent < (uint32_t)reports) {
+        for (int b = 0; b < batch; b++) {
+            for (int d = 0; d < devices; d++) {
+                int len = make_report(types[d],sent,r);
+                hci_sim_report(d,r,len);
+                if (types[d] == HCI_SIM_WIIMOTE)
+                    wii = sent & 0xFFFF;
+                sent++;
+            }
+        }
+        t = hci_time_us();
+        hid_update();
+        int len;
+        while ((len = hid_get(buf,sizeof(buf))) > 0) {
+            got++;
+            bytes += len;
+        }
+        stack_us += hci_time_us() - t;
+    }
+    uint32_t elapsed = hci_time_us() - start;
+
+    uint16_t classic = wii_states[0].classic();
+    printf("hci_sim: %d reports sent, %d received (%d bytes), wiimote classic buttons %04X of %04X\n",sent,got,bytes,classic,wii);
+    printf("hci_sim: %.0f reports/sec, stack %.3fus/report, total %.3fus/report\n",
+        got*1000000.0/elapsed,(float)stack_us/got,(float)elapsed/got);
+
+    // a pad that keeps reporting the same state only gets through once
+    int len = make_report(HCI_SIM_GAMEPAD,12345,r);
+    for (int i = 0; i < 8; i++)
+        hci_sim_report(2,r,len);
+    hid_update();
+    int same = 0;
+    while (hid_get(buf,sizeof(buf)) > 0)
+        same++;
+    printf("hci_sim: 8 identical reports, %d received\n",same);
+    return (got == sent && classic == wii && same == 1) ? 0 : 1;
+}
+#endif
+
+#endif
@@ -22,8 +22,10 @@
 #include <unistd.h>
 #include <vector>
 #include <string>
+#include <map>
 using namespace std;
 
+#include "hci_transport.h"
 #include "hci_server.h"
 #include "hid_server.h"
 
@@ -59,18 +61,25 @@ public:
     string _hid_descriptor;
 
     bool _reconnect;
+    bool _known;            // name and descriptor came from the cache
     int _sdp;
     int _control;
     int _interrupt;
 
     int _wii_index;
 
+    uint8_t _last[64];      // what the last report forwarded changed, to drop ones that change nothing
+    int _last_len;
+
+    bool redundant(const uint8_t* data, int len);
+
     const char* name();
     void connect();
     void authentication_complete(int status);
     void connection_request();
     void connection_complete(int status);
     void remote_name_response(const char* name);
+    void named();
     void disconnection_complete();
     void socket_changed(int socket, int state);
 
@@ -686,7 +695,115 @@ public:
     }
 };
 
-InputDevice::InputDevice() : _sdp_handler(0),_reconnect(0),_wii_index(-1) {
+//==================================================================
+//==================================================================
+// What a device told us the first time we met, kept in prefs and loaded at hid_init so a
+// reconnect can go straight to the hid channels without asking for the name or sdp again.
+// "hid_devices" lists the addresses, "h<address>" holds class and name in hex. The hid descriptor
+// isn't kept, nothing reads it and it can run to a few KB of NVS per device.
+
+#define KNOWN_DEVICES 16
+
+class DeviceCache {
+public:
+    typedef struct {
+        int dev_class;
+        string name;
+    } entry;
+
+    map<string,entry> _entries;     // by address in hex
+    string _order;                  // addresses, oldest first
+
+    static string hex(const uint8_t* d, int len)
+    {
+        const char* h = "0123456789ABCDEF";
+        string s;
+        for (int i = 0; i < len; i++) {
+            s += h[d[i] >> 4];
+            s += h[d[i] & 0xF];
+        }
+        return s;
+    }
+
+    static string unhex(const char* s, int len)
+    {
+        string d;
+        for (int i = 0; i + 1 < len; i += 2) {
+            char b[3] = {s[i],s[i+1],0};
+            d += (char)strtol(b,0,16);
+        }
+        return d;
+    }
+
+    static string pref(const string& key, int max_len)
+    {
+        vector<char> buf(max_len+1);
+        if (!sys_get_pref(key.c_str(),&buf[0],max_len+1))     // room for the terminator
+            return "";
+        return &buf[0];
+    }
+
+    void load()
+    {
+        _entries.clear();
+        _order = pref("hid_devices",KNOWN_DEVICES*12);
+        for (int i = 0; i + 12 <= (int)_order.size(); i += 12) {
+            string a = _order.substr(i,12);
+            string v = pref("h" + a,8 + 255*2);
+            if (v.size() < 8)
+                continue;
+            entry& e = _entries[a];
+            e.dev_class = strtol(v.substr(0,6).c_str(),0,16);
+            int n = strtol(v.substr(6,2).c_str(),0,16);
+            e.name = unhex(v.c_str() + 8,min(n*2,(int)v.size()-8));
+
+            bdaddr_t ba;
+            string b = unhex(a.c_str(),12);
+            memcpy(ba.b,b.c_str(),6);
+            uint8_t key[16];
+            read_link_key(&ba,key);         // into ram now rather than when the device is waiting
+            printf("%s known as %s\n",batostr(ba),e.name.c_str());
+        }
+    }
+
+    const entry* find(const bdaddr_t& ba)
+    {
+        auto i = _entries.find(hex(ba.b,6));
+        return i == _entries.end() ? 0 : &i->second;
+    }
+
+    void save(const bdaddr_t& ba, int dev_class, const string& name)
+    {
+        string a = hex(ba.b,6);
+        entry& e = _entries[a];
+        if (e.dev_class == dev_class && e.name == name && _order.find(a) != string::npos)
+            return;
+        e.dev_class = dev_class;
+        e.name = name;
+
+        char c[9];
+        sprintf(c,"%06X%02X",dev_class & 0xFFFFFF,min((int)name.size(),255));
+        string v = c + hex((const uint8_t*)name.c_str(),min((int)name.size(),255));
+        sys_set_pref(("h" + a).c_str(),v.c_str());
+
+        for (int i = 0; i + 12 <= (int)_order.size(); i += 12) {
+            if (_order.compare(i,12,a) == 0) {
+                _order.erase(i,12);
+                break;
+            }
+        }
+        _order += a;
+        if (_order.size() > KNOWN_DEVICES*12) {
+            _entries.erase(_order.substr(0,12));
+            _order.erase(0,12);
+        }
+        sys_set_pref("hid_devices",_order.c_str());
+    }
+};
+
+static DeviceCache _device_cache;
+
+InputDevice::InputDevice() : _sdp_handler(0),_reconnect(0),_known(0),_wii_index(-1),_last_len(0) {
     _name[0] = 0;
 }
 
@@ -709,6 +826,8 @@ void InputDevice::update_sdp()
         _sdp_handler = 0;
         l2_close(_sdp);
         _sdp = 0;
+        _device_cache.save(_bdaddr,_dev_class,_name);
+        _known = true;
 
         // got the sdp from the new device
         // do we want to authenticate?
@@ -748,6 +867,10 @@ void InputDevice::connection_complete(int status)
         _control = l2_open(&_bdaddr, HID_CONTROL_PSM, true);
         _interrupt = l2_open(&_bdaddr, HID_INTERRUPT_PSM, true);
     }
+    if (_known) {
+        named();        // seen before, don't wait for the name
+        return;
+    }
     hci_remote_name_request(&_bdaddr);
     _state = READING_NAME;
 }
@@ -755,11 +878,19 @@ void InputDevice::connection_complete(int status)
 void InputDevice::remote_name_response(const char* n)
 {
     _name = n;
+    named();
+}
+
+void InputDevice::named()
+{
     gui_msg(name());
 
     uint8_t key[16];
     if (_reconnect || (read_link_key(&_bdaddr,key) == 0))       // do we know this device?
     {
+        if (!_known)
+            _device_cache.save(_bdaddr,_dev_class,_name);   // paired before the cache existed
+        _known = true;
         if (_reconnect)
             _state = OPENING;                   // we already have a link key
         else {
@@ -784,6 +915,29 @@ void InputDevice::authentication_complete(int status)
     }
 }
 
+// wii button reports are compared on the buttons alone, the accelerometer never holds still
+bool InputDevice::redundant(const uint8_t* data, int len)
+{
+    uint8_t key[sizeof(_last)];
+    if (len >= 2 && (data[1] == 0x32 || data[1] == 0x37) && _wii_index != -1) {
+        uint16_t c = wii_states[_wii_index].common();
+        uint16_t k = wii_states[_wii_index].classic();
+        key[0] = data[1];
+        key[1] = c >> 8;
+        key[2] = c;
+        key[3] = k >> 8;
+        key[4] = k;
+        data = key;
+        len = 5;
+    }
+    len = min(len,(int)sizeof(_last));
+    if (len == _last_len && memcmp(_last,data,len) == 0)
+        return true;
+    memcpy(_last,data,len);
+    _last_len = len;
+    return false;
+}
+
 void InputDevice::disconnection_complete()
 {
     l2_close(_sdp);     // these are already dead
@@ -796,6 +950,7 @@ void InputDevice::disconnection_complete()
     if (_wii_index != -1)
         wii_states[_wii_index].flags = 0;
     _wii_index = -1;
+    _last_len = 0;
 }
 
 const char* _nams[] = {
@@ -826,6 +981,7 @@ const char* InputDevice::name()
 class HIDSource {
     string _local_name;
     vector<InputDevice*> _devices;
+    int _next;              // device to read first next time, so a chatty one can't starve the rest
     WII _wii;
 
     InputDevice* get_device(const bdaddr_t* bdaddr)
@@ -877,8 +1033,15 @@ class HIDSource {
             d->_dev_class = (dev_class[0] << 16) | (dev_class[1] << 8) | dev_class[2];
             d->_control = d->_interrupt = d->_sdp = 0;
             d->_state = InputDevice::CLOSED;
+            auto* e = _device_cache.find(*addr);
+            if (e) {
+                if (!d->_dev_class)
+                    d->_dev_class = e->dev_class;   // wiimotes can report 0 on reconnect
+                d->_name = e->name;
+                d->_known = true;
+            }
             _devices.push_back(d);
-            printf("%s:%06X input device added\n",batostr(d->_bdaddr),d->_dev_class);
+            printf("%s:%06X input device added%s\n",batostr(d->_bdaddr),d->_dev_class,e ? " (known)" : "");
         }
         return d;
     }
@@ -953,8 +1116,9 @@ class HIDSource {
     }
 
     public:
-    HIDSource(const char* localname) : _local_name(localname)
+    HIDSource(const char* localname) : _local_name(localname),_next(0)
     {
+        _device_cache.load();
         hci_init(hci_cb,this);
     }
 
@@ -963,21 +1127,29 @@ class HIDSource {
         printf("HID CONTROL %02X %d\n",data[0],len);
     }
 
-    // get hid (events). max one per call
+    // get hid (events). max one per call, taking turns between devices
+    // reports that don't change anything the emulators look at are dropped here
     // called from emu thread
-    int get(uint8_t* dst, int dst_len)
+    int get(uint8_t* dst, int dst_len, uint32_t* arrival_us)
     {
-        for (auto d : _devices) {
-            if (d->_interrupt) {
-                int len = l2_recv(d->_interrupt,dst,dst_len);
+        int n = (int)_devices.size();
+        for (int i = 0; i < n; i++) {
+            int index = (_next + i) % n;
+            auto d = _devices[index];
+            while (d->_interrupt) {
+                int len = l2_recv(d->_interrupt,dst,dst_len,arrival_us);
                 if (len > 0) {
                     _wii.hid(d,dst,len);
+                    if (d->redundant(dst,len))
+                        continue;
+                    _next = index + 1;
                     return len;
                 }
                 if (len < 0) {
                     printf("hid shutting down TODO\n");
                     d->disconnection_complete();
                 }
+                break;
             }
             if (d->_sdp)
                 d->update_sdp();
@@ -1007,32 +1179,14 @@ int hid_update()
     return hci_update();
 }
 
-int hid_get(uint8_t* dst, int dst_len)
+int hid_get(uint8_t* dst, int dst_len, uint32_t* arrival_us)
 {
     if (!_hid_source)
         return -1;
-    return _hid_source->get(dst,dst_len);
+    return _hid_source->get(dst,dst_len,arrival_us);
 }
 
-// map wii controller keys
-uint32_t wii_map(int index, const uint32_t* common, const uint32_t* classic)
+uint32_t hid_time_us()
 {
-    uint32_t f = wii_states[index].flags;
-    if (!(f & wiimote))
-        return 0;
-
-    uint32_t r = 0;
-    int pad = wii_states[index].common();
-    for (int i = 0; i < 16; i++) {
-        if (pad & (0x8000 >> i))
-            r |= common[i];
-    }
-    if (classic && (f & classic_controller)) {
-        pad = wii_states[index].classic();
-        for (int i = 0; i < 16; i++) {
-            if (pad & (0x8000 >> i))
-                r |= classic[i];
-        }
-    }
-    return r;
+    return hci_time_us();
 }
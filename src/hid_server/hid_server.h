@@ -129,7 +129,7 @@ typedef struct {
     uint8_t report[32];
     uint16_t common()   { return (report[2] << 8) | report[3]; }
     uint16_t classic()  {
-        if (report[0] == 0x37)
+        if (report[1] == 0x37)      // report[0] is the 0xA1 hid header
             return ((report[21] << 8) | report[22]) ^ 0xFFFF;
         return ((report[8] << 8) | report[9]) ^ 0xFFFF;
     }
@@ -137,13 +137,13 @@ typedef struct {
 
 // report all of the wii states
 extern wii_state wii_states[4];
-uint32_t wii_map(int index, const uint32_t* common, const uint32_t* classic);
 
 // minimal hid interface
 int hid_init(const char* local_name);
 int hid_update();
 int hid_close();
-int hid_get(uint8_t* dst, int dst_len); //
+int hid_get(uint8_t* dst, int dst_len, uint32_t* arrival_us = 0);   // one report, stamped with hid_time_us() on arrival
+uint32_t hid_time_us();                                             // microseconds, same on both cores
 
 void gui_msg(const char* msg);                                  // temporarily display a msg
 
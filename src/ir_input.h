@@ -18,35 +18,73 @@
 #ifndef __ir_input__
 #define __ir_input__
 
-// generate events on state changes of IR pin, feed to state machines.
+#include <atomic>
+
+// record state changes of IR pin from the video isr, feed them to state machines once per frame.
 // event timings  have a resolution of HSYNC, timing is close enough between 15720 and 15600 to make this work
 // poll to synthesize hid events at every frame
 // i know there is a perfectly good peripheral for this in the ESP32 but this seems more fun somehow
 
-#define WEBTV_KEYBOARD
-#define RETCON_CONTROLLER
-#define FLASHBACK_CONTROLLER
-//#define APPLE_TV_CONTROLLER
-
 uint8_t _ir_last = 0;
 uint8_t _ir_count = 0;
 uint8_t _keyDown = 0;
 uint8_t _keyUp = 0;
 
-void IRAM_ATTR ir_event(uint8_t ticks, uint8_t value); // t is HSYNCH ticks, v is value
+// edges waiting to be decoded, (ticks << 1) | value
+// at most one edge per line so this holds most of a frame
+uint16_t _ir_edges[256];
+std::atomic<uint8_t> _ir_edge_read(0);
+std::atomic<uint8_t> _ir_edge_write(0);
+uint32_t _ir_edge_drops = 0;
+
+// t is HSYNCH ticks, v is the value the pin held for that long
+// called from the isr, or with captured edges when testing decoders
+inline void IRAM_ATTR ir_edge(uint8_t t, uint8_t v)
+{
+    uint8_t w = _ir_edge_write.load(std::memory_order_relaxed);
+    if ((uint8_t)(w + 1) == _ir_edge_read.load(std::memory_order_acquire)) {
+        _ir_edge_drops++;   // decoders will see a framing error and resync
+        return;
+    }
+    _ir_edges[w] = (t << 1) | v;
+    _ir_edge_write.store(w + 1,std::memory_order_release);
+}
 
+#ifdef IR_PIN
 inline void IRAM_ATTR ir_sample()
 {
     uint8_t ir = (GPIO.in & (1 << IR_PIN)) != 0;
     if (ir != _ir_last)
     {
-        ir_event(_ir_count,_ir_last);
+        ir_edge(_ir_count,_ir_last);
         _ir_count = 0;
         _ir_last = ir;
     }
     if (_ir_count != 0xFF)
         _ir_count++;
 }
+#endif
+
+// a protocol, registered with ir_register
+typedef struct {
+    const char* name;
+    void (*edge)(uint8_t t, uint8_t v);     // every edge, in order
+    int (*get_hid)(uint8_t* dst);           // once a frame after edges, length of a fake hid report or 0
+} ir_decoder;
+
+#define IR_DECODERS 8
+const ir_decoder* _ir_decoders[IR_DECODERS] = {0};
+int _ir_decoder_count = 0;
+
+// earlier decoders get first say in get_hid_ir
+int ir_register(const ir_decoder* d)
+{
+    if (_ir_decoder_count == IR_DECODERS)
+        return -1;
+    printf("ir_register %s\n",d->name);
+    _ir_decoders[_ir_decoder_count] = d;
+    return _ir_decoder_count++;
+}
 
 class IRState {
 public:
@@ -100,7 +138,6 @@ public:
 // Apple remote NEC code
 // pretty easy to adapt to any NEC remote
 
-#ifdef APPLE_TV_CONTROLLER
 
 // Silver apple remote, 7 Bit code
 // should work with both silvers and white
@@ -152,7 +189,7 @@ int get_hid_apple(uint8_t* dst)
 }
 
 // NEC codes used by apple remote
-void IRAM_ATTR ir_apple(uint8_t t, uint8_t v)
+void ir_apple(uint8_t t, uint8_t v)
 {
   if (!v) {
     if (t > 32)
@@ -173,13 +210,12 @@ void IRAM_ATTR ir_apple(uint8_t t, uint8_t v)
   }
 }
 
-#endif
+const ir_decoder ir_apple_decoder = { "apple", ir_apple, get_hid_apple };
 
 //==========================================================
 //==========================================================
 //  Atari Flashback 4 wireless controllers
 
-#ifdef FLASHBACK_CONTROLLER
 
 // HSYNCH period is 44/315*455 or 63.55555..us
 // 18 bit code 1.87khz clock
@@ -219,7 +255,7 @@ int get_hid_flashback(uint8_t* dst)
     return _flashback.get_hid(dst);
 }
 
-void IRAM_ATTR ir_flashback(uint8_t t, uint8_t v)
+void ir_flashback(uint8_t t, uint8_t v)
 {
   if (_flashback._state == 0)
   {
@@ -257,7 +293,7 @@ void IRAM_ATTR ir_flashback(uint8_t t, uint8_t v)
   }
 }
 
-#endif
+const ir_decoder ir_flashback_decoder = { "flashback", ir_flashback, get_hid_flashback };
 
 //==========================================================
 //==========================================================
@@ -271,7 +307,6 @@ void IRAM_ATTR ir_flashback(uint8_t t, uint8_t v)
 // LOW1 = 4.25
 // HIGH = 5.82
 
-#ifdef RETCON_CONTROLLER
 
 // number of 63.55555 cycles per bit
 #define PREAMBLE_L(_t) (_t >= 12 && _t <= 14) // 12/13/14 preamble
@@ -320,7 +355,7 @@ int get_hid_retcon(uint8_t* dst)
     return _retcon.get_hid(dst);
 }
 
-void IRAM_ATTR ir_retcon(uint8_t t, uint8_t v)
+void ir_retcon(uint8_t t, uint8_t v)
 {
   if (_retcon._state == 0)
   {
@@ -345,13 +380,12 @@ void IRAM_ATTR ir_retcon(uint8_t t, uint8_t v)
   }
 }
 
-#endif
+const ir_decoder ir_retcon_decoder = { "retcon", ir_retcon, get_hid_retcon };
 
 
 //==========================================================
 //==========================================================
 //  Webtv keyboard
-#ifdef WEBTV_KEYBOARD
 
 #define BAUDB   12  // Width of uart bit in HSYNCH
 #define WT_PREAMBLE(_t) (_t >= 36 && _t <= 40)   // 3.25 baud
@@ -593,7 +627,7 @@ int get_hid_webtv(uint8_t* dst)
 
 #define KEYDOWN     0x4A
 #define KEYUP       0x5E
-void IRAM_ATTR ir_webtv(uint8_t t, uint8_t v)
+void ir_webtv(uint8_t t, uint8_t v)
 {
   if (_state == 0)
   {
@@ -629,44 +663,38 @@ void IRAM_ATTR ir_webtv(uint8_t t, uint8_t v)
       _state = bits+2;
     }
 }
-#endif
 
-// called from interrupt
-void IRAM_ATTR ir_event(uint8_t t, uint8_t v)
+
+const ir_decoder ir_webtv_decoder = { "webtv", ir_webtv, get_hid_webtv };
+
+// the protocols we listen for unless the sketch registered its own before video_init
+void ir_begin()
 {
-#ifdef WEBTV_KEYBOARD
-    ir_webtv(t,v);
-#endif
-#ifdef RETCON_CONTROLLER
-    ir_retcon(t,v);
-#endif
-#ifdef APPLE_TV_CONTROLLER
-    ir_apple(t,v);
-#endif
-#ifdef FLASHBACK_CONTROLLER
-    ir_flashback(t,v);
-#endif
+    if (_ir_decoder_count)
+        return;
+    ir_register(&ir_retcon_decoder);
+    ir_register(&ir_flashback_decoder);
+    ir_register(&ir_webtv_decoder);
+    //ir_register(&ir_apple_decoder);
 }
 
 // called every frame from emu
+// run the decoders over everything the isr saw since last time
 int get_hid_ir(uint8_t* dst)
 {
+    uint8_t r = _ir_edge_read.load(std::memory_order_relaxed);
+    uint8_t w = _ir_edge_write.load(std::memory_order_acquire);
+    for (; r != w; r++) {
+        uint16_t e = _ir_edges[r];
+        for (int i = 0; i < _ir_decoder_count; i++)
+            _ir_decoders[i]->edge(e >> 1,e & 1);
+    }
+    _ir_edge_read.store(r,std::memory_order_release);
+
     int n = 0;
-#ifdef APPLE_TV_CONTROLLER
-    if (n = get_hid_apple(dst))
-        return n;
-#endif
-#ifdef RETCON_CONTROLLER
-    if (n = get_hid_retcon(dst))
-        return n;
-#endif
-#ifdef FLASHBACK_CONTROLLER
-    if (n = get_hid_flashback(dst))
-        return n;
-#endif
-    #ifdef WEBTV_KEYBOARD
-        return get_hid_webtv(dst);
-    #endif
+    for (int i = 0; i < _ir_decoder_count; i++)
+        if ((n = _ir_decoders[i]->get_hid(dst)))
+            return n;
     return 0;
 }
 #endif
@@ -81,7 +81,7 @@ bitmap_t *bmp_create(int width, int height, int overdraw)
    int pitch;
 
    pitch = width + (overdraw * 2); /* left and right */
-   addr = malloc((pitch * height) + 3); /* add max 32-bit aligned adjustment */
+   addr = MALLOC32((pitch * height) + 3, "bitmap"); /* add max 32-bit aligned adjustment */
    if (NULL == addr)
       return NULL;
 
@@ -100,7 +100,7 @@ void bmp_destroy(bitmap_t **bitmap)
    if (*bitmap)
    {
       if ((*bitmap)->data && false == (*bitmap)->hardware)
-         free((*bitmap)->data);
+         FREE32((*bitmap)->data);
       free(*bitmap);
       *bitmap = NULL;
    }
@@ -27,17 +27,6 @@
 #include "nes_apu.h"
 #include "fds_snd.h"
 
-static int32 fds_incsize = 0;
-
-/* mix sound channels together */
-static int32 fds_process(void)
-{
-   int32 output;
-   output = 0;
-
-   return output;
-}
-
 /* write to registers */
 static void fds_write(uint32 address, uint8 value)
 {
@@ -45,28 +34,21 @@ static void fds_write(uint32 address, uint8 value)
    UNUSED(value);
 }
 
-/* reset state of vrcvi sound channels */
-static void fds_reset(void)
-{
-   apu_t apu;
-
-   apu_getcontext(&apu);
-//   fds_incsize = apu.cycle_rate;
-   fds_incsize = (int32) (APU_BASEFREQ * 65536.0 / (float) apu.sample_rate);
-}
-
 static apu_memwrite fds_memwrite[] =
 {
    { 0x4040, 0x4092, fds_write }, 
    {     -1,     -1, NULL }
 };
 
+/* no channels yet, so nothing to log, clock or mix */
 apuext_t fds_ext = 
 {
    NULL, /* no init */
    NULL, /* no shutdown */
-   fds_reset,
-   fds_process,
+   NULL, /* no reset */
+   NULL, /* no logged writes */
+   NULL, /* no channels */
+   NULL, /* no frame sequencer */
    NULL, /* no reads */
    fds_memwrite
 };
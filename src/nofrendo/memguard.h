@@ -54,6 +54,12 @@ extern char *_my_strdup(const char *string);
 #endif /* !NOFRENDO_DEBUG */
 
 
+/* blocks that live as long as the core, from the frontend's arena */
+extern void *MALLOC32(int size, const char *name);
+/* blocks that live as long as the cart, all released at once on eject */
+extern void *MALLOC_MEDIA(int size, const char *name);
+extern void FREE32(void *data);
+
 extern void mem_cleanup(void);
 extern void mem_checkblocks(void);
 extern void mem_checkleaks(void);
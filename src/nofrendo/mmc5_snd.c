@@ -30,19 +30,16 @@
 
 /* TODO: encapsulate apu/mmc5 rectangle */
 
-#define  APU_OVERSAMPLE
-#define  APU_VOLUME_DECAY(x)  ((x) -= ((x) >> 7))
-
-/* look up table madness */
-static int32 decay_lut[16];
-static int vbl_lut[32];
+/* output per step of volume, matching the apu's rectangles */
+#define  MMC5_RECTANGLE_STEP  512
+#define  MMC5_DAC_STEP        64
 
 /* various sound constants for sound emulation */
-/* vblank length table used for rectangles, triangle, noise */
+/* length counter loads, in half frames */
 static const uint8 vbl_length[32] =
 {
-   5, 127, 10, 1, 19,  2, 40,  3, 80,  4, 30,  5, 7,  6, 13,  7,
-   6,   8, 12, 9, 24, 10, 48, 11, 96, 12, 36, 13, 8, 14, 16, 15
+   10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+   12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
 };
 
 /* ratios of pos/neg pulse for rectangle waves
@@ -71,14 +68,14 @@ typedef struct mmc5rectangle_s
 
    bool enabled;
    
-   float accum;
+   int32 timer;
    int32 freq;
    int32 output_vol;
    bool fixed_envelope;
    bool holdnote;
    uint8 volume;
 
-   int32 env_phase;
+   bool env_start;
    int32 env_delay;
    uint8 env_vol;
 
@@ -90,102 +87,64 @@ typedef struct mmc5rectangle_s
 typedef struct mmc5dac_s
 {
    int32 output;
+   int32 output_vol;
    bool enabled;
 } mmc5dac_t;
 
 
 static struct
 {
-   float incsize;
    uint8 mul[2];
    mmc5rectangle_t rect[2];
    mmc5dac_t dac;
 } mmc5;
 
 
-#define  MMC5_RECTANGLE_OUTPUT   chan->output_vol
-static int32 mmc5_rectangle(mmc5rectangle_t *chan)
+static void mmc5_rectangle(mmc5rectangle_t *chan, uint32 cycle, int32 cycles)
 {
-   int32 output;
-
-#ifdef APU_OVERSAMPLE
-   int num_times;
-   int32 total;
-#endif /* APU_OVERSAMPLE */
+   int32 vol, edge;
+   int steps;
 
    /* reg0: 0-3=volume, 4=envelope, 5=hold, 6-7=duty cycle
-   ** reg1: 0-2=sweep shifts, 3=sweep inc/dec, 4-6=sweep length, 7=sweep on
+   ** reg1: unused, no sweep
    ** reg2: 8 bits of freq
    ** reg3: 0-2=high freq, 7-4=vbl length counter
    */
 
-   APU_VOLUME_DECAY(chan->output_vol);
-
-   if (false == chan->enabled || 0 == chan->vbl_length)
-      return MMC5_RECTANGLE_OUTPUT;
-
-   /* vbl length counter */
-   if (false == chan->holdnote)
-      chan->vbl_length--;
-
-   /* envelope decay at a rate of (env_delay + 1) / 240 secs */
-   chan->env_phase -= 4; /* 240/60 */
-   while (chan->env_phase < 0)
-   {
-      chan->env_phase += chan->env_delay;
-
-      if (chan->holdnote)
-         chan->env_vol = (chan->env_vol + 1) & 0x0F;
-      else if (chan->env_vol < 0x0F)
-         chan->env_vol++;
-   }
-
-   if (chan->freq < 4)
-      return MMC5_RECTANGLE_OUTPUT;
-
-   chan->accum -= mmc5.incsize; /* # of cycles per sample */
-   if (chan->accum >= 0)
-      return MMC5_RECTANGLE_OUTPUT;
-
-#ifdef APU_OVERSAMPLE
-   num_times = total = 0;
-
-   if (chan->fixed_envelope)
-      output = chan->volume << 8; /* fixed volume */
+   if (0 == chan->vbl_length || chan->freq < 4)
+      vol = 0;
+   else if (chan->fixed_envelope)
+      vol = chan->volume * MMC5_RECTANGLE_STEP; /* fixed volume */
    else
-      output = (chan->env_vol ^ 0x0F) << 8;
-#endif
+      vol = chan->env_vol * MMC5_RECTANGLE_STEP;
 
-   while (chan->accum < 0)
-   {
-      chan->accum += chan->freq;
-      chan->adder = (chan->adder + 1) & 0x0F;
+   apu_mixext(&chan->output_vol, (chan->adder < chan->duty_flip) ? vol : 0, cycle);
 
-#ifdef APU_OVERSAMPLE
+   /* step from one edge of the duty cycle to the next */
+   while (vol)
+   {
       if (chan->adder < chan->duty_flip)
-         total += output;
+         steps = chan->duty_flip - chan->adder;
       else
-         total -= output;
-
-      num_times++;
-#endif
-   }
+         steps = 16 - chan->adder;
 
-#ifdef APU_OVERSAMPLE
-   chan->output_vol = total / num_times;
-#else
-   if (chan->fixed_envelope)
-      output = chan->volume << 8; /* fixed volume */
-   else
-      output = (chan->env_vol ^ 0x0F) << 8;
+      edge = chan->timer + (steps - 1) * chan->freq;
+      if (edge > cycles)
+         break;
 
-   if (0 == chan->adder)
-      chan->output_vol = output;
-   else if (chan->adder == chan->duty_flip)
-      chan->output_vol = -output;
-#endif
+      chan->adder = (chan->adder + steps) & 0x0F;
+      chan->timer = edge + chan->freq;
+      apu_mixext(&chan->output_vol, (chan->adder < chan->duty_flip) ? vol : 0, cycle + edge);
+   }
 
-   return MMC5_RECTANGLE_OUTPUT;
+   /* keep the sequencer in phase over the rest */
+   chan->timer -= cycles;
+   if (chan->timer <= 0)
+   {
+      steps = (-chan->timer) / chan->freq + 1;
+      chan->timer += steps * chan->freq;
+      chan->adder = (chan->adder + steps) & 0x0F;
+   }
 }
 
 static uint8 mmc5_read(uint32 address)
@@ -207,17 +166,44 @@ static uint8 mmc5_read(uint32 address)
    }
 }
 
-/* mix vrcvi sound channels together */
-static int32 mmc5_process(void)
+/* clock mmc5 sound channels, mixing them with the apu's */
+static void mmc5_run(uint32 cycle, int32 cycles)
 {
-   int32 accum;
+   mmc5_rectangle(&mmc5.rect[0], cycle, cycles);
+   mmc5_rectangle(&mmc5.rect[1], cycle, cycles);
+   apu_mixext(&mmc5.dac.output_vol, mmc5.dac.enabled ? mmc5.dac.output : 0, cycle);
+}
 
-   accum = mmc5_rectangle(&mmc5.rect[0]);
-   accum += mmc5_rectangle(&mmc5.rect[1]);
-   if (mmc5.dac.enabled)
-      accum += mmc5.dac.output;
+/* envelopes at 240Hz, length counters at 120Hz */
+static void mmc5_sequence(bool half_frame)
+{
+   mmc5rectangle_t *chan;
 
-   return accum;
+   for (chan = mmc5.rect; chan < mmc5.rect + 2; chan++)
+   {
+      if (chan->env_start)
+      {
+         chan->env_start = false;
+         chan->env_delay = chan->volume;
+         chan->env_vol = 0x0F;
+      }
+      else if (chan->env_delay)
+      {
+         chan->env_delay--;
+      }
+      else
+      {
+         chan->env_delay = chan->volume;
+
+         if (chan->env_vol)
+            chan->env_vol--;
+         else if (chan->holdnote)
+            chan->env_vol = 0x0F;
+      }
+
+      if (half_frame && chan->vbl_length && false == chan->holdnote)
+         chan->vbl_length--;
+   }
 }
 
 /* write to registers */
@@ -234,7 +220,6 @@ static void mmc5_write(uint32 address, uint8 value)
       mmc5.rect[chan].regs[0] = value;
 
       mmc5.rect[chan].volume = value & 0x0F;
-      mmc5.rect[chan].env_delay = decay_lut[value & 0x0F];
       mmc5.rect[chan].holdnote = (value & 0x20) ? true : false;
       mmc5.rect[chan].fixed_envelope = (value & 0x10) ? true : false;
       mmc5.rect[chan].duty_flip = duty_lut[value >> 6];
@@ -248,22 +233,19 @@ static void mmc5_write(uint32 address, uint8 value)
    case MMC5_WRB2:
       chan = (address & 4) ? 1 : 0;
       mmc5.rect[chan].regs[2] = value;
-      if (mmc5.rect[chan].enabled)
-         mmc5.rect[chan].freq = (((mmc5.rect[chan].regs[3] & 7) << 8) + value) + 1;
+      mmc5.rect[chan].freq = (((mmc5.rect[chan].regs[3] & 7) << 8) + value) + 1;
       break;
 
    case MMC5_WRA3:
    case MMC5_WRB3:
       chan = (address & 4) ? 1 : 0;
       mmc5.rect[chan].regs[3] = value;
+      mmc5.rect[chan].freq = (((value & 7) << 8) + mmc5.rect[chan].regs[2]) + 1;
+      mmc5.rect[chan].env_start = true;
+      mmc5.rect[chan].adder = 0;
 
       if (mmc5.rect[chan].enabled)
-      {
-         mmc5.rect[chan].vbl_length = vbl_lut[value >> 3];
-         mmc5.rect[chan].env_vol = 0;
-         mmc5.rect[chan].freq = (((value & 7) << 8) + mmc5.rect[chan].regs[2]) + 1;
-         mmc5.rect[chan].adder = 0;
-      }
+         mmc5.rect[chan].vbl_length = vbl_length[value >> 3];
       break;
    
    case MMC5_SMASK:
@@ -297,7 +279,7 @@ static void mmc5_write(uint32 address, uint8 value)
       break;
 
    case 0x5011:
-      mmc5.dac.output = (value ^ 0x80) << 8;
+      mmc5.dac.output = value * MMC5_DAC_STEP;
       break;
 
    case 0x5205:
@@ -318,16 +300,12 @@ static void mmc5_write(uint32 address, uint8 value)
    }
 }
 
-/* reset state of vrcvi sound channels */
+/* reset state of mmc5 sound channels */
 static void mmc5_reset(void)
 {
    int i;
-   apu_t apu;
-
 
-   /* get the phase period from the apu */
-   apu_getcontext(&apu);
-   mmc5.incsize = apu.cycle_rate;
+   memset(&mmc5, 0, sizeof(mmc5));
 
    for (i = 0x5000; i < 0x5008; i++)
       mmc5_write(i, 0);
@@ -336,34 +314,18 @@ static void mmc5_reset(void)
    mmc5_write(0x5011, 0);
 }
 
-static int mmc5_init(void)
-{
-   int i, num_samples;
-   apu_t apu;
-
-   apu_getcontext(&apu);
-   num_samples = apu.num_samples;
-
-   /* lut used for enveloping and frequency sweeps */
-   for (i = 0; i < 16; i++)
-      decay_lut[i] = num_samples * (i + 1);
-
-   /* used for note length, based on vblanks and size of audio buffer */
-   for (i = 0; i < 32; i++)
-      vbl_lut[i] = vbl_length[i] * num_samples;
-
-   return 0;
-}
-
 static apu_memread mmc5_memread[] =
 {
    { 0x5205, 0x5206, mmc5_read },
    {     -1,     -1, NULL }
 };
 
+/* sound registers go through the apu's write log, the multiplier
+** has to answer straight away
+*/
 static apu_memwrite mmc5_memwrite[] =
 {
-   { 0x5000, 0x5015, mmc5_write },
+   { 0x5000, 0x5015, apu_write },
    { 0x5114, 0x5115, mmc5_write },
    { 0x5205, 0x5206, mmc5_write },
    {     -1,     -1, NULL }
@@ -371,10 +333,12 @@ static apu_memwrite mmc5_memwrite[] =
 
 apuext_t mmc5_ext =
 {
-   mmc5_init,
+   NULL, /* no init */
    NULL, /* no shutdown */
    mmc5_reset,
-   mmc5_process,
+   mmc5_write,
+   mmc5_run,
+   mmc5_sequence,
    mmc5_memread,
    mmc5_memwrite
 };
@@ -46,8 +46,6 @@
 #define  NES_SCANLINE_CYCLES  (1364.0 / NES_CLOCK_DIVIDER)
 #define  NES_FIQ_PERIOD       (NES_MASTER_CLOCK / NES_CLOCK_DIVIDER / 60)
 
-#define  NES_RAMSIZE          0x800
-
 #define  NES_SKIP_LIMIT       (NES_REFRESH_RATE / 5)   /* 12 or 10, depending on PAL/NTSC */
 
 static nes_t nes;
@@ -97,6 +95,24 @@ static void ram_write(uint32 address, uint8 value)
    nes.cpu->mem_page[0][address & (NES_RAMSIZE - 1)] = value;
 }
 
+/* battery backed cart RAM, report changed bytes so they can be saved.
+** the page may be banked, so the offset comes from where it points
+*/
+static void sram_write(uint32 address, uint8 value)
+{
+   uint8 *p = nes.cpu->mem_page[address >> NES6502_BANKSHIFT] + (address & NES6502_BANKMASK);
+   int offset = p - nes.rominfo->sram;
+
+   if (offset < 0 || offset >= nes.rominfo->sram_banks * SRAM_BANK_LENGTH)
+      return;
+
+   if (*p != value)
+   {
+      *p = value;
+      battery_write(offset);
+   }
+}
+
 static void write_protect(uint32 address, uint8 value)
 {
    /* don't allow write to go through */
@@ -112,6 +128,17 @@ static uint8 read_protect(uint32 address)
    return 0xFF;
 }
 
+/* RAM mirrors and the PPU status register can be polled in idle loops */
+static int idle_func(uint32 address, int cycles)
+{
+   if (address < 0x2000)
+      return cycles;
+   if (address < 0x4000)
+      return ppu_idlecycles(address, cycles);
+
+   return 0;
+}
+
 #define  LAST_MEMORY_HANDLER  { -1, -1, NULL }
 /* read/write handlers for standard NES */
 static nes6502_memread default_readhandler[] =
@@ -230,6 +257,15 @@ static void build_address_handlers(nes_t *machine)
       }
    }
 
+   /* battery RAM, after the mapper in case it claims $6000-$7FFF */
+   if (machine->rominfo->flags & ROM_FLAG_BATTERY)
+   {
+      machine->writehandler[num_handlers].min_range = 0x6000;
+      machine->writehandler[num_handlers].max_range = 0x7FFF;
+      machine->writehandler[num_handlers].write_func = sram_write;
+      num_handlers++;
+   }
+
    /* catch-all for bad writes */
    /* TODO: poof! numbers */
    machine->writehandler[num_handlers].min_range = 0x4018;
@@ -445,11 +481,11 @@ void nes_destroy(nes_t **machine)
       if ((*machine)->cpu)
       {
          if ((*machine)->cpu->mem_page[0])
-            free((*machine)->cpu->mem_page[0]);
-         free((*machine)->cpu);
+            FREE32((*machine)->cpu->mem_page[0]);
+         FREE32((*machine)->cpu);
       }
 
-      free(*machine);
+      FREE32(*machine);
       *machine = NULL;
    }
 }
@@ -512,7 +548,7 @@ nes_t *nes_create(void)
    sndinfo_t osd_sound;
    int i;
 
-   machine = malloc(sizeof(nes_t));
+   machine = MALLOC32(sizeof(nes_t), "nes_t");
    if (NULL == machine)
       return NULL;
 
@@ -527,14 +563,14 @@ nes_t *nes_create(void)
    machine->autoframeskip = true;
 
    /* cpu */
-   machine->cpu = malloc(sizeof(nes6502_context));
+   machine->cpu = MALLOC32(sizeof(nes6502_context), "nes6502_context");
    if (NULL == machine->cpu)
       goto _fail;
 
    memset(machine->cpu, 0, sizeof(nes6502_context));
    
    /* allocate 2kB RAM */
-   machine->cpu->mem_page[0] = malloc(NES_RAMSIZE);
+   machine->cpu->mem_page[0] = MALLOC32(NES_RAMSIZE, "nes_ram");
    if (NULL == machine->cpu->mem_page[0])
       goto _fail;
 
@@ -544,6 +580,7 @@ nes_t *nes_create(void)
 
    machine->cpu->read_handler = machine->readhandler;
    machine->cpu->write_handler = machine->writehandler;
+   machine->cpu->idle_func = idle_func;
 
    /* apu */
    osd_getsoundinfo(&osd_sound);
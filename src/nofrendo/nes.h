@@ -50,6 +50,8 @@
 
 #define  MAX_MEM_HANDLERS     32
 
+#define  NES_RAMSIZE          0x800
+
 enum
 {
    SOFT_RESET,
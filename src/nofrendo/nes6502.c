@@ -283,6 +283,7 @@
          ADD_CYCLES(1); \
       ADD_CYCLES(3); \
       PC += (int8) btemp; \
+      IDLE_SKIP((int8) btemp); \
    } \
    else \
    { \
@@ -703,6 +704,7 @@
 
 #define JMP_ABSOLUTE() \
 { \
+   IDLE_JUMP(); \
    JUMP(PC); \
    ADD_CYCLES(3); \
 }
@@ -1311,6 +1313,140 @@ uint32 nes6502_getcycles(bool reset_flag)
    return cycles;
 }
 
+#ifdef NES6502_IDLESKIP
+
+static uint32 idle_cycles = 0;
+
+/* branch and cycle count of the last polling loop iteration seen */
+static uint32 idle_branch = 0;
+static int32 idle_at = 0;
+
+/* longest loop body looked at, in bytes */
+#define  IDLE_MAX_BODY  5
+
+/*
+** A loop of one read (LDA, LDX, LDY, BIT, CMP, CPX, CPY, AND or ORA
+** zp/abs), an optional AND/CMP/CPX/CPY #imm and a branch back does the
+** same thing every time round until the location read changes.  Returns
+** the cycles taken by one iteration of such a loop and the address it
+** polls, or 0.
+*/
+static int idle_loop(uint32 target, uint32 branch, uint32 *poll)
+{
+   uint32 pc = target;
+   int loop;
+
+   switch (bank_readbyte(pc))
+   {
+   case 0x05: case 0x24: case 0x25: case 0xA4: case 0xA5:
+   case 0xA6: case 0xC4: case 0xC5: case 0xE4:
+      *poll = bank_readbyte(pc + 1);
+      pc += 2;
+      loop = 3;
+      break;
+
+   case 0x0D: case 0x2C: case 0x2D: case 0xAC: case 0xAD:
+   case 0xAE: case 0xCC: case 0xCD: case 0xEC:
+      *poll = bank_readword(pc + 1);
+      pc += 3;
+      loop = 4;
+      break;
+
+   default:
+      return 0;
+   }
+
+   switch (bank_readbyte(pc))
+   {
+   case 0x29: case 0xC0: case 0xC9: case 0xE0:
+      pc += 2;
+      loop += 2;
+      break;
+   }
+
+   if (pc != branch)
+      return 0;
+
+   /* taken branch: 3 cycles, 4 if it crosses a page */
+   return loop + ((((branch + 2) ^ target) & 0xFF00) ? 4 : 3);
+}
+
+/*
+** Called on a taken branch back to target.  Interrupts are only taken
+** between timeslices, so RAM and ROM can't change before the end of
+** this one; anything else is up to the machine's idle_func.  The flags
+** the branch tests may predate an interrupt, so nothing is skipped until
+** a whole iteration has run back to back with the previous one.  Then as
+** many iterations are skipped as leave the last one to the interpreter.
+*/
+static void idle_skip(uint32 target, uint32 branch)
+{
+   uint32 poll;
+   int loop, budget, n;
+
+   loop = idle_loop(target, branch, &poll);
+   if (0 == loop)
+      return;
+
+   if (branch != idle_branch || cpu.total_cycles - idle_at != loop)
+   {
+      idle_branch = branch;
+      idle_at = cpu.total_cycles;
+      return;
+   }
+
+   budget = remaining_cycles;
+   if (poll >= 0x800 && poll < 0x8000)
+      budget = cpu.idle_func ? cpu.idle_func(poll, budget) : 0;
+
+   n = (budget - 1) / loop;
+   if (n <= 0)
+      return;
+
+   ADD_CYCLES(n * loop);
+   idle_cycles += n * loop;
+   idle_at = cpu.total_cycles;
+}
+
+#define  IDLE_SKIP(offset) \
+{ \
+   if ((offset) <= -4 && (offset) >= -IDLE_MAX_BODY - 2) \
+      idle_skip(PC & 0xFFFF, (PC - (offset) - 2) & 0xFFFF); \
+}
+
+/* JMP to itself just waits for an interrupt */
+#define  IDLE_JUMP() \
+{ \
+   if (bank_readword(PC) == PC - 1 && remaining_cycles > 3) \
+   { \
+      int skip = (remaining_cycles - 1) / 3 * 3; \
+      ADD_CYCLES(skip); \
+      idle_cycles += skip; \
+   } \
+}
+
+#else /* !NES6502_IDLESKIP */
+
+#define  IDLE_SKIP(offset)
+#define  IDLE_JUMP()
+
+#endif /* !NES6502_IDLESKIP */
+
+/* get number of cycles skipped in polling loops */
+uint32 nes6502_getidlecycles(bool reset_flag)
+{
+#ifdef NES6502_IDLESKIP
+   uint32 cycles = idle_cycles;
+
+   if (reset_flag)
+      idle_cycles = 0;
+
+   return cycles;
+#else /* !NES6502_IDLESKIP */
+   return 0;
+#endif /* !NES6502_IDLESKIP */
+}
+
 #define  GET_GLOBAL_REGS() \
 { \
    PC = cpu.pc_reg; \
@@ -34,6 +34,9 @@
 /* Define this to enable decimal mode in ADC / SBC (not needed in NES) */
 /*#define  NES6502_DECIMAL*/
 
+/* Define this to fast-forward through loops polling RAM or the PPU */
+#define  NES6502_IDLESKIP
+
 #define  NES6502_NUMBANKS  16
 #define  NES6502_BANKSHIFT 12
 #define  NES6502_BANKSIZE  (0x10000 / NES6502_NUMBANKS)
@@ -83,6 +86,9 @@ typedef struct
    nes6502_memread *read_handler;
    nes6502_memwrite *write_handler;
 
+   /* cycles of the next ones a read of address won't change in, or 0 */
+   int (*idle_func)(uint32 address, int cycles);
+
    uint32 pc_reg;
    uint8 a_reg, p_reg;
    uint8 x_reg, y_reg;
@@ -106,6 +112,7 @@ extern void nes6502_nmi(void);
 extern void nes6502_irq(void);
 extern uint8 nes6502_getbyte(uint32 address);
 extern uint32 nes6502_getcycles(bool reset_flag);
+extern uint32 nes6502_getidlecycles(bool reset_flag);
 extern void nes6502_burn(int cycles);
 extern void nes6502_release(void);
 
@@ -24,63 +24,82 @@
 */
 
 #include "string.h"
+#include "math.h"
 #include "noftypes.h"
 #include "log.h"
 #include "nes_apu.h"
 #include "nes6502.h"
+#include "osd.h"
  
 
-#define  APU_OVERSAMPLE
-#define  APU_VOLUME_DECAY(x)  ((x) -= ((x) >> 7))
-
 /* the following seem to be the correct (empirically determined)
-** relative volumes between the sound channels
+** relative volumes between the sound channels, per output step
+*/
+#define  APU_RECTANGLE_STEP   512
+#define  APU_TRIANGLE_STEP    640
+#define  APU_NOISE_STEP       384
+#define  APU_DMC_STEP         192
+
+/* the frame sequencer clocks envelopes and the linear counter at
+** 240Hz, and length counters and sweeps on every other step
+*/
+#define  APU_QUARTER_FRAME    7457
+
+/* register writes are logged with the cycle they landed on, and
+** played back between runs of the channels when the audio is pulled
 */
-#define  APU_RECTANGLE_OUTPUT(channel) (apu.rectangle[channel].output_vol)
-#define  APU_TRIANGLE_OUTPUT           (apu.triangle.output_vol + (apu.triangle.output_vol >> 2))
-#define  APU_NOISE_OUTPUT              ((apu.noise.output_vol + apu.noise.output_vol + apu.noise.output_vol) >> 2)
-#define  APU_DMC_OUTPUT                ((apu.dmc.output_vol + apu.dmc.output_vol + apu.dmc.output_vol) >> 2)
+#define  APU_QUEUE_SIZE       256
+
+/* level changes are mixed as band-limited steps: a windowed sinc
+** impulse is added to a buffer of deltas, which is summed into the
+** output. Sample positions have BLIP_FRAC fractional bits, the top
+** BLIP_PHASE_BITS of which pick the kernel.
+*/
+#define  BLIP_TAPS            8
+#define  BLIP_PHASE_BITS      5
+#define  BLIP_PHASES          (1 << BLIP_PHASE_BITS)
+#define  BLIP_BITS            12
+#define  BLIP_FRAC            20
+#define  BLIP_CUTOFF          0.9
+#define  APU_BLIP_SIZE        512
+
+#define  APU_PI               3.14159265358979323846
 
 /* active APU */
 static apu_t apu;
 
-/* look up table madness */
-static int32 decay_lut[16];
-static int vbl_lut[32];
-static int trilength_lut[128];
+static struct
+{
+   uint32 cycle;
+   uint16 address;
+   uint8 value;
+} apu_queue[APU_QUEUE_SIZE];
+static int apu_queued;
 
-/* noise lookups for both modes */
-#ifndef REALTIME_NOISE
-static int8 noise_long_lut[APU_NOISE_32K];
-static int8 noise_short_lut[APU_NOISE_93];
-#endif /* !REALTIME_NOISE */
+static int32 blip_buf[APU_BLIP_SIZE];
+static int blip_used;
+static int16 blip_kernel[BLIP_PHASES][BLIP_TAPS];
 
 
-/* vblank length table used for rectangles, triangle, noise */
+/* length counter loads, in half frames */
 static const uint8 vbl_length[32] =
 {
-    5, 127,
-   10,   1,
-   19,   2,
-   40,   3,
-   80,   4,
-   30,   5,
-    7,   6,
-   13,   7,
-    6,   8,
-   12,   9,
-   24,  10,
-   48,  11,
-   96,  12,
-   36,  13,
-    8,  14,
-   16,  15
-};
-
-/* frequency limit of rectangle channels */
-static const int freq_limit[8] =
-{
-   0x3FF, 0x555, 0x666, 0x71C, 0x787, 0x7C1, 0x7E0, 0x7F0
+   10, 254,
+   20,   2,
+   40,   4,
+   80,   6,
+  160,   8,
+   60,  10,
+   14,  12,
+   26,  14,
+   12,  16,
+   24,  18,
+   48,  20,
+   96,  22,
+  192,  24,
+   72,  26,
+   16,  28,
+   32,  30
 };
 
 /* noise frequency lookup table */
@@ -111,63 +130,50 @@ void apu_getcontext(apu_t *dest_apu)
    *dest_apu = apu;
 }
 
-void apu_setchan(int chan, bool enabled)
+/* add a step of delta to the output at the given cycle */
+INLINE void apu_blip(uint32 cycle, int32 delta)
 {
-   if (enabled)
-      apu.mix_enable |= (1 << chan);
-   else
-      apu.mix_enable &= ~(1 << chan);
+   uint32 pos = apu.blip_origin + (cycle - apu.frame_cycle) * apu.blip_factor;
+   uint32 index = pos >> BLIP_FRAC;
+   const int16 *kernel = blip_kernel[(pos >> (BLIP_FRAC - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+   int32 *out;
+
+   /* audio hasn't been pulled for a while */
+   if (index > APU_BLIP_SIZE - BLIP_TAPS)
+      return;
+
+   out = blip_buf + index;
+   out[0] += delta * kernel[0];
+   out[1] += delta * kernel[1];
+   out[2] += delta * kernel[2];
+   out[3] += delta * kernel[3];
+   out[4] += delta * kernel[4];
+   out[5] += delta * kernel[5];
+   out[6] += delta * kernel[6];
+   out[7] += delta * kernel[7];
+
+   if ((int) index + BLIP_TAPS > blip_used)
+      blip_used = index + BLIP_TAPS;
 }
 
-/* emulation of the 15-bit shift register the
-** NES uses to generate pseudo-random series
-** for the white noise channel
-*/
-#ifdef REALTIME_NOISE
-INLINE int8 shift_register15(uint8 xor_tap)
+/* move a channel's output to level, if it is being mixed */
+INLINE void apu_mix(int chan, int32 *output_vol, int32 level, uint32 cycle)
 {
-   static int sreg = 0x4000;
-   int bit0, tap, bit14;
-
-   bit0 = sreg & 1;
-   tap = (sreg & xor_tap) ? 1 : 0;
-   bit14 = (bit0 ^ tap);
-   sreg >>= 1;
-   sreg |= (bit14 << 14);
-   return (bit0 ^ 1);
-}
-#else /* !REALTIME_NOISE */
-static void shift_register15(int8 *buf, int count)
-{
-   static int sreg = 0x4000;
-   int bit0, bit1, bit6, bit14;
+   if (0 == (apu.mix_enable & (1 << chan)))
+      level = 0;
 
-   if (count == APU_NOISE_93)
+   if (level != *output_vol)
    {
-      while (count--)
-      {
-         bit0 = sreg & 1;
-         bit6 = (sreg & 0x40) >> 6;
-         bit14 = (bit0 ^ bit6);
-         sreg >>= 1;
-         sreg |= (bit14 << 14);
-         *buf++ = bit0 ^ 1;
-      }
-   }
-   else /* 32K noise */
-   {
-      while (count--)
-      {
-         bit0 = sreg & 1;
-         bit1 = (sreg & 2) >> 1;
-         bit14 = (bit0 ^ bit1);
-         sreg >>= 1;
-         sreg |= (bit14 << 14);
-         *buf++ = bit0 ^ 1;
-      }
+      apu_blip(cycle, level - *output_vol);
+      *output_vol = level;
    }
 }
-#endif /* !REALTIME_NOISE */
+
+/* expansion chip channels share the sixth mix enable */
+void apu_mixext(int32 *output_vol, int32 level, uint32 cycle)
+{
+   apu_mix(5, output_vol, level, cycle);
+}
 
 /* RECTANGLE WAVE
 ** ==============
@@ -176,216 +182,124 @@ static void shift_register15(int8 *buf, int count)
 ** reg2: 8 bits of freq
 ** reg3: 0-2=high freq, 7-4=vbl length counter
 */
-#ifdef APU_OVERSAMPLE
+static int32 apu_rectangle_target(int ch)
+{
+   int32 change = apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts;
 
-#define  APU_MAKE_RECTANGLE(ch) \
-static int32 apu_rectangle_##ch(void) \
-{ \
-   int32 output, total; \
-   int num_times; \
-\
-   APU_VOLUME_DECAY(apu.rectangle[ch].output_vol); \
-\
-   if (false == apu.rectangle[ch].enabled || 0 == apu.rectangle[ch].vbl_length) \
-      return APU_RECTANGLE_OUTPUT(ch); \
-\
-   /* vbl length counter */ \
-   if (false == apu.rectangle[ch].holdnote) \
-      apu.rectangle[ch].vbl_length--; \
-\
-   /* envelope decay at a rate of (env_delay + 1) / 240 secs */ \
-   apu.rectangle[ch].env_phase -= 4; /* 240/60 */ \
-   while (apu.rectangle[ch].env_phase < 0) \
-   { \
-      apu.rectangle[ch].env_phase += apu.rectangle[ch].env_delay; \
-\
-      if (apu.rectangle[ch].holdnote) \
-         apu.rectangle[ch].env_vol = (apu.rectangle[ch].env_vol + 1) & 0x0F; \
-      else if (apu.rectangle[ch].env_vol < 0x0F) \
-         apu.rectangle[ch].env_vol++; \
-   } \
-\
-   /* TODO: find true relation of freq_limit to register values */ \
-   if (apu.rectangle[ch].freq < 8 \
-       || (false == apu.rectangle[ch].sweep_inc \
-           && apu.rectangle[ch].freq > apu.rectangle[ch].freq_limit)) \
-      return APU_RECTANGLE_OUTPUT(ch); \
-\
-   /* frequency sweeping at a rate of (sweep_delay + 1) / 120 secs */ \
-   if (apu.rectangle[ch].sweep_on && apu.rectangle[ch].sweep_shifts) \
-   { \
-      apu.rectangle[ch].sweep_phase -= 2; /* 120/60 */ \
-      while (apu.rectangle[ch].sweep_phase < 0) \
-      { \
-         apu.rectangle[ch].sweep_phase += apu.rectangle[ch].sweep_delay; \
-\
-         if (apu.rectangle[ch].sweep_inc) /* ramp up */ \
-         { \
-            if (0 == ch) \
-               apu.rectangle[ch].freq += ~(apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts); \
-            else \
-               apu.rectangle[ch].freq -= (apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts); \
-         } \
-         else /* ramp down */ \
-         { \
-            apu.rectangle[ch].freq += (apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts); \
-         } \
-      } \
-   } \
-\
-   apu.rectangle[ch].accum -= apu.cycle_rate; \
-   if (apu.rectangle[ch].accum >= 0) \
-      return APU_RECTANGLE_OUTPUT(ch); \
-\
-   if (apu.rectangle[ch].fixed_envelope) \
-      output = apu.rectangle[ch].volume << 8; /* fixed volume */ \
-   else \
-      output = (apu.rectangle[ch].env_vol ^ 0x0F) << 8; \
-\
-   num_times = total = 0; \
-\
-   while (apu.rectangle[ch].accum < 0) \
-   { \
-      apu.rectangle[ch].accum += apu.rectangle[ch].freq + 1; \
-      apu.rectangle[ch].adder = (apu.rectangle[ch].adder + 1) & 0x0F; \
-\
-      if (apu.rectangle[ch].adder < apu.rectangle[ch].duty_flip) \
-         total += output; \
-      else \
-         total -= output; \
-\
-      num_times++; \
-   } \
-\
-   apu.rectangle[ch].output_vol = total / num_times; \
-   return APU_RECTANGLE_OUTPUT(ch); \
-} 
-
-#else /* !APU_OVERSAMPLE */
-#define  APU_MAKE_RECTANGLE(ch) \
-static int32 apu_rectangle_##ch(void) \
-{ \
-   int32 output; \
-\
-   APU_VOLUME_DECAY(apu.rectangle[ch].output_vol); \
-\
-   if (false == apu.rectangle[ch].enabled || 0 == apu.rectangle[ch].vbl_length) \
-      return APU_RECTANGLE_OUTPUT(ch); \
-\
-   /* vbl length counter */ \
-   if (false == apu.rectangle[ch].holdnote) \
-      apu.rectangle[ch].vbl_length--; \
-\
-   /* envelope decay at a rate of (env_delay + 1) / 240 secs */ \
-   apu.rectangle[ch].env_phase -= 4; /* 240/60 */ \
-   while (apu.rectangle[ch].env_phase < 0) \
-   { \
-      apu.rectangle[ch].env_phase += apu.rectangle[ch].env_delay; \
-\
-      if (apu.rectangle[ch].holdnote) \
-         apu.rectangle[ch].env_vol = (apu.rectangle[ch].env_vol + 1) & 0x0F; \
-      else if (apu.rectangle[ch].env_vol < 0x0F) \
-         apu.rectangle[ch].env_vol++; \
-   } \
-\
-   /* TODO: find true relation of freq_limit to register values */ \
-   if (apu.rectangle[ch].freq < 8 || (false == apu.rectangle[ch].sweep_inc && apu.rectangle[ch].freq > apu.rectangle[ch].freq_limit)) \
-      return APU_RECTANGLE_OUTPUT(ch); \
-\
-   /* frequency sweeping at a rate of (sweep_delay + 1) / 120 secs */ \
-   if (apu.rectangle[ch].sweep_on && apu.rectangle[ch].sweep_shifts) \
-   { \
-      apu.rectangle[ch].sweep_phase -= 2; /* 120/60 */ \
-      while (apu.rectangle[ch].sweep_phase < 0) \
-      { \
-         apu.rectangle[ch].sweep_phase += apu.rectangle[ch].sweep_delay; \
-\
-         if (apu.rectangle[ch].sweep_inc) /* ramp up */ \
-         { \
-            if (0 == ch) \
-               apu.rectangle[ch].freq += ~(apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts); \
-            else \
-               apu.rectangle[ch].freq -= (apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts); \
-         } \
-         else /* ramp down */ \
-         { \
-            apu.rectangle[ch].freq += (apu.rectangle[ch].freq >> apu.rectangle[ch].sweep_shifts); \
-         } \
-      } \
-   } \
-\
-   apu.rectangle[ch].accum -= apu.cycle_rate; \
-   if (apu.rectangle[ch].accum >= 0) \
-      return APU_RECTANGLE_OUTPUT(ch); \
-\
-   while (apu.rectangle[ch].accum < 0) \
-   { \
-      apu.rectangle[ch].accum += (apu.rectangle[ch].freq + 1); \
-      apu.rectangle[ch].adder = (apu.rectangle[ch].adder + 1) & 0x0F; \
-   } \
-\
-   if (apu.rectangle[ch].fixed_envelope) \
-      output = apu.rectangle[ch].volume << 8; /* fixed volume */ \
-   else \
-      output = (apu.rectangle[ch].env_vol ^ 0x0F) << 8; \
-\
-   if (0 == apu.rectangle[ch].adder) \
-      apu.rectangle[ch].output_vol = output; \
-   else if (apu.rectangle[ch].adder == apu.rectangle[ch].duty_flip) \
-      apu.rectangle[ch].output_vol = -output; \
-\
-   return APU_RECTANGLE_OUTPUT(ch); \
+   /* the first channel ramps up by one's complement */
+   if (apu.rectangle[ch].sweep_inc)
+      return apu.rectangle[ch].freq - change - (0 == ch);
+   else
+      return apu.rectangle[ch].freq + change;
 }
 
-#endif /* !APU_OVERSAMPLE */
+/* the sweep unit silences the channel whether it is on or not */
+static int32 apu_rectangle_volume(int ch)
+{
+   if (0 == apu.rectangle[ch].vbl_length || apu.rectangle[ch].freq < 8
+       || apu_rectangle_target(ch) > 0x7FF)
+      return 0;
 
-/* generate the functions */
-APU_MAKE_RECTANGLE(0)
-APU_MAKE_RECTANGLE(1)
+   if (apu.rectangle[ch].fixed_envelope)
+      return apu.rectangle[ch].volume * APU_RECTANGLE_STEP;
+   else
+      return apu.rectangle[ch].env_vol * APU_RECTANGLE_STEP;
+}
 
+static void apu_rectangle(int ch, uint32 cycle, int32 cycles)
+{
+   rectangle_t *chan = &apu.rectangle[ch];
+   int32 period = chan->freq + 1;
+   int32 vol = apu_rectangle_volume(ch);
+   int32 edge;
+   int steps;
+
+   /* step straight from one edge of the duty cycle to the next */
+   while (vol)
+   {
+      if (chan->adder < chan->duty_flip)
+         steps = chan->duty_flip - chan->adder;
+      else
+         steps = 16 - chan->adder;
 
-/* TRIANGLE WAVE
-** =============
-** reg0: 7=holdnote, 6-0=linear length counter
-** reg2: low 8 bits of frequency
-** reg3: 7-3=length counter, 2-0=high 3 bits of frequency
-*/
-static int32 apu_triangle(void)
+      edge = chan->timer + (steps - 1) * period;
+      if (edge > cycles)
+         break;
+
+      chan->adder = (chan->adder + steps) & 0x0F;
+      chan->timer = edge + period;
+      apu_mix(ch, &chan->output_vol, (chan->adder < chan->duty_flip) ? vol : 0, cycle + edge);
+   }
+
+   /* and keep the sequencer in phase over the rest */
+   chan->timer -= cycles;
+   if (chan->timer <= 0)
+   {
+      steps = (-chan->timer) / period + 1;
+      chan->timer += steps * period;
+      chan->adder = (chan->adder + steps) & 0x0F;
+   }
+}
+
+static void apu_rectangle_level(int ch)
+{
+   rectangle_t *chan = &apu.rectangle[ch];
+
+   apu_mix(ch, &chan->output_vol,
+           (chan->adder < chan->duty_flip) ? apu_rectangle_volume(ch) : 0, apu.cycle);
+}
+
+static void apu_sweep(int ch)
 {
-   APU_VOLUME_DECAY(apu.triangle.output_vol);
+   rectangle_t *chan = &apu.rectangle[ch];
 
-   if (false == apu.triangle.enabled || 0 == apu.triangle.vbl_length)
-      return APU_TRIANGLE_OUTPUT;
+   if (0 == chan->sweep_delay && chan->sweep_on && chan->sweep_shifts
+       && chan->freq >= 8 && apu_rectangle_target(ch) <= 0x7FF)
+      chan->freq = apu_rectangle_target(ch);
 
-   if (apu.triangle.counter_started)
+   if (0 == chan->sweep_delay || chan->sweep_reload)
    {
-      if (apu.triangle.linear_length > 0)
-         apu.triangle.linear_length--;
-      if (apu.triangle.vbl_length && false == apu.triangle.holdnote)
-         apu.triangle.vbl_length--;
+      chan->sweep_delay = chan->sweep_length;
+      chan->sweep_reload = false;
    }
-   else if (false == apu.triangle.holdnote && apu.triangle.write_latency)
+   else
    {
-      if (--apu.triangle.write_latency == 0)
-         apu.triangle.counter_started = true;
+      chan->sweep_delay--;
    }
+}
 
-   if (0 == apu.triangle.linear_length || apu.triangle.freq < 4) /* inaudible */
-      return APU_TRIANGLE_OUTPUT;
 
-   apu.triangle.accum -= apu.cycle_rate; \
-   while (apu.triangle.accum < 0)
+/* TRIANGLE WAVE
+** =============
+** reg0: 7=holdnote, 6-0=linear length counter
+** reg2: low 8 bits of frequency
+** reg3: 7-3=length counter, 2-0=high 3 bits of frequency
+*/
+INLINE int32 apu_triangle_step(void)
+{
+   if (apu.triangle.adder & 0x10)
+      return (apu.triangle.adder & 0x0F) * APU_TRIANGLE_STEP;
+   else
+      return (15 - apu.triangle.adder) * APU_TRIANGLE_STEP;
+}
+
+static void apu_triangle(uint32 cycle, int32 cycles)
+{
+   /* the sequencer holds its level while either counter is empty,
+   ** and ultrasonic periods are held rather than mixed down to hiss
+   */
+   if (0 == apu.triangle.vbl_length || 0 == apu.triangle.linear_length
+       || apu.triangle.freq < 3)
+      return;
+
+   while (apu.triangle.timer <= cycles)
    {
-      apu.triangle.accum += apu.triangle.freq;
       apu.triangle.adder = (apu.triangle.adder + 1) & 0x1F;
-
-      if (apu.triangle.adder & 0x10)
-         apu.triangle.output_vol -= (2 << 8);
-      else
-         apu.triangle.output_vol += (2 << 8);
+      apu_mix(2, &apu.triangle.output_vol, apu_triangle_step(), cycle + apu.triangle.timer);
+      apu.triangle.timer += apu.triangle.freq;
    }
 
-   return APU_TRIANGLE_OUTPUT;
+   apu.triangle.timer -= cycles;
 }
 
 
@@ -395,123 +309,41 @@ static int32 apu_triangle(void)
 ** reg2: 7=small(93 byte) sample,3-0=freq lookup
 ** reg3: 7-4=vbl length counter
 */
-/* TODO: AAAAAAAAAAAAAAAAAAAAAAAA!  #ifdef MADNESS! */
-static int32 apu_noise(void)
+static int32 apu_noise_volume(void)
 {
-   int32 outvol;
-
-#if defined(APU_OVERSAMPLE) && defined(REALTIME_NOISE)
-#else /* !(APU_OVERSAMPLE && REALTIME_NOISE) */
-   int32 noise_bit;
-#endif /* !(APU_OVERSAMPLE && REALTIME_NOISE) */
-#ifdef APU_OVERSAMPLE
-   int num_times;
-   int32 total;
-#endif /* APU_OVERSAMPLE */
-
-   APU_VOLUME_DECAY(apu.noise.output_vol);
-
-   if (false == apu.noise.enabled || 0 == apu.noise.vbl_length)
-      return APU_NOISE_OUTPUT;
-
-   /* vbl length counter */
-   if (false == apu.noise.holdnote)
-      apu.noise.vbl_length--;
-
-   /* envelope decay at a rate of (env_delay + 1) / 240 secs */
-   apu.noise.env_phase -= 4; /* 240/60 */
-   while (apu.noise.env_phase < 0)
-   {
-      apu.noise.env_phase += apu.noise.env_delay;
-
-      if (apu.noise.holdnote)
-         apu.noise.env_vol = (apu.noise.env_vol + 1) & 0x0F;
-      else if (apu.noise.env_vol < 0x0F)
-         apu.noise.env_vol++;
-   }
+   if (0 == apu.noise.vbl_length)
+      return 0;
 
-   apu.noise.accum -= apu.cycle_rate;
-   if (apu.noise.accum >= 0)
-      return APU_NOISE_OUTPUT;
-   
-#ifdef APU_OVERSAMPLE
    if (apu.noise.fixed_envelope)
-      outvol = apu.noise.volume << 8; /* fixed volume */
+      return apu.noise.volume * APU_NOISE_STEP;
    else
-      outvol = (apu.noise.env_vol ^ 0x0F) << 8;
+      return apu.noise.env_vol * APU_NOISE_STEP;
+}
 
-   num_times = total = 0;
-#endif /* APU_OVERSAMPLE */
+/* emulation of the 15-bit shift register the
+** NES uses to generate pseudo-random series
+** for the white noise channel
+*/
+static void apu_noise(uint32 cycle, int32 cycles)
+{
+   int32 vol = apu_noise_volume();
+   int tap;
 
-   while (apu.noise.accum < 0)
+   if (vol)
    {
-      apu.noise.accum += apu.noise.freq;
-
-#ifdef REALTIME_NOISE
-
-#ifdef APU_OVERSAMPLE
-      if (shift_register15(apu.noise.xor_tap))
-         total += outvol;
-      else
-         total -= outvol;
-
-      num_times++;
-#else /* !APU_OVERSAMPLE */
-      noise_bit = shift_register15(apu.noise.xor_tap);
-#endif /* !APU_OVERSAMPLE */
-
-#else /* !REALTIME_NOISE */
-      apu.noise.cur_pos++;
-
-      if (apu.noise.short_sample)
-      {
-         if (APU_NOISE_93 == apu.noise.cur_pos)
-            apu.noise.cur_pos = 0;
-      }
-      else
+      while (apu.noise.timer <= cycles)
       {
-         if (APU_NOISE_32K == apu.noise.cur_pos)
-            apu.noise.cur_pos = 0;
+         tap = (apu.noise.sreg & apu.noise.xor_tap) ? 1 : 0;
+         apu.noise.sreg = (apu.noise.sreg >> 1) | (((apu.noise.sreg ^ tap) & 1) << 14);
+         apu_mix(3, &apu.noise.output_vol, (apu.noise.sreg & 1) ? 0 : vol,
+                 cycle + apu.noise.timer);
+         apu.noise.timer += apu.noise.freq;
       }
-
-#ifdef APU_OVERSAMPLE
-      if (apu.noise.short_sample)
-         noise_bit = noise_short_lut[apu.noise.cur_pos];
-      else
-         noise_bit = noise_long_lut[apu.noise.cur_pos];
-
-      if (noise_bit)
-         total += outvol;
-      else
-         total -= outvol;
-
-      num_times++;
-#endif /* APU_OVERSAMPLE */
-#endif /* !REALTIME_NOISE */
    }
 
-#ifdef APU_OVERSAMPLE
-   apu.noise.output_vol = total / num_times;
-#else /* !APU_OVERSAMPLE */
-   if (apu.noise.fixed_envelope)
-      outvol = apu.noise.volume << 8; /* fixed volume */
-   else
-      outvol = (apu.noise.env_vol ^ 0x0F) << 8;
-
-#ifndef REALTIME_NOISE
-   if (apu.noise.short_sample)
-      noise_bit = noise_short_lut[apu.noise.cur_pos];
-   else
-      noise_bit = noise_long_lut[apu.noise.cur_pos];
-#endif /* !REALTIME_NOISE */
-
-   if (noise_bit)
-      apu.noise.output_vol = outvol;
-   else
-      apu.noise.output_vol = -outvol;
-#endif /* !APU_OVERSAMPLE */
-
-   return APU_NOISE_OUTPUT;
+   apu.noise.timer -= cycles;
+   if (apu.noise.timer <= 0)
+      apu.noise.timer += ((-apu.noise.timer) / apu.noise.freq + 1) * apu.noise.freq;
 }
 
 
@@ -525,90 +357,197 @@ INLINE void apu_dmcreload(void)
 /* DELTA MODULATION CHANNEL
 ** =========================
 ** reg0: 7=irq gen, 6=looping, 3-0=pointer to clock table
-** reg1: output dc level, 6 bits unsigned
+** reg1: output dc level, 7 bits unsigned
 ** reg2: 8 bits of 64-byte aligned address offset : $C000 + (value * 64)
 ** reg3: length, (value * 16) + 1
 */
-static int32 apu_dmc(void)
+static void apu_dmc(uint32 cycle, int32 cycles)
 {
    int delta_bit;
 
-   APU_VOLUME_DECAY(apu.dmc.output_vol);
-
    /* only process when channel is alive */
-   if (apu.dmc.dma_length)
+   while (apu.dmc.dma_length && apu.dmc.timer <= cycles)
    {
-      apu.dmc.accum -= apu.cycle_rate;
-      
-      while (apu.dmc.accum < 0)
+      delta_bit = (apu.dmc.dma_length & 7) ^ 7;
+
+      if (7 == delta_bit)
       {
-         apu.dmc.accum += apu.dmc.freq;
-         
-         delta_bit = (apu.dmc.dma_length & 7) ^ 7;
+         apu.dmc.cur_byte = nes6502_getbyte(apu.dmc.address);
          
-         if (7 == delta_bit)
-         {
-            apu.dmc.cur_byte = nes6502_getbyte(apu.dmc.address);
-            
-            /* steal a cycle from CPU*/
-            nes6502_burn(1);
-
-            /* prevent wraparound */
-            if (0xFFFF == apu.dmc.address)
-               apu.dmc.address = 0x8000;
-            else
-               apu.dmc.address++;
-         }
+         /* steal a cycle from CPU*/
+         nes6502_burn(1);
 
-         if (--apu.dmc.dma_length == 0)
-         {
-            /* if loop bit set, we're cool to retrigger sample */
-            if (apu.dmc.looping)
-            {
-               apu_dmcreload();
-            }
-            else
-            {
-               /* check to see if we should generate an irq */
-               if (apu.dmc.irq_gen)
-               {
-                  apu.dmc.irq_occurred = true;
-                  if (apu.irq_callback)
-                     apu.irq_callback();
-               }
-
-               /* bodge for timestamp queue */
-               apu.dmc.enabled = false;
-               break;
-            }
-         }
+         /* prevent wraparound */
+         if (0xFFFF == apu.dmc.address)
+            apu.dmc.address = 0x8000;
+         else
+            apu.dmc.address++;
+      }
 
-         /* positive delta */
-         if (apu.dmc.cur_byte & (1 << delta_bit))
+      /* positive delta */
+      if (apu.dmc.cur_byte & (1 << delta_bit))
+      {
+         if (apu.dmc.level <= 125)
+            apu.dmc.level += 2;
+      }
+      /* negative delta */
+      else
+      {
+         if (apu.dmc.level >= 2)
+            apu.dmc.level -= 2;
+      }
+
+      apu_mix(4, &apu.dmc.output_vol, apu.dmc.level * APU_DMC_STEP, cycle + apu.dmc.timer);
+      apu.dmc.timer += apu.dmc.freq;
+
+      if (--apu.dmc.dma_length == 0)
+      {
+         /* if loop bit set, we're cool to retrigger sample */
+         if (apu.dmc.looping)
          {
-            if (apu.dmc.regs[1] < 0x7D)
-            {
-               apu.dmc.regs[1] += 2;
-               apu.dmc.output_vol += (2 << 8);
-            }
+            apu_dmcreload();
          }
-         /* negative delta */
-         else            
+         /* check to see if we should generate an irq */
+         else if (apu.dmc.irq_gen)
          {
-            if (apu.dmc.regs[1] > 1)
-            {
-               apu.dmc.regs[1] -= 2;
-               apu.dmc.output_vol -= (2 << 8);
-            }
+            apu.dmc.irq_occurred = true;
+            if (apu.irq_callback)
+               apu.irq_callback();
          }
       }
    }
 
-   return APU_DMC_OUTPUT;
+   apu.dmc.timer -= cycles;
+   if (apu.dmc.timer <= 0)
+      apu.dmc.timer += ((-apu.dmc.timer) / apu.dmc.freq + 1) * apu.dmc.freq;
 }
 
 
-void apu_write(uint32 address, uint8 value)
+/* bring every channel's output in line with its registers */
+static void apu_levels(void)
+{
+   apu_rectangle_level(0);
+   apu_rectangle_level(1);
+   apu_mix(2, &apu.triangle.output_vol, apu_triangle_step(), apu.cycle);
+   apu_mix(3, &apu.noise.output_vol, (apu.noise.sreg & 1) ? 0 : apu_noise_volume(), apu.cycle);
+   apu_mix(4, &apu.dmc.output_vol, apu.dmc.level * APU_DMC_STEP, apu.cycle);
+
+   if (apu.ext && apu.ext->run)
+      apu.ext->run(apu.cycle, 0);
+}
+
+void apu_setchan(int chan, bool enabled)
+{
+   if (enabled)
+      apu.mix_enable |= (1 << chan);
+   else
+      apu.mix_enable &= ~(1 << chan);
+
+   apu_levels();
+}
+
+static void apu_envelope(bool *start, int32 *delay, uint8 *env_vol, uint8 volume, bool holdnote)
+{
+   if (*start)
+   {
+      *start = false;
+      *delay = volume;
+      *env_vol = 0x0F;
+   }
+   else if (*delay)
+   {
+      (*delay)--;
+   }
+   else
+   {
+      *delay = volume;
+
+      if (*env_vol)
+         (*env_vol)--;
+      else if (holdnote)
+         *env_vol = 0x0F;
+   }
+}
+
+/* one step of the frame sequencer */
+static void apu_sequence(void)
+{
+   int chan;
+
+   for (chan = 0; chan < 2; chan++)
+      apu_envelope(&apu.rectangle[chan].env_start, &apu.rectangle[chan].env_delay,
+                   &apu.rectangle[chan].env_vol, apu.rectangle[chan].volume,
+                   apu.rectangle[chan].holdnote);
+
+   apu_envelope(&apu.noise.env_start, &apu.noise.env_delay, &apu.noise.env_vol,
+                apu.noise.volume, apu.noise.holdnote);
+
+   if (apu.triangle.counter_reload)
+      apu.triangle.linear_length = apu.triangle.regs[0] & 0x7F;
+   else if (apu.triangle.linear_length)
+      apu.triangle.linear_length--;
+
+   if (false == apu.triangle.holdnote)
+      apu.triangle.counter_reload = false;
+
+   /* half frame */
+   if (apu.seq_step & 1)
+   {
+      for (chan = 0; chan < 2; chan++)
+      {
+         if (apu.rectangle[chan].vbl_length && false == apu.rectangle[chan].holdnote)
+            apu.rectangle[chan].vbl_length--;
+
+         apu_sweep(chan);
+      }
+
+      if (apu.triangle.vbl_length && false == apu.triangle.holdnote)
+         apu.triangle.vbl_length--;
+
+      if (apu.noise.vbl_length && false == apu.noise.holdnote)
+         apu.noise.vbl_length--;
+   }
+
+   if (apu.ext && apu.ext->sequence)
+      apu.ext->sequence((apu.seq_step & 1) ? true : false);
+
+   apu.seq_step = (apu.seq_step + 1) & 3;
+}
+
+/* run the channels in spans between frame sequencer clocks */
+static void apu_run(uint32 cycle)
+{
+   int32 cycles, seq;
+
+   while ((cycles = (int32) (cycle - apu.cycle)) > 0)
+   {
+      seq = (int32) (apu.seq_cycle - apu.cycle);
+      if (seq < cycles)
+         cycles = seq;
+
+      if (cycles > 0)
+      {
+         apu_rectangle(0, apu.cycle, cycles);
+         apu_rectangle(1, apu.cycle, cycles);
+         apu_triangle(apu.cycle, cycles);
+         apu_noise(apu.cycle, cycles);
+         apu_dmc(apu.cycle, cycles);
+         if (apu.ext && apu.ext->run)
+            apu.ext->run(apu.cycle, cycles);
+         apu.cycle += cycles;
+      }
+
+      if ((int32) (apu.seq_cycle - apu.cycle) <= 0)
+      {
+         apu_sequence();
+         apu.seq_cycle += APU_QUARTER_FRAME;
+         apu_levels();
+      }
+   }
+}
+
+
+static void apu_regwrite(uint32 address, uint8 value)
 {  
    int chan;
 
@@ -620,7 +559,6 @@ void apu_write(uint32 address, uint8 value)
       chan = (address & 4) >> 2;
       apu.rectangle[chan].regs[0] = value;
       apu.rectangle[chan].volume = value & 0x0F;
-      apu.rectangle[chan].env_delay = decay_lut[value & 0x0F];
       apu.rectangle[chan].holdnote = (value & 0x20) ? true : false;
       apu.rectangle[chan].fixed_envelope = (value & 0x10) ? true : false;
       apu.rectangle[chan].duty_flip = duty_flip[value >> 6];
@@ -632,9 +570,9 @@ void apu_write(uint32 address, uint8 value)
       apu.rectangle[chan].regs[1] = value;
       apu.rectangle[chan].sweep_on = (value & 0x80) ? true : false;
       apu.rectangle[chan].sweep_shifts = value & 7;
-      apu.rectangle[chan].sweep_delay = decay_lut[(value >> 4) & 7];
+      apu.rectangle[chan].sweep_length = (value >> 4) & 7;
       apu.rectangle[chan].sweep_inc = (value & 0x08) ? true : false;
-      apu.rectangle[chan].freq_limit = freq_limit[value & 7];
+      apu.rectangle[chan].sweep_reload = true;
       break;
 
    case APU_WRA2:
@@ -648,8 +586,9 @@ void apu_write(uint32 address, uint8 value)
    case APU_WRB3:
       chan = (address & 4) >> 2;
       apu.rectangle[chan].regs[3] = value;
-      apu.rectangle[chan].vbl_length = vbl_lut[value >> 3];
-      apu.rectangle[chan].env_vol = 0;
+      if (apu.rectangle[chan].enabled)
+         apu.rectangle[chan].vbl_length = vbl_length[value >> 3];
+      apu.rectangle[chan].env_start = true;
       apu.rectangle[chan].freq = ((value & 7) << 8) | (apu.rectangle[chan].freq & 0xFF);
       apu.rectangle[chan].adder = 0;
       break;
@@ -658,10 +597,6 @@ void apu_write(uint32 address, uint8 value)
    case APU_WRC0:
       apu.triangle.regs[0] = value;
       apu.triangle.holdnote = (value & 0x80) ? true : false;
-
-      if (false == apu.triangle.counter_started && apu.triangle.vbl_length)
-         apu.triangle.linear_length = trilength_lut[value & 0x7F];
-
       break;
 
    case APU_WRC2:
@@ -670,31 +605,16 @@ void apu_write(uint32 address, uint8 value)
       break;
 
    case APU_WRC3:
-
       apu.triangle.regs[2] = value;
-  
-      /* this is somewhat of a hack.  there appears to be some latency on 
-      ** the Real Thing between when trireg0 is written to and when the 
-      ** linear length counter actually begins its countdown.  we want to 
-      ** prevent the case where the program writes to the freq regs first, 
-      ** then to reg 0, and the counter accidentally starts running because 
-      ** of the sound queue's timestamp processing.
-      **
-      ** set latency to a couple hundred cycles -- should be plenty of time 
-      ** for the 6502 code to do a couple of table dereferences and load up 
-      ** the other triregs
-      */
-      apu.triangle.write_latency = (int) (228 / apu.cycle_rate);
       apu.triangle.freq = (((value & 7) << 8) + apu.triangle.regs[1]) + 1;
-      apu.triangle.vbl_length = vbl_lut[value >> 3];
-      apu.triangle.counter_started = false;
-      apu.triangle.linear_length = trilength_lut[apu.triangle.regs[0] & 0x7F];
+      if (apu.triangle.enabled)
+         apu.triangle.vbl_length = vbl_length[value >> 3];
+      apu.triangle.counter_reload = true;
       break;
 
    /* noise */
    case APU_WRD0:
       apu.noise.regs[0] = value;
-      apu.noise.env_delay = decay_lut[value & 0x0F];
       apu.noise.holdnote = (value & 0x20) ? true : false;
       apu.noise.fixed_envelope = (value & 0x10) ? true : false;
       apu.noise.volume = value & 0x0F;
@@ -703,25 +623,14 @@ void apu_write(uint32 address, uint8 value)
    case APU_WRD2:
       apu.noise.regs[1] = value;
       apu.noise.freq = noise_freq[value & 0x0F];
-
-#ifdef REALTIME_NOISE
       apu.noise.xor_tap = (value & 0x80) ? 0x40: 0x02;
-#else /* !REALTIME_NOISE */
-      /* detect transition from long->short sample */
-      if ((value & 0x80) && false == apu.noise.short_sample)
-      {
-         /* recalculate short noise buffer */
-         shift_register15(noise_short_lut, APU_NOISE_93);
-         apu.noise.cur_pos = 0;
-      }
-      apu.noise.short_sample = (value & 0x80) ? true : false;
-#endif /* !REALTIME_NOISE */
       break;
 
    case APU_WRD3:
       apu.noise.regs[2] = value;
-      apu.noise.vbl_length = vbl_lut[value >> 3];
-      apu.noise.env_vol = 0; /* reset envelope */
+      if (apu.noise.enabled)
+         apu.noise.vbl_length = vbl_length[value >> 3];
+      apu.noise.env_start = true;
       break;
 
    /* DMC */
@@ -742,12 +651,8 @@ void apu_write(uint32 address, uint8 value)
       break;
 
    case APU_WRE1: /* 7-bit DAC */
-      /* add the _delta_ between written value and
-      ** current output level of the volume reg
-      */
-      value &= 0x7F; /* bit 7 ignored */
-      apu.dmc.output_vol += ((value - apu.dmc.regs[1]) << 8);
       apu.dmc.regs[1] = value;
+      apu.dmc.level = value & 0x7F; /* bit 7 ignored */
       break;
 
    case APU_WRE2:
@@ -761,8 +666,6 @@ void apu_write(uint32 address, uint8 value)
       break;
 
    case APU_SMASK:
-      /* bodge for timestamp queue */
-      apu.dmc.enabled = (value & 0x10) ? true : false;
       apu.enable_reg = value;
 
       for (chan = 0; chan < 2; chan++)
@@ -786,9 +689,6 @@ void apu_write(uint32 address, uint8 value)
       {
          apu.triangle.enabled = false;
          apu.triangle.vbl_length = 0;
-         apu.triangle.linear_length = 0;
-         apu.triangle.counter_started = false;
-         apu.triangle.write_latency = 0;
       }
 
       if (value & 0x08)
@@ -814,16 +714,43 @@ void apu_write(uint32 address, uint8 value)
       apu.dmc.irq_occurred = false;
       break;
 
-      /* unused, but they get hit in some mem-clear loops */
-   case 0x4009:
-   case 0x400D:
-      break;
-   
    default:
       break;
    }
 }
 
+/* play back the logged writes, and run the channels up to cycle */
+static void apu_sync(uint32 cycle)
+{
+   int i;
+
+   for (i = 0; i < apu_queued; i++)
+   {
+      apu_run(apu_queue[i].cycle);
+      if (apu_queue[i].address <= APU_SMASK)
+         apu_regwrite(apu_queue[i].address, apu_queue[i].value);
+      else if (apu.ext && apu.ext->write)
+         apu.ext->write(apu_queue[i].address, apu_queue[i].value);
+      apu_levels();
+   }
+   apu_queued = 0;
+
+   apu_run(cycle);
+}
+
+void apu_write(uint32 address, uint8 value)
+{
+   uint32 cycle = nes6502_getcycles(false);
+
+   if (APU_QUEUE_SIZE == apu_queued)
+      apu_sync(cycle);
+
+   apu_queue[apu_queued].cycle = cycle;
+   apu_queue[apu_queued].address = (uint16) address;
+   apu_queue[apu_queued].value = value;
+   apu_queued++;
+}
+
 /* Read from $4000-$4017 */
 uint8 apu_read(uint32 address)
 {
@@ -832,19 +759,20 @@ uint8 apu_read(uint32 address)
    switch (address)
    {
    case APU_SMASK:
+      /* counters have to be current */
+      apu_sync(nes6502_getcycles(false));
+
       value = 0;
       /* Return 1 in 0-5 bit pos if a channel is playing */
-      if (apu.rectangle[0].enabled && apu.rectangle[0].vbl_length)
+      if (apu.rectangle[0].vbl_length)
          value |= 0x01;
-      if (apu.rectangle[1].enabled && apu.rectangle[1].vbl_length)
+      if (apu.rectangle[1].vbl_length)
          value |= 0x02;
-      if (apu.triangle.enabled && apu.triangle.vbl_length)
+      if (apu.triangle.vbl_length)
          value |= 0x04;
-      if (apu.noise.enabled && apu.noise.vbl_length)
+      if (apu.noise.vbl_length)
          value |= 0x08;
-
-      /* bodge for timestamp queue */
-      if (apu.dmc.enabled)
+      if (apu.dmc.dma_length)
          value |= 0x10;
 
       if (apu.dmc.irq_occurred)
@@ -863,6 +791,75 @@ uint8 apu_read(uint32 address)
    return value;
 }
 
+/* save states: the channels as they stand now, and the sequencer
+** relative to them
+*/
+typedef struct apu_state_s
+{
+   rectangle_t rectangle[2];
+   triangle_t triangle;
+   noise_t noise;
+   dmc_t dmc;
+   uint8 enable_reg;
+   int32 seq_step;
+   int32 seq_cycles;
+} apu_state_t;
+
+int apu_savestate(void)
+{
+   apu_state_t state;
+
+   apu_sync(nes6502_getcycles(false));
+
+   memcpy(state.rectangle, apu.rectangle, sizeof(state.rectangle));
+   state.triangle = apu.triangle;
+   state.noise = apu.noise;
+   state.dmc = apu.dmc;
+   state.enable_reg = apu.enable_reg;
+   state.seq_step = apu.seq_step;
+   state.seq_cycles = (int32) (apu.seq_cycle - apu.cycle);
+
+   return state_put("APU ", 1, &state, sizeof(state));
+}
+
+/* the output carries on from the levels the mixer has now, so the
+** channels step to their loaded levels rather than the DC filter and
+** delta buffer having to be restored too
+*/
+int apu_loadstate(void)
+{
+   apu_state_t state;
+   int32 vol[5];
+
+   if (state_get("APU ", 1, &state, sizeof(state)))
+      return -1;
+
+   apu_sync(nes6502_getcycles(false));
+
+   vol[0] = apu.rectangle[0].output_vol;
+   vol[1] = apu.rectangle[1].output_vol;
+   vol[2] = apu.triangle.output_vol;
+   vol[3] = apu.noise.output_vol;
+   vol[4] = apu.dmc.output_vol;
+
+   memcpy(apu.rectangle, state.rectangle, sizeof(apu.rectangle));
+   apu.triangle = state.triangle;
+   apu.noise = state.noise;
+   apu.dmc = state.dmc;
+   apu.enable_reg = state.enable_reg;
+   apu.seq_step = state.seq_step;
+   apu.seq_cycle = apu.cycle + state.seq_cycles;
+
+   apu.rectangle[0].output_vol = vol[0];
+   apu.rectangle[1].output_vol = vol[1];
+   apu.triangle.output_vol = vol[2];
+   apu.noise.output_vol = vol[3];
+   apu.dmc.output_vol = vol[4];
+
+   apu_levels();
+   return 0;
+}
+
 #define CLIP_OUTPUT16(out) \
 { \
    /*out <<= 1;*/ \
@@ -872,12 +869,25 @@ uint8 apu_read(uint32 address)
       out = -0x8000; \
 }
 
-void apu_process(void *buffer, int num_samples)
+/* start the timeline over at cycle, after a reset or if the CPU's
+** cycle count has been changed under us
+*/
+static void apu_settime(uint32 cycle)
 {
-   static int32 prev_sample = 0;
+   apu_queued = 0;
+   apu.cycle = cycle;
+   apu.seq_cycle = cycle + APU_QUARTER_FRAME;
+   apu.frame_cycle = cycle;
+   apu.blip_origin = 0;
+}
 
+void apu_process(void *buffer, int num_samples)
+{
+   uint32 cycle = nes6502_getcycles(false);
+   uint32 elapsed, end;
    int16 *buf16;
    uint8 *buf8;
+   int i, carry;
 
    if (NULL != buffer)
    {
@@ -887,22 +897,24 @@ void apu_process(void *buffer, int num_samples)
       buf16 = (int16 *) buffer;
       buf8 = (uint8 *) buffer;
 
-      while (num_samples--)
+      if (num_samples > APU_BLIP_SIZE - BLIP_TAPS)
+         num_samples = APU_BLIP_SIZE - BLIP_TAPS;
+
+      if ((int32) (cycle - apu.cycle) < 0)
+         apu_settime(cycle);
+
+      apu_sync(cycle);
+
+      for (i = 0; i < num_samples; i++)
       {
-         int32 next_sample, accum = 0;
-
-         if (apu.mix_enable & 0x01)
-            accum += apu_rectangle_0();
-         if (apu.mix_enable & 0x02)
-            accum += apu_rectangle_1();
-         if (apu.mix_enable & 0x04)
-            accum += apu_triangle();
-         if (apu.mix_enable & 0x08)
-            accum += apu_noise();
-         if (apu.mix_enable & 0x10)
-            accum += apu_dmc();
-         if (apu.ext && (apu.mix_enable & 0x20))
-            accum += apu.ext->process();
+         int32 next_sample, accum;
+
+         apu.blip_sum += blip_buf[i];
+         accum = apu.blip_sum >> BLIP_BITS;
+
+         /* the channels are unipolar, take out the DC */
+         apu.dc_level += accum - (apu.dc_level >> 5);
+         accum -= apu.dc_level >> 5;
 
          /* do any filtering */
          if (APU_FILTER_NONE != apu.filter_type)
@@ -911,13 +923,13 @@ void apu_process(void *buffer, int num_samples)
 
             if (APU_FILTER_LOWPASS == apu.filter_type)
             {
-               accum += prev_sample;
+               accum += apu.prev_sample;
                accum >>= 1;
             }
             else
-               accum = (accum + accum + accum + prev_sample) >> 2;
+               accum = (accum + accum + accum + apu.prev_sample) >> 2;
 
-            prev_sample = next_sample;
+            apu.prev_sample = next_sample;
          }
 
          /* do clipping */
@@ -929,6 +941,33 @@ void apu_process(void *buffer, int num_samples)
          else
             *buf8++ = (accum >> 8) ^ 0x80;
       }
+
+      /* keep the tails of steps that run into the next frame */
+      carry = blip_used - num_samples;
+      if (carry > 0)
+         memmove(blip_buf, blip_buf + num_samples, carry * sizeof(int32));
+      else
+         carry = 0;
+      memset(blip_buf + carry, 0, (blip_used - carry) * sizeof(int32));
+      blip_used = carry;
+
+      /* this frame ended where the samples pulled did, give or take a
+      ** fraction of a sample. Track the CPU's real frame length so the
+      ** next one lines up too.
+      */
+      elapsed = cycle - apu.frame_cycle;
+      end = apu.blip_origin + elapsed * apu.blip_factor;
+      if (end < ((uint32) num_samples << BLIP_FRAC))
+         apu.blip_origin = 0;
+      else if (end - ((uint32) num_samples << BLIP_FRAC) > (2 << BLIP_FRAC))
+         apu.blip_origin = 2 << BLIP_FRAC;
+      else
+         apu.blip_origin = end - ((uint32) num_samples << BLIP_FRAC);
+
+      if (elapsed > (uint32) num_samples * 16 && elapsed < (uint32) num_samples * 512)
+         apu.blip_factor = ((uint32) num_samples << BLIP_FRAC) / elapsed;
+
+      apu.frame_cycle = cycle;
    }
 }
 
@@ -942,37 +981,65 @@ void apu_reset(void)
 {
    uint32 address;
 
+   memset(apu.rectangle, 0, sizeof(apu.rectangle));
+   memset(&apu.triangle, 0, sizeof(apu.triangle));
+   memset(&apu.noise, 0, sizeof(apu.noise));
+   memset(&apu.dmc, 0, sizeof(apu.dmc));
+   apu.noise.sreg = 1;
+   apu.seq_step = 0;
+
+   memset(blip_buf, 0, sizeof(blip_buf));
+   blip_used = 0;
+   apu.prev_sample = 0;
+
+   apu_settime(nes6502_getcycles(false));
+
    /* initialize all channel members */
    for (address = 0x4000; address <= 0x4013; address++)
-      apu_write(address, 0);
+      apu_regwrite(address, 0);
+
+   apu_regwrite(0x4015, 0);
 
-   apu_write(0x4015, 0);
+   /* the triangle powers up partway through its wave, start the mix
+   ** there rather than with a step
+   */
+   apu.triangle.output_vol = (apu.mix_enable & 0x04) ? apu_triangle_step() : 0;
+   apu.blip_sum = apu.triangle.output_vol << BLIP_BITS;
+   apu.dc_level = apu.triangle.output_vol << 5;
 
    if (apu.ext && NULL != apu.ext->reset)
       apu.ext->reset();
 }
 
-void apu_build_luts(int num_samples)
+/* windowed sinc impulses for each fraction of a sample, each summing
+** to exactly one step so the output never drifts
+*/
+void apu_build_luts(void)
 {
-   int i;
+   int phase, i, sum;
+   double x, w, total, taps[BLIP_TAPS];
 
-   /* lut used for enveloping and frequency sweeps */
-   for (i = 0; i < 16; i++)
-      decay_lut[i] = num_samples * (i + 1);
-
-   /* used for note length, based on vblanks and size of audio buffer */
-   for (i = 0; i < 32; i++)
-      vbl_lut[i] = vbl_length[i] * num_samples;
-
-   /* triangle wave channel's linear length table */
-   for (i = 0; i < 128; i++)
-      trilength_lut[i] = (int) (0.25 * i * num_samples);
+   for (phase = 0; phase < BLIP_PHASES; phase++)
+   {
+      total = 0;
+      for (i = 0; i < BLIP_TAPS; i++)
+      {
+         x = i - (BLIP_TAPS / 2 - 1) - (double) phase / BLIP_PHASES;
+         w = APU_PI * x / (BLIP_TAPS / 2);
+         taps[i] = (0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w));
+         if (0 != x)
+            taps[i] *= sin(APU_PI * BLIP_CUTOFF * x) / (APU_PI * BLIP_CUTOFF * x);
+         total += taps[i];
+      }
 
-#ifndef REALTIME_NOISE
-   /* generate noise samples */
-   shift_register15(noise_long_lut, APU_NOISE_32K);
-   shift_register15(noise_short_lut, APU_NOISE_93);
-#endif /* !REALTIME_NOISE */
+      sum = 0;
+      for (i = 0; i < BLIP_TAPS; i++)
+      {
+         blip_kernel[phase][i] = (int16) floor(taps[i] * (1 << BLIP_BITS) / total + 0.5);
+         sum += blip_kernel[phase][i];
+      }
+      blip_kernel[phase][BLIP_TAPS / 2 - 1] += (1 << BLIP_BITS) - sum;
+   }
 }
 
 void apu_setparams(double base_freq, int sample_rate, int refresh_rate, int sample_bits)
@@ -986,9 +1053,10 @@ void apu_setparams(double base_freq, int sample_rate, int refresh_rate, int samp
    else
       apu.base_freq = base_freq;
    apu.cycle_rate = (float) (apu.base_freq / sample_rate);
+   apu.blip_factor = (uint32) ((1 << BLIP_FRAC) / apu.cycle_rate);
 
    /* build various lookup tables for apu */
-   apu_build_luts(apu.num_samples);
+   apu_build_luts();
 
    apu_reset();
 }
@@ -999,7 +1067,7 @@ apu_t *apu_create(double base_freq, int sample_rate, int refresh_rate, int sampl
    apu_t *temp_apu;
    int channel;
 
-   temp_apu = malloc(sizeof(apu_t));
+   temp_apu = MALLOC32(sizeof(apu_t), "apu_t");
    if (NULL == temp_apu)
       return NULL;
 
@@ -1015,11 +1083,11 @@ apu_t *apu_create(double base_freq, int sample_rate, int refresh_rate, int sampl
 
    apu_setcontext(temp_apu);
 
-   apu_setparams(base_freq, sample_rate, refresh_rate, sample_bits);
-
    for (channel = 0; channel < 6; channel++)
       apu_setchan(channel, true);
 
+   apu_setparams(base_freq, sample_rate, refresh_rate, sample_bits);
+
    apu_setfilter(APU_FILTER_WEIGHTED);
 
    apu_getcontext(temp_apu);
@@ -1033,7 +1101,7 @@ void apu_destroy(apu_t **src_apu)
    {
       if ((*src_apu)->ext && NULL != (*src_apu)->ext->shutdown)
          (*src_apu)->ext->shutdown();
-      free(*src_apu);
+      FREE32(*src_apu);
       *src_apu = NULL;
    }
 }
@@ -27,9 +27,6 @@
 #define _NES_APU_H_
 
 
-/* define this for realtime generated noise */
-#define  REALTIME_NOISE
-
 #define  APU_WRA0       0x4000
 #define  APU_WRA1       0x4001
 #define  APU_WRA2       0x4002
@@ -51,16 +48,12 @@
 
 #define  APU_SMASK      0x4015
 
-/* length of generated noise */
-#define  APU_NOISE_32K  0x7FFF
-#define  APU_NOISE_93   93
-
 #define  APU_BASEFREQ   1789772.7272727272727272
 
 
 /* channel structures */
-/* As much data as possible is precalculated,
-** to keep the sample processing as lean as possible
+/* Channels are clocked in CPU cycles between register writes, and
+** only hand changes of their output level to the band-limited mixer
 */
  
 typedef struct rectangle_s
@@ -69,23 +62,21 @@ typedef struct rectangle_s
 
    bool enabled;
    
-   float accum;
+   int32 timer;
    int32 freq;
    int32 output_vol;
    bool fixed_envelope;
    bool holdnote;
    uint8 volume;
 
-   int32 sweep_phase;
    int32 sweep_delay;
    bool sweep_on;
+   bool sweep_reload;
    uint8 sweep_shifts;
    uint8 sweep_length;
    bool sweep_inc;
 
-   /* this may not be necessary in the future */
-   int32 freq_limit;
-   int32 env_phase;
+   bool env_start;
    int32 env_delay;
    uint8 env_vol;
 
@@ -100,16 +91,14 @@ typedef struct triangle_s
 
    bool enabled;
 
-   float accum;
+   int32 timer;
    int32 freq;
    int32 output_vol;
 
    uint8 adder;
 
    bool holdnote;
-   bool counter_started;
-   /* quasi-hack */
-   int write_latency;
+   bool counter_reload;
 
    int vbl_length;
    int linear_length;
@@ -122,11 +111,11 @@ typedef struct noise_s
 
    bool enabled;
 
-   float accum;
+   int32 timer;
    int32 freq;
    int32 output_vol;
 
-   int32 env_phase;
+   bool env_start;
    int32 env_delay;
    uint8 env_vol;
    bool fixed_envelope;
@@ -136,22 +125,15 @@ typedef struct noise_s
 
    int vbl_length;
 
-#ifdef REALTIME_NOISE
+   uint16 sreg;
    uint8 xor_tap;
-#else
-   bool short_sample;
-   int cur_pos;
-#endif /* REALTIME_NOISE */
 } noise_t;
 
 typedef struct dmc_s
 {
    uint8 regs[4];
 
-   /* bodge for timestamp queue */
-   bool enabled;
-   
-   float accum;
+   int32 timer;
    int32 freq;
    int32 output_vol;
 
@@ -160,6 +142,7 @@ typedef struct dmc_s
    int dma_length;
    int cached_dmalength;
    uint8 cur_byte;
+   uint8 level;
 
    bool looping;
    bool irq_gen;
@@ -187,12 +170,20 @@ typedef struct
 } apu_memwrite;
 
 /* external sound chip stuff */
+/* Sound registers map to apu_write, which logs them alongside the 2A03's
+** and plays them back through write(). run() brings the chip's output
+** up to date at cycle, then clocks its channels for the cycles after,
+** handing level changes to apu_mixext(). sequence() is clocked with the
+** 2A03's frame sequencer.
+*/
 typedef struct apuext_s
 {
    int   (*init)(void);
    void  (*shutdown)(void);
    void  (*reset)(void);
-   int32 (*process)(void);
+   void  (*write)(uint32 address, uint8 value);
+   void  (*run)(uint32 cycle, int32 cycles);
+   void  (*sequence)(bool half_frame);
    apu_memread *mem_read;
    apu_memwrite *mem_write;
 } apuext_t;
@@ -219,6 +210,23 @@ typedef struct apu_s
    int sample_bits;
    int refresh_rate;
 
+   /* CPU cycle the channels have been run up to, and of the next
+   ** 240Hz frame sequencer clock
+   */
+   uint32 cycle;
+   uint32 seq_cycle;
+   int seq_step;
+
+   /* output sample position of frame_cycle and samples per cycle,
+   ** both with 20 fractional bits
+   */
+   uint32 frame_cycle;
+   uint32 blip_origin;
+   uint32 blip_factor;
+   int32 blip_sum;
+   int32 dc_level;
+   int32 prev_sample;
+
    void (*process)(void *buffer, int num_samples);
    void (*irq_callback)(void);
    uint8 (*irqclear_callback)(void);
@@ -250,6 +258,11 @@ extern void apu_setchan(int chan, bool enabled);
 extern uint8 apu_read(uint32 address);
 extern void apu_write(uint32 address, uint8 value);
 
+extern void apu_mixext(int32 *output_vol, int32 level, uint32 cycle);
+
+extern int apu_savestate(void);
+extern int apu_loadstate(void);
+
 
 #ifdef __cplusplus
 }
@@ -224,7 +224,7 @@ void mmc_reset(void)
 void mmc_destroy(mmc_t **nes_mmc)
 {
    if (*nes_mmc)
-      free(*nes_mmc);
+      FREE32(*nes_mmc);
 }
 
 mmc_t *mmc_create(rominfo_t *rominfo)
@@ -238,7 +238,7 @@ mmc_t *mmc_create(rominfo_t *rominfo)
          return NULL; /* Should *never* happen */
    }
 
-   temp = malloc(sizeof(mmc_t));
+   temp = MALLOC_MEDIA(sizeof(mmc_t), "mmc_t");
    if (NULL == temp)
       return NULL;
 
@@ -55,6 +55,191 @@
 /* the NES PPU */
 static ppu_t ppu;
 
+/* A line is left as it is when it would come out the same as last time:
+** drawn in one go, from the same registers and banks, and nothing it reads
+** (its nametable row, pattern data, palette, the sprites on it) has
+** changed since. Changes are stamped with a generation number when they
+** land, lines with the generation they were drawn at.
+*/
+#define  PPU_PAGESETS         16
+#define  PPU_LINEPAGES        12    /* pattern tables and nametables */
+
+typedef struct ppu_lines_s
+{
+   uint32 gen;
+   uint32 all_gen;                        /* pattern data or palette */
+   uint32 row_gen[4][32];                 /* nametable tile rows */
+   uint32 obj_gen[NES_SCREEN_HEIGHT];     /* sprites on each line */
+
+   uint32 drawn[NES_SCREEN_HEIGHT];       /* 0 if the line can't be kept */
+   uint32 regs[NES_SCREEN_HEIGHT];
+   uint8 pageset[NES_SCREEN_HEIGHT];
+   uint8 maxsprite[NES_SCREEN_HEIGHT];
+
+   /* bank layouts seen lately, mappers that split the screen flip between a few */
+   uint8 *pages[PPU_PAGESETS][PPU_LINEPAGES];
+   uint32 pages_gen[PPU_PAGESETS];
+   int cur_pages, next_pages;
+   bool pages_dirty;
+
+   uint8 oam[256];                        /* sprites as last looked at */
+   bool oam_dirty;
+} ppu_lines_t;
+
+/* everything changed, e.g. a state was loaded */
+static void ppu_dirtylines(void)
+{
+   if (ppu.lines)
+   {
+      ppu.lines->all_gen = ++ppu.lines->gen;
+      ppu.lines->pages_dirty = true;
+      ppu.lines->oam_dirty = true;
+   }
+}
+
+/* stamp the lines a changed byte of vram shows on */
+static void ppu_vramchanged(uint32 addr)
+{
+   ppu_lines_t *lines = ppu.lines;
+   uint32 offset;
+   int nt, row, first;
+
+   if (NULL == lines)
+      return;
+
+   lines->gen++;
+   if (addr < 0x2000)
+   {
+      lines->all_gen = lines->gen;
+      return;
+   }
+
+   /* every nametable mirroring this byte, attributes cover 4 rows */
+   offset = addr & 0x3FF;
+   for (nt = 0; nt < 4; nt++)
+   {
+      if (&PPU_MEM(0x2000 + (nt << 10) + offset) != &PPU_MEM(addr))
+         continue;
+
+      lines->row_gen[nt][offset >> 5] = lines->gen;
+      if (offset >= 0x3C0)
+      {
+         first = ((offset - 0x3C0) >> 3) << 2;
+         for (row = first; row < first + 4; row++)
+            lines->row_gen[nt][row] = lines->gen;
+      }
+   }
+}
+
+/* find the current bank layout among those seen lately */
+static void ppu_checkpages(ppu_lines_t *lines)
+{
+   int i;
+
+   if (false == lines->pages_dirty)
+      return;
+   lines->pages_dirty = false;
+
+   for (i = 0; i < PPU_PAGESETS; i++)
+   {
+      if (0 == memcmp(lines->pages[i], ppu.page, sizeof(lines->pages[i])))
+      {
+         lines->cur_pages = i;
+         return;
+      }
+   }
+
+   /* lines drawn with what was here before can't be kept */
+   i = lines->next_pages;
+   lines->next_pages = (i + 1) % PPU_PAGESETS;
+   memcpy(lines->pages[i], ppu.page, sizeof(lines->pages[i]));
+   lines->pages_gen[i] = ++lines->gen;
+   lines->cur_pages = i;
+}
+
+/* stamp the lines a sprite starting at y_loc can cover, as tall as they get */
+static void ppu_objchanged(ppu_lines_t *lines, uint8 y_loc)
+{
+   int line;
+
+   for (line = y_loc + 1; line < y_loc + 17 && line < NES_SCREEN_HEIGHT; line++)
+      lines->obj_gen[line] = lines->gen;
+}
+
+/* stamp where sprites that changed were and are now */
+static void ppu_checkoam(ppu_lines_t *lines)
+{
+   int i;
+
+   if (false == lines->oam_dirty)
+      return;
+   lines->oam_dirty = false;
+
+   lines->gen++;
+   for (i = 0; i < 256; i += 4)
+   {
+      if (0 == memcmp(lines->oam + i, ppu.oam + i, 4))
+         continue;
+
+      ppu_objchanged(lines, lines->oam[i]);
+      ppu_objchanged(lines, ppu.oam[i]);
+   }
+   memcpy(lines->oam, ppu.oam, sizeof(lines->oam));
+}
+
+/* the registers a line is drawn from */
+static uint32 ppu_lineregs(void)
+{
+   return (ppu.vaddr & 0x7FFF) | (ppu.tile_xofs << 15)
+          | ((ppu.ctrl0 & (PPU_CTRL0F_OBJ16 | PPU_CTRL0F_BGADDR | PPU_CTRL0F_OBJADDR)) << 15)
+          | ((ppu.ctrl1 & (PPU_CTRL1F_OBJON | PPU_CTRL1F_BGON | PPU_CTRL1F_OBJMASK | PPU_CTRL1F_BGMASK)) << 20)
+          | (ppu.drawsprites ? 0x2000000 : 0);
+}
+
+/* does the line in the buffer look like the one about to be drawn */
+static bool ppu_keepline(int scanline)
+{
+   ppu_lines_t *lines = ppu.lines;
+   uint32 drawn;
+   int nt, row;
+
+   /* mmc2 switches banks as it draws */
+   if (NULL == lines || ppu.latchfunc)
+      return false;
+
+   ppu_checkpages(lines);
+   ppu_checkoam(lines);
+
+   drawn = lines->drawn[scanline];
+   nt = (ppu.vaddr >> 10) & 3;
+   row = (ppu.vaddr >> 5) & 0x1F;
+
+   return lines->regs[scanline] == ppu_lineregs()
+          && lines->pageset[scanline] == lines->cur_pages
+          && lines->pages_gen[lines->cur_pages] <= drawn
+          && lines->all_gen <= drawn
+          && lines->row_gen[nt][row] <= drawn
+          && lines->row_gen[nt ^ 1][row] <= drawn
+          && lines->obj_gen[scanline] <= drawn;
+}
+
+/* note what the line was drawn from, unless it changed partway */
+static void ppu_linedrawn(int scanline, bool whole)
+{
+   ppu_lines_t *lines = ppu.lines;
+
+   if (NULL == lines)
+      return;
+
+   ppu_checkpages(lines);
+   ppu_checkoam(lines);
+
+   lines->drawn[scanline] = whole ? lines->gen : 0;
+   lines->regs[scanline] = ppu_lineregs();
+   lines->pageset[scanline] = lines->cur_pages;
+   lines->maxsprite[scanline] = (ppu.stat & PPU_STATF_MAXSPRITE) ? 1 : 0;
+}
+
 
 void ppu_displaysprites(bool display)
 {
@@ -88,6 +273,8 @@ void ppu_setcontext(ppu_t *src_ppu)
    ppu.page[13] = ppu.page[9] - 0x1000;
    ppu.page[14] = ppu.page[10] - 0x1000;
    ppu.page[15] = ppu.page[11] - 0x1000;
+
+   ppu_dirtylines();
 }
 
 void ppu_getcontext(ppu_t *dest_ppu)
@@ -125,12 +312,22 @@ ppu_t *ppu_create(void)
    static bool pal_generated = false;
    ppu_t *temp;
 
-   temp = malloc(sizeof(ppu_t));
+   temp = MALLOC32(sizeof(ppu_t), "ppu_t");
    if (NULL == temp)
       return NULL;
 
    memset(temp, 0, sizeof(ppu_t));
 
+   /* without it every line is drawn */
+   temp->lines = MALLOC32(sizeof(ppu_lines_t), "ppu_lines");
+   if (temp->lines)
+   {
+      memset(temp->lines, 0, sizeof(ppu_lines_t));
+      temp->lines->gen = temp->lines->all_gen = 1;
+      temp->lines->pages_dirty = true;
+      temp->lines->oam_dirty = true;
+   }
+
    temp->latchfunc = NULL;
    temp->vromswitch = NULL;
    temp->vram_present = false;
@@ -152,13 +349,19 @@ void ppu_destroy(ppu_t **src_ppu)
 {
    if (*src_ppu)
    {
-      free(*src_ppu);
+      if ((*src_ppu)->lines)
+         FREE32((*src_ppu)->lines);
+      FREE32(*src_ppu);
       *src_ppu = NULL;
    }
 }
 
 void ppu_setpage(int size, int page_num, uint8 *location)
 {
+   ppu_catchup();
+   if (ppu.lines)
+      ppu.lines->pages_dirty = true;
+
    /* deliberately fall through */
    switch (size)
    {
@@ -189,6 +392,10 @@ void ppu_mirrorhipages(void)
 
 void ppu_mirror(int nt1, int nt2, int nt3, int nt4)
 {
+   ppu_catchup();
+   if (ppu.lines)
+      ppu.lines->pages_dirty = true;
+
    ppu.page[8] = ppu.nametab + (nt1 << 10) - 0x2000;
    ppu.page[9] = ppu.nametab + (nt2 << 10) - 0x2400;
    ppu.page[10] = ppu.nametab + (nt3 << 10) - 0x2800;
@@ -229,6 +436,8 @@ void ppu_reset(int reset_type)
 
    ppu.latch = 0;
    ppu.vram_accessible = true;
+   ppu.render_buf = NULL;
+   ppu_dirtylines();
 }
 
 /* we render a scanline of graphics first so we know exactly
@@ -242,7 +451,7 @@ static void ppu_setstrike(int x_loc)
       ppu.strikeflag = true;
 
       /* 3 pixels per cpu cycle */
-      ppu.strike_cycle = nes6502_getcycles(false) + (x_loc / 3);
+      ppu.strike_cycle = ppu.line_cycle + (x_loc / 3);
    }
 }
 
@@ -279,6 +488,9 @@ static void ppu_oamdma(uint8 value)
          ppu.oam[oam_loc] = nes6502_getbyte(cpu_address++);
    }
 
+   if (ppu.lines)
+      ppu.lines->oam_dirty = true;
+
    /* make the CPU spin for DMA cycles */
    nes6502_burn(513);
    nes6502_release();
@@ -401,6 +613,23 @@ uint8 ppu_read(uint32 address)
    return value;
 }
 
+/* How many of the next cycles reads of $2000-$2007 return the same value
+** for: only the status register, and only until a pending sprite 0 strike
+*/
+int ppu_idlecycles(uint32 address, int cycles)
+{
+   uint32 now;
+
+   if (PPU_STAT != (address & 0x2007))
+      return 0;
+
+   now = nes6502_getcycles(false);
+   if (ppu.strikeflag && now < ppu.strike_cycle && ppu.strike_cycle - now < (uint32) cycles)
+      return ppu.strike_cycle - now;
+
+   return cycles;
+}
+
 /* Write to $2000-$2007 */
 void ppu_write(uint32 address, uint8 value)
 {
@@ -410,6 +639,8 @@ void ppu_write(uint32 address, uint8 value)
    switch (address & 0x2007)
    {
    case PPU_CTRL0:
+      if ((value ^ ppu.ctrl0) & PPU_CTRL0F_BGADDR)
+         ppu_catchup();
       ppu.ctrl0 = value;
 
       ppu.obj_height = (value & PPU_CTRL0F_OBJ16) ? 16 : 8;
@@ -424,6 +655,8 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_CTRL1:
+      if ((value ^ ppu.ctrl1) & (PPU_CTRL1F_BGON | PPU_CTRL1F_BGMASK))
+         ppu_catchup();
       ppu.ctrl1 = value;
 
       ppu.obj_on = (value & PPU_CTRL1F_OBJON) ? true : false;
@@ -438,11 +671,17 @@ void ppu_write(uint32 address, uint8 value)
 
    case PPU_OAMDATA:
       ppu.oam[ppu.oam_addr++] = value;
+      if (ppu.lines)
+         ppu.lines->oam_dirty = true;
       break;
 
    case PPU_SCROLL:
       if (0 == ppu.flipflop)
       {
+         /* fine x applies straight away, the rest waits for the next line */
+         if ((value & 7) != ppu.tile_xofs)
+            ppu_catchup();
+
          /* Mask out bits 4 - 0 in the ppu latch */
          ppu.vaddr_latch &= ~0x001F;
          ppu.vaddr_latch |= (value >> 3);    /* Tile number */
@@ -469,10 +708,13 @@ void ppu_write(uint32 address, uint8 value)
       }
       else
       {
+         ppu_catchup();
+
          /* Mask out bits 7-0 in ppu latch */
          ppu.vaddr_latch &= ~0x00FF;
          ppu.vaddr_latch |= value;
          ppu.vaddr = ppu.vaddr_latch;
+         ppu.vaddr_x = ppu.render_x;
       }
       
       ppu.flipflop ^= 1;
@@ -480,6 +722,8 @@ void ppu_write(uint32 address, uint8 value)
       break;
 
    case PPU_VDATA:
+      ppu_catchup();
+
       if (ppu.vaddr < 0x3F00)
       {
          /* VRAM only accessible during scanlines 241-260 */
@@ -487,7 +731,11 @@ void ppu_write(uint32 address, uint8 value)
          {
             log_printf("VRAM write to $%04X, scanline %d\n", 
                        ppu.vaddr, nes_getcontextptr()->scanline);
-            PPU_MEM(ppu.vaddr) = 0xFF; /* corrupt */
+            if (0xFF != PPU_MEM(ppu.vaddr))
+            {
+               PPU_MEM(ppu.vaddr) = 0xFF; /* corrupt */
+               ppu_vramchanged(ppu.vaddr);
+            }
          }
          else 
          {
@@ -496,7 +744,11 @@ void ppu_write(uint32 address, uint8 value)
             if (false == ppu.vram_present && addr >= 0x3000)
                ppu.vaddr -= 0x1000;
 
-            PPU_MEM(addr) = value;
+            if (value != PPU_MEM(addr))
+            {
+               PPU_MEM(addr) = value;
+               ppu_vramchanged(addr);
+            }
          }
       }
       else
@@ -505,11 +757,15 @@ void ppu_write(uint32 address, uint8 value)
          {
             int i;
 
+            if (ppu.lines && ppu.palette[0] != ((value & 0x3F) | BG_TRANS))
+               ppu.lines->all_gen = ++ppu.lines->gen;
             for (i = 0; i < 8; i ++)
                ppu.palette[i << 2] = (value & 0x3F) | BG_TRANS;
          }
          else if (ppu.vaddr & 3)
          {
+            if (ppu.lines && ppu.palette[ppu.vaddr & 0x1F] != (value & 0x3F))
+               ppu.lines->all_gen = ++ppu.lines->gen;
             ppu.palette[ppu.vaddr & 0x1F] = value & 0x3F;
          }
       }
@@ -693,24 +949,40 @@ INLINE int draw_oamtile(uint8 *surface, uint8 attrib, uint8 pat1,
    return strike_pixel;
 }
 
-static void ppu_renderbg(uint8 *vidbuf)
+/* draw pixels x0 to x1 of the background, the current scroll applies to
+** the whole span so mid-line changes take effect from where they land
+*/
+static void ppu_renderbg(uint8 *vidbuf, int x0, int x1)
 {
    uint8 *bmp_ptr, *data_ptr, *tile_ptr, *attrib_ptr;
    uint32 refresh_vaddr, bg_offset, attrib_base;
-   int tile_count;
+   int tile_count, skip, keep;
    uint8 tile_index, x_tile, y_tile;
    uint8 col_high, attrib, attrib_shift;
+   uint8 saved[8];
 
    /* draw a line of transparent background color if bg is disabled */
    if (false == ppu.bg_on)
    {
-      memset(vidbuf, FULLBG, NES_SCREEN_WIDTH);
+      memset(vidbuf + x0, FULLBG, x1 - x0);
       return;
    }
 
-   bmp_ptr = vidbuf - ppu.tile_xofs; /* scroll x */
+   /* tiles are drawn whole, keep what is left of x0 in the first one */
+   skip = (x0 + ppu.tile_xofs) >> 3;
+   bmp_ptr = vidbuf - ppu.tile_xofs + (skip << 3); /* scroll x */
+   keep = x0 ? x0 - (bmp_ptr - vidbuf) : 0;
+   if (keep)
+      memcpy(saved, bmp_ptr, keep);
+
+   /* coarse x is for the tile the beam was on when vaddr was set */
    refresh_vaddr = 0x2000 + (ppu.vaddr & 0x0FE0); /* mask out x tile */
-   x_tile = ppu.vaddr & 0x1F;
+   x_tile = (ppu.vaddr & 0x1F) + skip - ((ppu.vaddr_x + ppu.tile_xofs) >> 3);
+   if (x_tile >= 32)
+   {
+      x_tile -= 32;
+      refresh_vaddr ^= (1 << 10); /* switch nametable */
+   }
    y_tile = (ppu.vaddr >> 5) & 0x1F; /* to simplify calculations */
    bg_offset = ((ppu.vaddr >> 12) & 7) + ppu.bg_base; /* offset in y tile */
 
@@ -722,8 +994,12 @@ static void ppu_renderbg(uint8 *vidbuf)
    attrib_shift = (x_tile & 2) + ((y_tile & 2) << 1);
    col_high = ((attrib >> attrib_shift) & 3) << 2;
 
-   /* ppu fetches 33 tiles */
-   tile_count = 33;
+   /* ppu fetches 33 tiles a line */
+   if (NES_SCREEN_WIDTH == x1)
+      tile_count = 33 - skip;
+   else
+      tile_count = ((x1 + ppu.tile_xofs + 7) >> 3) - skip;
+
    while (tile_count--)
    {
       /* Tile number from nametable */
@@ -763,15 +1039,12 @@ static void ppu_renderbg(uint8 *vidbuf)
       }
    }
 
-   /* Blank left hand column if need be */
-   if (ppu.bg_mask)
-   {
-      uint32 *buf_ptr = (uint32 *) vidbuf;
-      uint32 bg_clear = FULLBG | FULLBG << 8 | FULLBG << 16 | FULLBG << 24;
+   if (keep)
+      memcpy(vidbuf + x0 - keep, saved, keep);
 
-      ((uint32 *) buf_ptr)[0] = bg_clear;
-      ((uint32 *) buf_ptr)[1] = bg_clear;
-   }
+   /* Blank left hand column if need be */
+   if (ppu.bg_mask && x0 < 8)
+      memset(vidbuf + x0, FULLBG, (x1 < 8 ? x1 : 8) - x0);
 }
 
 /* OAM entry */
@@ -784,7 +1057,7 @@ typedef struct obj_s
 } obj_t;
 
 /* TODO: fetch valid OAM a scanline before, like the Real Thing */
-static void ppu_renderoam(uint8 *vidbuf, int scanline)
+static void ppu_renderoam(uint8 *vidbuf, int scanline, int num_sprites)
 {
    uint8 *buf_ptr;
    uint32 vram_offset, savecol[2];
@@ -811,7 +1084,7 @@ static void ppu_renderoam(uint8 *vidbuf, int scanline)
 
    sprite_ptr = (obj_t *) ppu.oam;
 
-   for (sprite_num = 0; sprite_num < 64; sprite_num++, sprite_ptr++)
+   for (sprite_num = 0; sprite_num < num_sprites; sprite_num++, sprite_ptr++)
    {
       uint8 *data_ptr, *bmp_ptr;
       uint32 vram_adr;
@@ -1009,9 +1282,27 @@ bool ppu_enabled(void)
    return (ppu.bg_on || ppu.obj_on);
 }
 
-static void ppu_renderscanline(bitmap_t *bmp, int scanline, bool draw_flag)
+/* sprite 0 is on this line and hasn't struck yet */
+static bool ppu_checkstrike(int scanline)
 {
-   uint8 *buf = bmp->line[scanline];
+   uint8 sprite_y = ppu.oam[0] + 1;
+
+   if (false == ppu.obj_on || ppu.strikeflag)
+      return false;
+
+   return (sprite_y <= scanline) && (sprite_y > (scanline - ppu.obj_height))
+          && (0 != sprite_y) && (sprite_y < 240);
+}
+
+/* a line's cpu timeslice starts at the hblank before it, so writes made
+** there (scanline irqs and the like) land before the first pixel
+*/
+#define  PPU_HBLANK_CYCLES    (340 / 12)
+
+static void ppu_startscanline(bitmap_t *bmp, int scanline, bool draw_flag)
+{
+   /* sprite 0 strikes are found by drawing it ahead of time */
+   static uint8 strike_buf[8 + NES_SCREEN_WIDTH + 16];
 
    /* start scanline - transfer ppu latch into vaddr */
    if (ppu.bg_on || ppu.obj_on)
@@ -1026,20 +1317,98 @@ static void ppu_renderscanline(bitmap_t *bmp, int scanline, bool draw_flag)
          ppu.vaddr |= (ppu.vaddr_latch & 0x041F);
       }
    }
+   ppu.vaddr_x = 0;
 
+   /* the line itself is drawn as the cpu runs: up to the beam when a
+   ** write changes how it looks, and the rest at the end of the line
+   */
+   ppu.line_cycle = nes6502_getcycles(false) + PPU_HBLANK_CYCLES;
    if (draw_flag)
-      ppu_renderbg(buf);
+   {
+      ppu.render_buf = bmp->line[scanline];
+      ppu.render_x = 0;
+   }
 
-   /* TODO: fetch obj data 1 scanline before */
+   /* so the time of a sprite 0 strike is known before the cpu polls for it */
    if (true == ppu.drawsprites && true == draw_flag)
-      ppu_renderoam(buf, scanline);
+   {
+      if (ppu_checkstrike(scanline))
+      {
+         int x = ppu.oam[3];
+
+         ppu_renderbg(strike_buf + 8, x, (x < NES_SCREEN_WIDTH - 8) ? x + 8 : NES_SCREEN_WIDTH);
+         ppu_renderoam(strike_buf + 8, scanline, 1);
+      }
+   }
    else
+   {
       ppu_fakeoam(scanline);
+   }
 }
 
+/* draw the current line up to x with the settings as they are */
+static void ppu_renderto(int x)
+{
+   uint8 *buf = ppu.render_buf;
+
+   if (x > ppu.render_x)
+   {
+      /* vrom switches made while drawing are part of the drawing */
+      ppu.render_buf = NULL;
+      ppu_renderbg(buf, ppu.render_x, x);
+      ppu.render_buf = buf;
+   }
+   ppu.render_x = x;
+}
+
+/* something that shows on screen is about to change */
+void ppu_catchup(void)
+{
+   int x;
+
+   if (NULL == ppu.render_buf)
+      return;
+
+   /* 3 pixels per cpu cycle, nothing to draw until hblank is over */
+   x = (int32) (nes6502_getcycles(false) - ppu.line_cycle) * 3;
+   if (x <= ppu.render_x)
+      return;
+   if (x > NES_SCREEN_WIDTH)
+      x = NES_SCREEN_WIDTH;
+
+   ppu_renderto(x);
+}
 
+/* end of a line's timeslice */
 void ppu_endscanline(int scanline)
 {
+   /* finish drawing the line, sprites go over the top of it all.
+   ** a line that didn't change partway and looks the same as last
+   ** time is already in the buffer
+   */
+   if (ppu.render_buf)
+   {
+      uint8 *buf = ppu.render_buf;
+      bool whole = (0 == ppu.render_x);
+
+      if (whole && ppu_keepline(scanline))
+      {
+         ppu.render_buf = NULL;
+         if (ppu.lines->maxsprite[scanline])
+            ppu.stat |= PPU_STATF_MAXSPRITE;
+      }
+      else
+      {
+         ppu_renderto(NES_SCREEN_WIDTH);
+         ppu.render_buf = NULL;
+
+         if (true == ppu.drawsprites)
+            ppu_renderoam(buf, scanline, 64);
+
+         ppu_linedrawn(scanline, whole);
+      }
+   }
+
    /* modify vram address at end of scanline */
    if (scanline < 240 && (ppu.bg_on || ppu.obj_on))
    {
@@ -1084,7 +1453,7 @@ void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag)
    {
       /* Lower the Max Sprite per scanline flag */
       ppu.stat &= ~PPU_STATF_MAXSPRITE;
-      ppu_renderscanline(bmp, scanline, draw_flag);
+      ppu_startscanline(bmp, scanline, draw_flag);
    }
    else if (241 == scanline)
    {
@@ -100,6 +100,15 @@ typedef struct ppu_s
    bool strikeflag;
    uint32 strike_cycle;
 
+   /* line being drawn, rendered lazily up to the beam on register writes */
+   uint8 *render_buf;
+   int render_x;
+   uint32 line_cycle;
+   int vaddr_x;      /* pixel vaddr's coarse x applies from, moved by mid-line $2006 writes */
+
+   /* what each line was last drawn from, so unchanged lines can be left alone */
+   struct ppu_lines_s *lines;
+
    /* callbacks for naughty mappers */
    ppulatchfunc_t latchfunc;
    ppuvromswitch_t vromswitch;
@@ -136,6 +145,7 @@ extern void ppu_reset(int reset_type);
 extern bool ppu_enabled(void);
 extern void ppu_scanline(bitmap_t *bmp, int scanline, bool draw_flag);
 extern void ppu_endscanline(int scanline);
+extern void ppu_catchup(void);
 extern void ppu_checknmi();
 
 extern ppu_t *ppu_create(void);
@@ -143,6 +153,7 @@ extern void ppu_destroy(ppu_t **ppu);
 
 /* IO */
 extern uint8 ppu_read(uint32 address);
+extern int ppu_idlecycles(uint32 address, int cycles);
 extern void ppu_write(uint32 address, uint8 value);
 extern uint8 ppu_readhigh(uint32 address);
 extern void ppu_writehigh(uint32 address, uint8 value);
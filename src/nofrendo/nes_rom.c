@@ -75,63 +75,11 @@ typedef struct inesheader_s
 #define  TRAINER_LENGTH    0x200
 #define  VRAM_LENGTH       0x2000
 
-#define  ROM_BANK_LENGTH   0x4000
-#define  VROM_BANK_LENGTH  0x2000
-
-#define  SRAM_BANK_LENGTH  0x0400
-#define  VRAM_BANK_LENGTH  0x2000
-
-/* Save battery-backed RAM */
-static void rom_savesram(rominfo_t *rominfo)
-{
-   FILE *fp;
-   char fn[PATH_MAX + 1];
-
-   ASSERT(rominfo);
-
-   if (rominfo->flags & ROM_FLAG_BATTERY)
-   {
-      strncpy(fn, rominfo->filename, PATH_MAX);
-      osd_newextension(fn, ".sav");
-
-      fp = fopen(fn, "wb");
-      if (NULL != fp)
-      {
-         fwrite(rominfo->sram, SRAM_BANK_LENGTH, rominfo->sram_banks, fp);
-         fclose(fp);
-         log_printf("Wrote battery RAM to %s.\n", fn);
-      }
-   }
-}
-
-/* Load battery-backed RAM from disk */
-static void rom_loadsram(rominfo_t *rominfo)
-{
-   FILE *fp;
-   char fn[PATH_MAX + 1];
-
-   ASSERT(rominfo);
-
-   if (rominfo->flags & ROM_FLAG_BATTERY)
-   {
-      strncpy(fn, rominfo->filename, PATH_MAX);
-      osd_newextension(fn, ".sav");
-
-      fp = fopen(fn, "rb");
-      if (NULL != fp)
-      {
-         fread(rominfo->sram, SRAM_BANK_LENGTH, rominfo->sram_banks, fp);
-         fclose(fp);
-         log_printf("Read battery RAM from %s.\n", fn);
-      }
-   }
-}
-
 /* Allocate space for SRAM */
 static int rom_allocsram(rominfo_t *rominfo)
 {
    /* Load up SRAM */
-   rominfo->sram = malloc(SRAM_BANK_LENGTH * rominfo->sram_banks);
+   rominfo->sram = MALLOC_MEDIA(SRAM_BANK_LENGTH * rominfo->sram_banks, "sram");
    if (NULL == rominfo->sram)
    {
       gui_sendmsg(GUI_RED, "Could not allocate space for battery RAM");
@@ -195,7 +143,7 @@ static int rom_loadrom(unsigned char **rom, rominfo_t *rominfo)
    }
    else
    {
-      rominfo->vram = malloc(VRAM_LENGTH);
+      rominfo->vram = MALLOC_MEDIA(VRAM_LENGTH, "vram");
       if (NULL == rominfo->vram)
       {
          gui_sendmsg(GUI_RED, "Could not allocate space for VRAM");
@@ -440,7 +388,7 @@ rominfo_t *rom_load(const char *filename)
    unsigned char *rom=(unsigned char*)osd_getromdata();
    rominfo_t *rominfo;
 
-   rominfo = malloc(sizeof(rominfo_t));
+   rominfo = MALLOC_MEDIA(sizeof(rominfo_t), "rominfo_t");
    if (NULL == rominfo)
       return NULL;
 
@@ -469,7 +417,7 @@ rominfo_t *rom_load(const char *filename)
 	if (rom_loadrom(&rom, rominfo))
       goto _fail;
 
-   rom_loadsram(rominfo);
+   /* battery RAM is loaded and saved a page at a time by the frontend */
 
    /* See if there's a palette we can load up */
 //   rom_checkforpal(rominfo);
@@ -500,18 +448,13 @@ void rom_free(rominfo_t **rominfo)
       log_printf("Default NES palette restored\n");
    }
 
-   rom_savesram(*rominfo);
-
+   /* rom and vrom point into the mapped file, the rest waits for eject */
    if ((*rominfo)->sram)
-      free((*rominfo)->sram);
-   if ((*rominfo)->rom)
-      free((*rominfo)->rom);
-   if ((*rominfo)->vrom)
-      free((*rominfo)->vrom);
+      FREE32((*rominfo)->sram);
    if ((*rominfo)->vram)
-      free((*rominfo)->vram);
+      FREE32((*rominfo)->vram);
 
-   free(*rominfo);
+   FREE32(*rominfo);
 
    gui_sendmsg(GUI_GREEN, "ROM freed");
 }
@@ -40,6 +40,12 @@ typedef enum
 #define  ROM_FLAG_FOURSCREEN  0x04
 #define  ROM_FLAG_VERSUS      0x08
 
+#define  ROM_BANK_LENGTH   0x4000
+#define  VROM_BANK_LENGTH  0x2000
+
+#define  SRAM_BANK_LENGTH  0x0400
+#define  VRAM_BANK_LENGTH  0x2000
+
 typedef struct rominfo_s
 {
    /* pointers to ROM and VROM */
@@ -37,6 +37,10 @@ static int active_entries = 0;
 /* read counters */
 static int pad0_readcount, pad1_readcount, ppad_readcount, ark_readcount;
 
+/* four score plugged in, pads 2/3 follow pads 0/1 */
+static int fourscore = 0;
+static uint8 fourscore_pads[2];
+
 
 static int retrieve_type(int type)
 {
@@ -53,12 +57,8 @@ static int retrieve_type(int type)
    return value;
 }
 
-static uint8 get_pad0(void)
+static uint8 mask_pad(uint8 value)
 {
-   uint8 value;
-
-   value = (uint8) retrieve_type(INP_JOYPAD0);
-
    /* mask out left/right simultaneous keypresses */
    if ((value & INP_PAD_UP) && (value & INP_PAD_DOWN))
       value &= ~(INP_PAD_UP | INP_PAD_DOWN);
@@ -66,25 +66,34 @@ static uint8 get_pad0(void)
    if ((value & INP_PAD_LEFT) && (value & INP_PAD_RIGHT))
       value &= ~(INP_PAD_LEFT | INP_PAD_RIGHT);
 
-   /* return (0x40 | value) due to bus conflicts */
-   return (0x40 | ((value >> pad0_readcount++) & 1));
+   return value;
 }
 
-static uint8 get_pad1(void)
+/* a four score shifts out 8 bits of the near pad, 8 of the far pad, then an id */
+static uint8 get_pad(int type, int far_pad, int signature, int *readcount)
 {
-   uint8 value;
+   int n = (*readcount)++;
+   int value = 0;
 
-   value = (uint8) retrieve_type(INP_JOYPAD1);
+   if (n < 8)
+      value = mask_pad((uint8) retrieve_type(type)) >> n;
+   else if (fourscore && n < 16)
+      value = mask_pad(fourscore_pads[far_pad]) >> (n - 8);
+   else if (fourscore && n < 24)
+      value = signature >> (n - 16);
 
-   /* mask out left/right simultaneous keypresses */
-   if ((value & INP_PAD_UP) && (value & INP_PAD_DOWN))
-      value &= ~(INP_PAD_UP | INP_PAD_DOWN);
+   /* return (0x40 | value) due to bus conflicts */
+   return (0x40 | (value & 1));
+}
 
-   if ((value & INP_PAD_LEFT) && (value & INP_PAD_RIGHT))
-      value &= ~(INP_PAD_LEFT | INP_PAD_RIGHT);
+static uint8 get_pad0(void)
+{
+   return get_pad(INP_JOYPAD0, 0, 0x08, &pad0_readcount);
+}
 
-   /* return (0x40 | value) due to bus conflicts */
-   return (0x40 | ((value >> pad1_readcount++) & 1));
+static uint8 get_pad1(void)
+{
+   return get_pad(INP_JOYPAD1, 1, 0x04, &pad1_readcount);
 }
 
 static uint8 get_zapper(void)
@@ -172,6 +181,14 @@ void input_event(nesinput_t *input, int state, int value)
       input->data &= ~value;  /* mask it out */
 }
 
+/* pads 2 and 3 are INP_PAD_ masks */
+void input_fourscore(int enable, int pad2, int pad3)
+{
+   fourscore = enable;
+   fourscore_pads[0] = pad2;
+   fourscore_pads[1] = pad3;
+}
+
 void input_strobe(void)
 {
    pad0_readcount = 0;
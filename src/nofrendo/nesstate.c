@@ -24,6 +24,7 @@
 */
 
 #include "stdio.h"
+#include "stddef.h"
 #include "string.h"
 #include "noftypes.h"
 #include "nesstate.h"
@@ -494,6 +495,313 @@ _error:
    return -1;
 }
 
+/* Save states in RAM: chunks through the frontend's state_put/state_find
+** rather than SNSS files, taken between frames.  Pointers into the cart are
+** stored as (region << 24) | offset so a state survives the ROM being
+** loaded somewhere else.
+*/
+#define  CHUNK_VERSION     1
+#define  PTR_UNKNOWN       0xFFFFFFFF
+
+enum
+{
+   PTR_NULL, PTR_RAM, PTR_ROM, PTR_VROM, PTR_VRAM, PTR_SRAM, PTR_REGIONS
+};
+
+typedef struct nes_chunk_s
+{
+   int32 mapper_number, rom_banks, vrom_banks;
+   int32 fiq_cycles, scanline;
+   float scanline_cycles;
+   uint8 fiq_occurred, fiq_state;
+} nes_chunk_t;
+
+typedef struct cpu_chunk_s
+{
+   uint32 mem_page[NES6502_NUMBANKS];
+   uint32 pc_reg;
+   uint8 a_reg, p_reg, x_reg, y_reg, s_reg;
+   uint8 jammed, int_pending, int_latency;
+   int32 burn_cycles;
+   uint8 ram[NES_RAMSIZE];
+} cpu_chunk_t;
+
+#define  PPU_REGS_START    offsetof(ppu_t, ctrl0)
+#define  PPU_REGS_LENGTH   (offsetof(ppu_t, render_buf) - offsetof(ppu_t, ctrl0))
+
+typedef struct ppu_chunk_s
+{
+   uint8 nametab[0x1000];
+   uint8 oam[256];
+   uint8 palette[32];
+   uint32 page[8];
+   uint8 mirror[4];
+   uint8 regs[PPU_REGS_LENGTH];
+   int32 strike_cycles;
+   uint8 vram_accessible;
+} ppu_chunk_t;
+
+static void state_regions(nes_t *machine, uint8 **base, int *len)
+{
+   rominfo_t *rominfo = machine->rominfo;
+
+   base[PTR_NULL] = NULL;
+   len[PTR_NULL] = 0;
+   base[PTR_RAM] = machine->cpu->mem_page[0];
+   len[PTR_RAM] = NES_RAMSIZE;
+   base[PTR_ROM] = rominfo->rom;
+   len[PTR_ROM] = rominfo->rom_banks * ROM_BANK_LENGTH;
+   base[PTR_VROM] = rominfo->vrom;
+   len[PTR_VROM] = rominfo->vrom_banks * VROM_BANK_LENGTH;
+   base[PTR_VRAM] = rominfo->vram;
+   len[PTR_VRAM] = rominfo->vram_banks * VRAM_BANK_LENGTH;
+   base[PTR_SRAM] = rominfo->sram;
+   len[PTR_SRAM] = rominfo->sram_banks * SRAM_BANK_LENGTH;
+}
+
+static uint32 state_ptr(nes_t *machine, const uint8 *ptr)
+{
+   uint8 *base[PTR_REGIONS];
+   int len[PTR_REGIONS], i;
+
+   if (NULL == ptr)
+      return PTR_NULL << 24;
+
+   state_regions(machine, base, len);
+   for (i = PTR_RAM; i < PTR_REGIONS; i++)
+   {
+      if (base[i] && ptr >= base[i] && ptr < base[i] + len[i])
+         return (i << 24) | (ptr - base[i]);
+   }
+
+   /* something a mapper allocated itself, leave it be on load */
+   return PTR_UNKNOWN;
+}
+
+static void state_unptr(nes_t *machine, uint8 **ptr, uint32 value)
+{
+   uint8 *base[PTR_REGIONS];
+   int len[PTR_REGIONS];
+   uint32 region = value >> 24, offset = value & 0xFFFFFF;
+
+   if (PTR_UNKNOWN == value || region >= PTR_REGIONS)
+      return;
+
+   if (PTR_NULL == region)
+   {
+      *ptr = NULL;
+      return;
+   }
+
+   state_regions(machine, base, len);
+   if (base[region] && offset < (uint32) len[region])
+      *ptr = base[region] + offset;
+}
+
+/* the chunk if it is the size and version we know, NULL if not */
+static const uint8 *state_chunk(const char *tag, int length)
+{
+   int version, len;
+   const uint8 *data = state_find(tag, &version, &len);
+
+   if (NULL == data || version > CHUNK_VERSION || len != length)
+      return NULL;
+   return data;
+}
+
+int state_savechunks(void)
+{
+   nes_chunk_t nes_chunk;
+   cpu_chunk_t *cpu_chunk;
+   ppu_chunk_t *ppu_chunk;
+   SnssMapperBlock *mapper_chunk;
+   nes_t *machine;
+   uint8 *page;
+   int room, i;
+
+   machine = nes_getcontextptr();
+   ASSERT(machine);
+
+   memset(&nes_chunk, 0, sizeof(nes_chunk));
+   nes_chunk.mapper_number = machine->rominfo->mapper_number;
+   nes_chunk.rom_banks = machine->rominfo->rom_banks;
+   nes_chunk.vrom_banks = machine->rominfo->vrom_banks;
+   nes_chunk.fiq_occurred = machine->fiq_occurred;
+   nes_chunk.fiq_state = machine->fiq_state;
+   nes_chunk.fiq_cycles = machine->fiq_cycles;
+   nes_chunk.scanline = machine->scanline;
+   nes_chunk.scanline_cycles = machine->scanline_cycles;
+   state_put("NES ", CHUNK_VERSION, &nes_chunk, sizeof(nes_chunk));
+
+   /* the bigger chunks are built in place */
+   nes6502_getcontext(machine->cpu);
+   cpu_chunk = (cpu_chunk_t *) state_begin("CPU ", CHUNK_VERSION, &room);
+   if (NULL == cpu_chunk || room < (int) sizeof(cpu_chunk_t))
+      return state_end(-1);
+
+   for (i = 0; i < NES6502_NUMBANKS; i++)
+      cpu_chunk->mem_page[i] = state_ptr(machine, machine->cpu->mem_page[i]);
+   cpu_chunk->pc_reg = machine->cpu->pc_reg;
+   cpu_chunk->a_reg = machine->cpu->a_reg;
+   cpu_chunk->p_reg = machine->cpu->p_reg;
+   cpu_chunk->x_reg = machine->cpu->x_reg;
+   cpu_chunk->y_reg = machine->cpu->y_reg;
+   cpu_chunk->s_reg = machine->cpu->s_reg;
+   cpu_chunk->jammed = machine->cpu->jammed;
+   cpu_chunk->int_pending = machine->cpu->int_pending;
+   cpu_chunk->int_latency = machine->cpu->int_latency;
+   cpu_chunk->burn_cycles = machine->cpu->burn_cycles;
+   memcpy(cpu_chunk->ram, machine->cpu->mem_page[0], NES_RAMSIZE);
+   state_end(sizeof(cpu_chunk_t));
+
+   ppu_getcontext(machine->ppu);
+   ppu_chunk = (ppu_chunk_t *) state_begin("PPU ", CHUNK_VERSION, &room);
+   if (NULL == ppu_chunk || room < (int) sizeof(ppu_chunk_t))
+      return state_end(-1);
+
+   memcpy(ppu_chunk->nametab, machine->ppu->nametab, sizeof(ppu_chunk->nametab));
+   memcpy(ppu_chunk->oam, machine->ppu->oam, sizeof(ppu_chunk->oam));
+   memcpy(ppu_chunk->palette, machine->ppu->palette, sizeof(ppu_chunk->palette));
+
+   /* pattern pages are stored offset by their address, undo that */
+   for (i = 0; i < 8; i++)
+   {
+      page = machine->ppu->page[i];
+      ppu_chunk->page[i] = state_ptr(machine, page ? page + (i << 10) : NULL);
+   }
+   for (i = 0; i < 4; i++)
+      ppu_chunk->mirror[i] = (machine->ppu->page[i + 8] + 0x2000 + (i << 10) - machine->ppu->nametab) >> 10;
+
+   memcpy(ppu_chunk->regs, (uint8 *) machine->ppu + PPU_REGS_START, PPU_REGS_LENGTH);
+   ppu_chunk->strike_cycles = (int32) (machine->ppu->strike_cycle - nes6502_getcycles(false));
+   ppu_chunk->vram_accessible = machine->ppu->vram_accessible;
+   state_end(sizeof(ppu_chunk_t));
+
+   mmc_getcontext(machine->mmc);
+   if (machine->mmc->intf->get_state)
+   {
+      mapper_chunk = (SnssMapperBlock *) state_begin("MMC ", CHUNK_VERSION, &room);
+      if (NULL == mapper_chunk || room < (int) sizeof(SnssMapperBlock))
+         return state_end(-1);
+      memset(mapper_chunk, 0, sizeof(SnssMapperBlock));
+      machine->mmc->intf->get_state(mapper_chunk);
+      state_end(sizeof(SnssMapperBlock));
+   }
+
+   if (machine->rominfo->vram)
+      state_put("VRAM", CHUNK_VERSION, machine->rominfo->vram, machine->rominfo->vram_banks * VRAM_BANK_LENGTH);
+   if (machine->rominfo->sram)
+      state_put("SRAM", CHUNK_VERSION, machine->rominfo->sram, machine->rominfo->sram_banks * SRAM_BANK_LENGTH);
+
+   return apu_savestate();
+}
+
+int state_loadchunks(void)
+{
+   const nes_chunk_t *nes_chunk;
+   const cpu_chunk_t *cpu_chunk;
+   const ppu_chunk_t *ppu_chunk;
+   const SnssMapperBlock *mapper_chunk;
+   const uint8 *vram_chunk = NULL, *sram_chunk = NULL;
+   SnssMapperBlock mapper_state;
+   nes_t *machine;
+   uint8 *page;
+   int i;
+
+   machine = nes_getcontextptr();
+   ASSERT(machine);
+
+   /* check everything before touching anything */
+   nes_chunk = (const nes_chunk_t *) state_chunk("NES ", sizeof(nes_chunk_t));
+   cpu_chunk = (const cpu_chunk_t *) state_chunk("CPU ", sizeof(cpu_chunk_t));
+   ppu_chunk = (const ppu_chunk_t *) state_chunk("PPU ", sizeof(ppu_chunk_t));
+   mapper_chunk = (const SnssMapperBlock *) state_chunk("MMC ", sizeof(SnssMapperBlock));
+   if (NULL == nes_chunk || NULL == cpu_chunk || NULL == ppu_chunk)
+      return -1;
+
+   if (nes_chunk->mapper_number != machine->rominfo->mapper_number
+       || nes_chunk->rom_banks != machine->rominfo->rom_banks
+       || nes_chunk->vrom_banks != machine->rominfo->vrom_banks)
+   {
+      log_printf("state is for another cart\n");
+      return -1;
+   }
+
+   if (machine->rominfo->vram)
+   {
+      vram_chunk = state_chunk("VRAM", machine->rominfo->vram_banks * VRAM_BANK_LENGTH);
+      if (NULL == vram_chunk)
+         return -1;
+   }
+   if (machine->rominfo->sram)
+   {
+      sram_chunk = state_chunk("SRAM", machine->rominfo->sram_banks * SRAM_BANK_LENGTH);
+      if (NULL == sram_chunk)
+         return -1;
+   }
+
+   machine->fiq_occurred = nes_chunk->fiq_occurred;
+   machine->fiq_state = nes_chunk->fiq_state;
+   machine->fiq_cycles = nes_chunk->fiq_cycles;
+   machine->scanline = nes_chunk->scanline;
+   machine->scanline_cycles = nes_chunk->scanline_cycles;
+
+   if (vram_chunk)
+      memcpy(machine->rominfo->vram, vram_chunk, machine->rominfo->vram_banks * VRAM_BANK_LENGTH);
+   if (sram_chunk)
+      memcpy(machine->rominfo->sram, sram_chunk, machine->rominfo->sram_banks * SRAM_BANK_LENGTH);
+
+   /* mapper registers first, some of them bank as they are set */
+   mmc_getcontext(machine->mmc);
+   if (mapper_chunk && machine->mmc->intf->set_state)
+   {
+      memcpy(&mapper_state, mapper_chunk, sizeof(mapper_state));
+      machine->mmc->intf->set_state(&mapper_state);
+   }
+
+   /* the cycle counter carries on, the apu and ppu are kept relative to it */
+   nes6502_getcontext(machine->cpu);
+   for (i = 0; i < NES6502_NUMBANKS; i++)
+      state_unptr(machine, &machine->cpu->mem_page[i], cpu_chunk->mem_page[i]);
+   machine->cpu->pc_reg = cpu_chunk->pc_reg;
+   machine->cpu->a_reg = cpu_chunk->a_reg;
+   machine->cpu->p_reg = cpu_chunk->p_reg;
+   machine->cpu->x_reg = cpu_chunk->x_reg;
+   machine->cpu->y_reg = cpu_chunk->y_reg;
+   machine->cpu->s_reg = cpu_chunk->s_reg;
+   machine->cpu->jammed = cpu_chunk->jammed;
+   machine->cpu->int_pending = cpu_chunk->int_pending;
+   machine->cpu->int_latency = cpu_chunk->int_latency;
+   machine->cpu->burn_cycles = cpu_chunk->burn_cycles;
+   memcpy(machine->cpu->mem_page[0], cpu_chunk->ram, NES_RAMSIZE);
+   nes6502_setcontext(machine->cpu);
+
+   /* the line buffer, callbacks and palette stay as they are */
+   ppu_getcontext(machine->ppu);
+   memcpy(machine->ppu->nametab, ppu_chunk->nametab, sizeof(ppu_chunk->nametab));
+   memcpy(machine->ppu->oam, ppu_chunk->oam, sizeof(ppu_chunk->oam));
+   memcpy(machine->ppu->palette, ppu_chunk->palette, sizeof(ppu_chunk->palette));
+
+   for (i = 0; i < 8; i++)
+   {
+      page = machine->ppu->page[i] ? machine->ppu->page[i] + (i << 10) : NULL;
+      state_unptr(machine, &page, ppu_chunk->page[i]);
+      machine->ppu->page[i] = page ? page - (i << 10) : NULL;
+   }
+   for (i = 0; i < 4; i++)
+      machine->ppu->page[i + 8] = machine->ppu->nametab + ((ppu_chunk->mirror[i] & 3) << 10) - (0x2000 + (i << 10));
+
+   memcpy((uint8 *) machine->ppu + PPU_REGS_START, ppu_chunk->regs, PPU_REGS_LENGTH);
+   machine->ppu->strike_cycle = nes6502_getcycles(false) + ppu_chunk->strike_cycles;
+   machine->ppu->vram_accessible = ppu_chunk->vram_accessible;
+   ppu_setcontext(machine->ppu);
+
+   /* without a usable apu chunk the sound carries on as it was */
+   apu_loadstate();
+
+   return 0;
+}
+
 /*
 ** $Log: nesstate.c,v $
 ** Revision 1.2  2001/04/27 14:37:11  neil
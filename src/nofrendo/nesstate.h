@@ -32,6 +32,10 @@ extern void state_setslot(int slot);
 extern int state_load();
 extern int state_save();
 
+/* save states in RAM, see Emu::save_state */
+extern int state_savechunks(void);
+extern int state_loadchunks(void);
+
 #endif /* _NESSTATE_H_ */
 
 /*
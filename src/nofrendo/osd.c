@@ -29,6 +29,7 @@
 
 #include "version.h"
 #include "nes.h"
+#include "nesstate.h"
 
 // TODO. this is really ugly. need to resolve with emu_nofrendo
 
@@ -236,9 +237,48 @@ int nes_emulate_init(const char* path, int width, int height)
     return 0;
 }
 
+// the frontend is switching cores, nes_create's blocks and the screen go with its arena
+void nes_emulate_exit()
+{
+    if (!_nes_p)
+        return;
+    vid_shutdown();
+    _nes_p = 0;
+}
+
 void nes_renderframe(bool draw_flag);
 extern bitmap_t *primary_buffer; //, *back_buffer = NULL;
 
+// cpu cycles fast-forwarded in polling loops since last call
+int nes_idle_cycles()
+{
+    return nes6502_getidlecycles(true);
+}
+
+// battery backed cart RAM, NULL if the cart has none
+uint8* nes_battery_ram(int* len)
+{
+    if (!_nes_p || !(_nes_p->rominfo->flags & ROM_FLAG_BATTERY))
+        return NULL;
+    *len = _nes_p->rominfo->sram_banks * 0x400;
+    return _nes_p->rominfo->sram;
+}
+
+// save states, between frames only
+int nes_save_state()
+{
+    if (!_nes_p)
+        return -1;
+    return state_savechunks();
+}
+
+int nes_load_state()
+{
+    if (!_nes_p)
+        return -1;
+    return state_loadchunks();
+}
+
 // emulate a frame, return
 uint8** nes_emulate_frame(bool draw_flag)
 {
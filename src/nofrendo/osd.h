@@ -95,6 +95,16 @@ extern void osd_getmouse(int *x, int *y, int *button);
 /* build a filename for a snapshot, return -ve for error */
 extern int osd_makesnapname(char *filename, int len);
 
+/* a byte of battery backed RAM changed */
+extern void battery_write(int offset);
+
+/* save state chunks, only valid inside Emu::save_state/load_state */
+extern uint8 *state_begin(const char *tag, int version, int *room);
+extern int state_end(int len);
+extern int state_put(const char *tag, int version, const void *data, int len);
+extern const uint8 *state_find(const char *tag, int *version, int *len);
+extern int state_get(const char *tag, int version, void *data, int len);
+
 #endif /* !NSF_PLAYER */
 
 #endif /* _OSD_H_ */
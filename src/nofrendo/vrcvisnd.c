@@ -23,22 +23,28 @@
 ** $Id: vrcvisnd.c,v 1.2 2001/04/27 14:37:11 neil Exp $
 */
 
+#include "string.h"
 #include "noftypes.h"
 #include "vrcvisnd.h"
 #include "nes_apu.h"
 
+/* output per step of volume, on a par with the 2A03 rectangles */
+#define  VRCVI_RECTANGLE_STEP    512
+#define  VRCVI_SAWTOOTH_STEP     512
+
 typedef struct vrcvirectangle_s
 {
    bool enabled;
 
    uint8 reg[3];
    
-   float accum;
+   int32 timer;
    uint8 adder;
 
    int32 freq;
    int32 volume;
    uint8 duty_flip;
+   int32 output_vol;
 } vrcvirectangle_t;
 
 typedef struct vrcvisawtooth_s
@@ -47,61 +53,93 @@ typedef struct vrcvisawtooth_s
    
    uint8 reg[3];
    
-   float accum;
+   int32 timer;
    uint8 adder;
    uint8 output_acc;
 
    int32 freq;
    uint8 volume;
+   int32 output_vol;
 } vrcvisawtooth_t;
 
 typedef struct vrcvisnd_s
 {
    vrcvirectangle_t rectangle[2];
    vrcvisawtooth_t saw;
-   float incsize;
 } vrcvisnd_t;
 
 
 static vrcvisnd_t vrcvi;
 
+/* keep a silent channel's sequencer in phase */
+INLINE void vrcvi_skip(int32 *timer, uint8 *adder, int32 freq, int32 cycles)
+{
+   int steps;
+
+   *timer -= cycles;
+   if (*timer <= 0)
+   {
+      steps = (-*timer) / freq + 1;
+      *timer += steps * freq;
+      *adder += steps;
+   }
+}
+
 /* VRCVI rectangle wave generation */
-static int32 vrcvi_rectangle(vrcvirectangle_t *chan)
+static void vrcvi_rectangle(vrcvirectangle_t *chan, uint32 cycle, int32 cycles)
 {
-   /* reg0: 0-3=volume, 4-6=duty cycle
+   /* reg0: 0-3=volume, 4-6=duty cycle, 7=digitized
    ** reg1: 8 bits of freq
    ** reg2: 0-3=high freq, 7=enable
    */
+   int32 volume = chan->enabled ? chan->volume : 0;
+   int32 edge;
+   int steps;
 
-   chan->accum -= vrcvi.incsize; /* # of clocks per wave cycle */
-   while (chan->accum < 0)
+   apu_mixext(&chan->output_vol, (chan->adder < chan->duty_flip) ? volume : 0, cycle);
+
+   /* step from one edge of the duty cycle to the next */
+   while (volume && chan->duty_flip < 16)
    {
-      chan->accum += chan->freq;
-      chan->adder = (chan->adder + 1) & 0x0F;
+      if (chan->adder < chan->duty_flip)
+         steps = chan->duty_flip - chan->adder;
+      else
+         steps = 16 - chan->adder;
+
+      edge = chan->timer + (steps - 1) * chan->freq;
+      if (edge > cycles)
+         break;
+
+      chan->adder = (chan->adder + steps) & 0x0F;
+      chan->timer = edge + chan->freq;
+      apu_mixext(&chan->output_vol, (chan->adder < chan->duty_flip) ? volume : 0, cycle + edge);
    }
 
-   /* return if not enabled */
-   if (false == chan->enabled)
-      return 0;
-
-   if (chan->adder < chan->duty_flip)
-      return -(chan->volume);
-   else
-      return chan->volume;
+   vrcvi_skip(&chan->timer, &chan->adder, chan->freq, cycles);
+   chan->adder &= 0x0F;
 }
 
 /* VRCVI sawtooth wave generation */
-static int32 vrcvi_sawtooth(vrcvisawtooth_t *chan)
+static void vrcvi_sawtooth(vrcvisawtooth_t *chan, uint32 cycle, int32 cycles)
 {
    /* reg0: 0-5=phase accumulator bits
    ** reg1: 8 bits of freq
    ** reg2: 0-3=high freq, 7=enable
    */
+   bool audible = chan->enabled && chan->volume;
 
-   chan->accum -= vrcvi.incsize; /* # of clocks per wav cycle */
-   while (chan->accum < 0)
+   apu_mixext(&chan->output_vol, audible ? (chan->output_acc >> 3) * VRCVI_SAWTOOTH_STEP : 0, cycle);
+
+   if (false == audible)
+   {
+      vrcvi_skip(&chan->timer, &chan->adder, chan->freq, cycles);
+      chan->adder %= 7;
+      chan->output_acc = chan->adder * chan->volume;
+      return;
+   }
+
+   while (chan->timer <= cycles)
    {
-      chan->accum += chan->freq;
       chan->output_acc += chan->volume;
       
       chan->adder++;
@@ -110,25 +148,21 @@ static int32 vrcvi_sawtooth(vrcvisawtooth_t *chan)
          chan->adder = 0;
          chan->output_acc = 0;
       }
-   }
 
-   /* return if not enabled */
-   if (false == chan->enabled)
-      return 0;
+      apu_mixext(&chan->output_vol, (chan->output_acc >> 3) * VRCVI_SAWTOOTH_STEP,
+                 cycle + chan->timer);
+      chan->timer += chan->freq;
+   }
 
-   return (chan->output_acc >> 3) << 9;
+   chan->timer -= cycles;
 }
 
-/* mix vrcvi sound channels together */
-static int32 vrcvi_process(void)
+/* clock vrcvi sound channels, mixing them with the apu's */
+static void vrcvi_run(uint32 cycle, int32 cycles)
 {
-   int32 output;
-
-   output = vrcvi_rectangle(&vrcvi.rectangle[0]);
-   output += vrcvi_rectangle(&vrcvi.rectangle[1]);
-   output += vrcvi_sawtooth(&vrcvi.saw);
-
-   return output;
+   vrcvi_rectangle(&vrcvi.rectangle[0], cycle, cycles);
+   vrcvi_rectangle(&vrcvi.rectangle[1], cycle, cycles);
+   vrcvi_sawtooth(&vrcvi.saw, cycle, cycles);
 }
 
 /* write to registers */
@@ -141,8 +175,8 @@ static void vrcvi_write(uint32 address, uint8 value)
    case 0x9000:
    case 0xA000:
       vrcvi.rectangle[chan].reg[0] = value;
-      vrcvi.rectangle[chan].volume = (value & 0x0F) << 8;
-      vrcvi.rectangle[chan].duty_flip = (value >> 4) + 1;
+      vrcvi.rectangle[chan].volume = (value & 0x0F) * VRCVI_RECTANGLE_STEP;
+      vrcvi.rectangle[chan].duty_flip = (value & 0x80) ? 16 : ((value >> 4) & 7) + 1;
       break;
 
    case 0x9001:
@@ -183,11 +217,8 @@ static void vrcvi_write(uint32 address, uint8 value)
 static void vrcvi_reset(void)
 {
    int i;
-   apu_t apu;
 
-   /* get the phase period from the apu */
-   apu_getcontext(&apu);
-   vrcvi.incsize = apu.cycle_rate;
+   memset(&vrcvi, 0, sizeof(vrcvi));
 
    /* preload regs */
    for (i = 0; i < 3; i++)
@@ -200,9 +231,9 @@ static void vrcvi_reset(void)
 
 static apu_memwrite vrcvi_memwrite[] =
 {
-   { 0x9000, 0x9002, vrcvi_write }, /* vrc6 */
-   { 0xA000, 0xA002, vrcvi_write },
-   { 0xB000, 0xB002, vrcvi_write },
+   { 0x9000, 0x9002, apu_write }, /* vrc6 */
+   { 0xA000, 0xA002, apu_write },
+   { 0xB000, 0xB002, apu_write },
    {     -1,     -1, NULL }
 };
 
@@ -211,7 +242,9 @@ apuext_t vrcvi_ext =
    NULL, /* no init */
    NULL, /* no shutdown */
    vrcvi_reset,
-   vrcvi_process,
+   vrcvi_write,
+   vrcvi_run,
+   NULL, /* no frame sequencer */
    NULL, /* no reads */
    vrcvi_memwrite
 };
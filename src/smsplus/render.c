@@ -7,18 +7,26 @@ void (*render_bg)(int line);
 /* Pointer to output buffer */
 uint8 *linebuf;
 
-//Each tile takes up 8*8=64 bytes. We have 512 tiles * 4 attribs, so 2K tiles max.
-#define CACHEDTILES 512
 #define ALIGN_DWORD 1 //esp doesn't support unaligned word writes
 
-int16 cachePtr[512*4];				//(tile+attr<<9) -> cache tile store index (i<<6); -1 if not cached
-uint8 cacheStore[CACHEDTILES*64];	//Tile store
-uint8 cacheStoreUsed[CACHEDTILES];	//Marks if a tile is used
+//A VRAM write only bumps the tile's generation; stale cache tiles are noticed and
+//regenerated when next drawn. Slots come off a free list, then from a clock
+//(second chance LRU) sweep.
+int16 cachePtr[512*4];				//(tile+attr<<9) -> cache tile store index; -1 if not cached
+uint8 *cacheStore;					//Tile store, CACHEDTILES*64 from the frontend
+int16 cacheOwner[CACHEDTILES];		//(tile+attr<<9) a slot holds; -1 if free
+uint16 cacheGen[CACHEDTILES];		//tileGen of the owner when the slot was generated
+uint8 cacheRef[CACHEDTILES];		//Set on use, cleared as the clock hand passes
+int16 cacheFree[CACHEDTILES];		//Free slots
+int cacheFreeCount=0;
+int cacheClock=0;
 
-uint8 is_vram_dirty;
+uint16 tileGen[512];				//Bumped when a tile's VRAM changes
+uint8 tileCached[512];				//Set if a slot holds the current generation
+
+t_tile_cache_stats tile_cache_stats;
 
-int cacheKillPtr=0;
-int freePtr=0;
+uint8 is_vram_dirty;
 
 /* Pixel look-up table */
 //uint8 lut[0x10000];
@@ -47,48 +55,66 @@ void render_reset(void);
 void render_init(void);
 
 void vramMarkTileDirty(int index) {
-	int i=index;
-	while (i<0x800) {
-		if (cachePtr[i]!=-1) {
-			freePtr=cachePtr[i]>>6;
-//			printf("Freeing cache loc %d for tile %d\n", freePtr, index);
-			cacheStoreUsed[freePtr]=0;
-			cachePtr[i]=-1;
-		}
-		i+=0x200;
+	//Only the first write since the tile was last generated needs a new generation
+	if (tileCached[index]) {
+		tileCached[index]=0;
+		//A wrapped generation could match a stale slot, so start the cache over
+		if (++tileGen[index]==0) vramMarkAllDirty();
 	}
 }
 
+void vramMarkAllDirty(void) {
+	int i;
+	for (i=0; i<512*4; i++) cachePtr[i]=-1;
+	for (i=0; i<CACHEDTILES; i++) {
+		cacheOwner[i]=-1;
+		cacheRef[i]=0;
+		cacheFree[i]=CACHEDTILES-1-i;
+	}
+	cacheFreeCount=CACHEDTILES;
+	cacheClock=0;
+	memset(tileCached, 0, sizeof(tileCached));
+}
+
+static int allocCache(void) {
+	int i;
+	if (cacheFreeCount) return cacheFree[--cacheFreeCount];
+
+	//Out of cache. Kill the first tile not used since the hand last passed it.
+	for (;;) {
+		i=cacheClock;
+		if (++cacheClock==CACHEDTILES) cacheClock=0;
+		if (!cacheRef[i]) break;
+		cacheRef[i]=0;
+	}
+	cachePtr[cacheOwner[i]]=-1;
+	tile_cache_stats.evictions++;
+	return i;
+}
+
 uint8 *getCache(int tile, int attr) {
-    int n, i, x, y, c;
+    int i, x, y, c;
     int b0, b1, b2, b3;
     int i0, i1, i2, i3;
-	int p;
+	int key=tile+(attr<<9);
 	//See if we have this in cache.
-	if (cachePtr[tile+(attr<<9)]!=-1) return &cacheStore[cachePtr[tile+(attr<<9)]];
-
-	//Nope! Generate cache tile.
-	//Find free cache idx first.
-	do {
-		i=freePtr;
-		n=0;
-		while (cacheStoreUsed[i] && n<CACHEDTILES) {
-			i++;
-			n++;
-			if (i==CACHEDTILES) i=0;
-		}
+	i=cachePtr[key];
+	if (i!=-1 && cacheGen[i]==tileGen[tile]) {
+		cacheRef[i]=1;
+		tile_cache_stats.hits++;
+		return &cacheStore[i<<6];
+	}
 
-		if (n==CACHEDTILES) {
-			//printf("Eek, tile cache overflow\n");
-			//Crap, out of cache. Kill a tile.
-			vramMarkTileDirty(cacheKillPtr++);
-			if (cacheKillPtr>=512) cacheKillPtr=0;
-			i=freePtr;
-		}
-	} while (cacheStoreUsed[i]);
-	//Okay, somehow we have a free cache tile in i now.
-	cacheStoreUsed[i]=1;
-	cachePtr[tile+(attr<<9)]=i<<6;
+	//Nope! Generate cache tile, in place if we hold a stale one.
+	tile_cache_stats.misses++;
+	if (i==-1) {
+		i=allocCache();
+		cachePtr[key]=i;
+		cacheOwner[i]=key;
+	}
+	cacheGen[i]=tileGen[tile];
+	cacheRef[i]=1;
+	tileCached[tile]=1;
 
 //	printf("Generating cache loc %d for tile %d attr %d\n", i, tile, attr);
 	//Calculate tile
@@ -115,6 +141,48 @@ uint8 *getCache(int tile, int attr) {
 }
 
 
+//Background tiles of the name table row drawn last, by column. The lines of
+//one render_lines() run see the same VRAM and registers, so the other lines
+//of a row reuse them, provided no cache slot has been evicted since.
+static uint8 *rowTile[33];
+static uint32 rowAtex[33];
+static int rowKey=-1;
+static uint32 rowEvictions;
+
+//Pattern and attribute bits of a background column, looked up unless the
+//row is being reused
+static __inline__ uint8 *rowFetch(int reuse, int column, uint16 *nt, int index, uint32 *atex_mask) {
+	uint16 attr;
+	if (reuse) {
+		*atex_mask=rowAtex[column];
+		return rowTile[column];
+	}
+	attr=nt[index & 0x1F];
+#ifndef LSB_FIRST
+	attr=(((attr & 0xFF) << 8) | ((attr & 0xFF00) >> 8));
+#endif
+	*atex_mask=rowAtex[column]=atex[(attr >> 11) & 3];
+	return rowTile[column]=getCache((attr&0x1ff), (attr>>9)&3);
+}
+
+//Start reusing a row if it is the one drawn last, returns non-zero if so
+static int rowBegin(int key, uint32 *evictions) {
+	*evictions=tile_cache_stats.evictions;
+	return key==rowKey && *evictions==rowEvictions;
+}
+
+//Keep the row just looked up for the next line
+static void rowEnd(int key, uint32 evictions) {
+	rowKey=key;
+	rowEvictions=evictions;
+}
+
+//Sprites that cross the lines of the render_lines() run, in front-to-back
+//order, so each line only looks at those instead of the whole table
+static uint8 objList[64];
+static int objCount=0;
+
+
 /* Macros to access memory 32-bits at a time (from MAME's drawgfx.c) */
 
 #ifdef ALIGN_DWORD
@@ -232,8 +300,8 @@ void render_reset(void)
     }
 
     /* Invalidate pattern cache */
-	for (i=0; i<512*4; i++) cachePtr[i]=-1;
-	for (i=0; i<512; i++) vramMarkTileDirty(i);
+	vramMarkAllDirty();
+	memset(&tile_cache_stats, 0, sizeof(tile_cache_stats));
 
     /* Set up viewport size */
     if(IS_GG)
@@ -260,7 +328,7 @@ void render_reset(void)
 static void render_332(const uint8_t* buf, int line);
 static uint8_t linebuf_[256];
 
-void render_line(int line)
+static void render_line(int line)
 {
     /* Ensure we're within the viewport range */
     if((line < vp_vstart) || (line >= vp_vend)) return;
@@ -294,6 +362,56 @@ void render_line(int line)
 }
 
 
+/* Find the sprites that cross a run of lines */
+static void render_obj_list(int first, int last)
+{
+    int i;
+    int height = (vdp.reg[1] & 0x02) ? 16 : 8;
+    uint8 *st = (uint8 *)&vdp.vram[vdp.satb];
+
+    if(vdp.reg[1] & 0x01)
+    {
+        height *= 2;
+    }
+
+    objCount = 0;
+    for(i = 0; i < 64; i += 1)
+    {
+        int yp = st[i];
+
+        /* End of sprite list marker? */
+        if(yp == 208) return;
+
+        /* Actual Y position is +1, wrapped for sprites > 240 */
+        yp += 1;
+        if(yp > 240) yp -= 256;
+
+        if((last >= yp) && (first < (yp + height)))
+        {
+            objList[objCount++] = i;
+        }
+    }
+}
+
+
+/* Draw a run of lines the CPU doesn't touch the VDP in between */
+void render_lines(int first, int last)
+{
+    /* Only lines in the viewport are drawn */
+    if(first < vp_vstart) first = vp_vstart;
+    if(last >= vp_vend) last = vp_vend - 1;
+    if(first > last) return;
+
+    rowKey = -1;
+    render_obj_list(first, last);
+
+    for(; first <= last; first += 1)
+    {
+        render_line(first);
+    }
+}
+
+
 /* Draw the Master System background */
 void render_bg_sms(int line)
 {
@@ -302,7 +420,6 @@ void render_bg_sms(int line)
     int v_row  = (v_line & 7) << 3;
     int hscroll = ((vdp.reg[0] & 0x40) && (line < 0x10)) ? 0 : (0x100 - vdp.reg[8]);
     int column = vp_hstart;
-    uint16 attr;
     uint16 *nt = (uint16 *)&vdp.vram[vdp.ntab + ((v_line >> 3) << 6)];
     int nt_scroll = (hscroll >> 3);
     int shift = (hscroll & 7);
@@ -310,22 +427,20 @@ void render_bg_sms(int line)
     uint32 *cache_ptr;
     uint32 *linebuf_ptr = (uint32 *)&linebuf[0 - shift];
 	uint8 *ctp;
+    uint32 evictions;
+    int key = (v_line >> 3) | ((line >> 3) << 5) | (hscroll << 10);
+    int reuse = rowBegin(key, &evictions);
 
     /* Draw first column (clipped) */
     if(shift)
     {
         int x, c, a;
 
-        attr = nt[(column + nt_scroll) & 0x1F];
-
-#ifndef LSB_FIRST
-        attr = (((attr & 0xFF) << 8) | ((attr & 0xFF00) >> 8));
-#endif
-        a = (attr >> 7) & 0x30;
+		ctp=rowFetch(reuse, column, nt, column + nt_scroll, &atex_mask);
+        a = atex_mask & 0x30;
 
         for(x = shift; x < 8; x += 1)
         {
-			ctp=getCache((attr&0x1ff), (attr>>9)&3);
             c = ctp[(v_row) | (x)];
             linebuf[(0 - shift) + (x)  ] = ((c) | (a));
         }
@@ -344,17 +459,9 @@ void render_bg_sms(int line)
             nt = (uint16 *)&vdp.vram[((vdp.reg[2] << 10) & 0x3800) + ((line >> 3) << 6)];
         }
 
-        /* Get name table attribute word */
-        attr = nt[(column + nt_scroll) & 0x1F];
-
-#ifndef LSB_FIRST
-        attr = (((attr & 0xFF) << 8) | ((attr & 0xFF00) >> 8));
-#endif
-        /* Expand priority and palette bits */
-        atex_mask = atex[(attr >> 11) & 3];
-
-        /* Point to a line of pattern data in cache */
-		ctp=getCache((attr&0x1ff), (attr>>9)&3);
+        /* Point to a line of pattern data in cache, with the priority
+           and palette bits expanded */
+		ctp=rowFetch(reuse, column, nt, column + nt_scroll, &atex_mask);
         cache_ptr = (uint32 *)&ctp[(v_row)];
         
         /* Copy the left half, adding the attribute bits in */
@@ -371,20 +478,17 @@ void render_bg_sms(int line)
 
         char *p = &linebuf[(0 - shift)+(column << 3)];
 
-        attr = nt[(column + nt_scroll) & 0x1F];
-
-#ifndef LSB_FIRST
-        attr = (((attr & 0xFF) << 8) | ((attr & 0xFF00) >> 8));
-#endif
-        a = (attr >> 7) & 0x30;
+		ctp=rowFetch(reuse, column, nt, column + nt_scroll, &atex_mask);
+        a = atex_mask & 0x30;
 
         for(x = 0; x < shift; x += 1)
         {
-			ctp=getCache((attr&0x1ff), (attr>>9)&3);
             c = ctp[(v_row) | (x)];
             p[x] = ((c) | (a));
         }
     }
+
+    rowEnd(key, evictions);
 }
 
 
@@ -395,28 +499,22 @@ void render_bg_gg(int line)
     int v_row  = (v_line & 7) << 3;
     int hscroll = (0x100 - vdp.reg[8]);
     int column;
-    uint16 attr;
     uint16 *nt = (uint16 *)&vdp.vram[vdp.ntab + ((v_line >> 3) << 6)];
     int nt_scroll = (hscroll >> 3);
     uint32 atex_mask;
     uint32 *cache_ptr;
     uint32 *linebuf_ptr = (uint32 *)&linebuf[0 - (hscroll & 7)];
 	uint8_t *ctp;
+    uint32 evictions;
+    int key = (v_line >> 3) | (hscroll << 10);
+    int reuse = rowBegin(key, &evictions);
 
     /* Draw a line of the background */
     for(column = vp_hstart; column <= vp_hend; column += 1)
     {
-        /* Get name table attribute word */
-        attr = nt[(column + nt_scroll) & 0x1F];
-
-#ifndef LSB_FIRST
-        attr = (((attr & 0xFF) << 8) | ((attr & 0xFF00) >> 8));
-#endif
-        /* Expand priority and palette bits */
-        atex_mask = atex[(attr >> 11) & 3];
-
-        /* Point to a line of pattern data in cache */
-		ctp=getCache((attr&0x1ff), (attr>>9)&3);
+        /* Point to a line of pattern data in cache, with the priority
+           and palette bits expanded */
+		ctp=rowFetch(reuse, column, nt, column + nt_scroll, &atex_mask);
         cache_ptr = (uint32 *)&ctp[(v_row)];
 
         /* Copy the left half, adding the attribute bits in */
@@ -425,13 +523,15 @@ void render_bg_gg(int line)
         /* Copy the right half, adding the attribute bits in */
         write_dword( &linebuf_ptr[(column << 1) | (1)], read_dword( &cache_ptr[1] ) | (atex_mask));
     }
+
+    rowEnd(key, evictions);
 }
 
 
 /* Draw sprites */
 void render_obj(int line)
 {
-    int i;
+    int i, j;
 	uint8_t *ctp;
 
     /* Sprite count for current line (8 max.) */
@@ -451,14 +551,11 @@ void render_obj(int line)
         height *= 2;
     }
 
-    /* Draw sprites in front-to-back order */
-    for(i = 0; i < 64; i += 1)
+    /* Draw sprites of the run in front-to-back order */
+    for(j = 0; j < objCount; j += 1)
     {
         /* Sprite Y position */
-        int yp = st[i];
-
-        /* End of sprite list marker? */
-        if(yp == 208) return;
+        int yp = st[i = objList[j]];
 
         /* Actual Y position is +1 */
         yp += 1;
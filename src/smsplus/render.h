@@ -9,17 +9,32 @@
 #define BACKDROP_COLOR      (0x10 | (vdp.reg[7] & 0x0F))
 
 
+/* Pattern cache counters, for tuning CACHEDTILES */
+typedef struct
+{
+    uint32 hits;
+    uint32 misses;      /* includes regenerating tiles changed in VRAM */
+    uint32 evictions;
+}t_tile_cache_stats;
+
+extern t_tile_cache_stats tile_cache_stats;
+
+//Each tile takes up 8*8=64 bytes. We have 512 tiles * 4 attribs, so 2K tiles max.
+#define CACHEDTILES 512
+extern uint8 *cacheStore;
+
 /* Function prototypes */
 void render_init(void);
 void render_reset(void);
 void render_bg_gg(int line);
 void render_bg_sms(int line);
 void render_obj(int line);
-void render_line(int line);
+void render_lines(int first, int last);
 void update_cache(void);
 void palette_sync(int index);
 void remap_8_to_16(int line);
 
 void vramMarkTileDirty(int tile);
+void vramMarkAllDirty(void);
 
 #endif /* _RENDER_H_ */
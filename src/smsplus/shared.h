@@ -26,6 +26,7 @@
 #include "vdp.h"
 #include "render.h"
 #include "sn76496.h"
+#include "ym2413.h"
 #include "system.h"
 
 char unalChar(const char *adr);
@@ -1,10 +1,44 @@
 
 #include "shared.h"
-void ym2413_write(int chip, int offset, int data);
 
 /* SMS context */
 t_sms sms;
 
+/* The Z80 runs in batches of line slices, up to the next line the VDP
+   interrupts on. vdp_run() and rendering for the lines of a batch are
+   caught up when it ends, or before the Z80 gets to access the VDP, so
+   the lines drawn together all see the same VRAM and registers. */
+static int sched_base;      /* Line of the first slice of the batch */
+static int sched_line;      /* Next line to run the VDP for */
+static int sched_skip;      /* Frame is not drawn */
+
+/* Handle VDP line events and draw up to and including a line */
+static void sms_sync_line(int line)
+{
+    int first = sched_line;
+
+    while(sched_line <= line)
+    {
+        vdp.line = sched_line++;
+        vdp_run();
+    }
+    if(!sched_skip && first <= line) render_lines(first, line);
+}
+
+/* Bring the VDP up to the line the Z80 is on; if the access can change
+   when the VDP interrupts, end the batch with the current line */
+void sms_sync(int stop)
+{
+    sms_sync_line(sched_base + z80_slice);
+    if(stop) z80_stop();
+}
+
+/* Line the Z80 is currently running */
+int sms_line(void)
+{
+    return sched_base + z80_slice;
+}
+
 /* Run the virtual console emulation for one frame */
 void sms_frame(int skip_render)
 {
@@ -32,49 +66,29 @@ void sms_frame(int skip_render)
 
     if(snd.log) snd.callback(0x00);
 
-    for(vdp.line = 0; vdp.line < 262; vdp.line += 1)
-    {
-        /* Handle VDP line events */
-        vdp_run();
-
-        /* Draw the current frame */
-        if(!skip_render) render_line(vdp.line);
+    /* Drop the timing of FM writes from a frame whose audio was not used */
+    if(sms.use_fm) ym2413_flush();
 
-        /* Run the Z80 for a line */
-        z80_execute(227);
-    }
+    sched_skip = skip_render;
+    sched_line = 0;
+    sched_base = 0;
 
-    /* Update the emulated sound stream */
-    if(snd.enabled) 
+    while(sched_base < LINES_PER_FRAME)
     {
-/*
-        int count;
+        /* Handle VDP line events and draw the first line of the batch */
+        sms_sync_line(sched_base);
 
-        SN76496Update(0, snd.psg_buffer, snd.bufsize, sms.psg_mask);
+        /* Run the Z80 a line at a time until the VDP interrupts again */
+        sched_base += z80_execute_slices(227, vdp_next_irq(sched_base + 1) - sched_base);
+    }
 
-//        if(sms.use_fm)
-//        {
-//            int i;
-//            for(i = 0; i < snd.bufsize; i++)
-//            {
-//                snd.fm_buffer[i] = OPLL_calc(opll);
-//            }
-//        }
+    /* Catch up with the rest of the frame */
+    sms_sync_line(LINES_PER_FRAME - 1);
+    vdp.line = LINES_PER_FRAME;
 
-        for(count = 0; count < snd.bufsize; count += 1)
-        {
-            signed short left   = 0;
-            signed short right  = 0;
-//            left = right = snd.fm_buffer[count];
-			left=0;
-            left  += snd.psg_buffer[0][count];
-            right += snd.psg_buffer[1][count];
-            snd.buffer[0][count] = left;
-            snd.buffer[1][count] = right;
-        }
-*/
-        SN76496Update(0, snd.buffer, snd.bufsize, sms.psg_mask);
-    }
+    /* The SN76489 and YM2413 are rendered by the frontend when it pulls
+       the frame's audio, straight into its output buffer (see
+       SN76496Update and ym2413_update) */
 }
 
 
@@ -131,7 +145,12 @@ void cpu_reset(void)
 /* Write to memory */
 void cpu_writemem16(int address, int data)
 {
-    cpu_writemap[(address >> 13)][(address & 0x1FFF)] = data;
+    uint8 *p = &cpu_writemap[(address >> 13)][(address & 0x1FFF)];
+
+    /* Cart RAM paged in at 8000-BFFF is battery backed */
+    if((address & 0xC000) == 0x8000 && (sms.fcr[0] & 8) && *p != data)
+        battery_write(p - sms.sram);
+    *p = data;
     if(address >= 0xFFFC) sms_mapper_w(address & 3, data);
 }
 
@@ -165,11 +184,13 @@ void cpu_writeport(int port, int data)
             break;
 
         case 0xBE: /* VDP DATA */
+            sms_sync(1);
             vdp_data_w(data);
             break;
 
         case 0xBD: /* VDP CTRL */ 
         case 0xBF:
+            sms_sync(1);
             vdp_ctrl_w(data);
             break;
 
@@ -209,6 +230,7 @@ int cpu_readport(int port)
             return (0x00);
     
         case 0x7E: /* V COUNTER */
+            sms_sync(0);
             return (vdp_vcounter_r());
             break;
     
@@ -247,10 +269,12 @@ int cpu_readport(int port)
             return ((temp & 0x3F) | (sms.port_3F & 0xC0));
 
         case 0xBE: /* VDP DATA */
+            sms_sync(1);
             return (vdp_data_r());
     
         case 0xBD:
         case 0xBF: /* VDP CTRL */
+            sms_sync(1);
             return (vdp_ctrl_r());
 
         case 0xF2: /* YM2413 DETECT */
@@ -261,6 +285,28 @@ int cpu_readport(int port)
 }
 
 
+/* Returns non-zero if a port reads the same until the next line once read */
+int cpu_pollport(int port)
+{
+    switch(port & 0xFF)
+    {
+        case 0x00: /* INPUT #2 */
+        case 0x01: /* GG SIO */
+        case 0x02:
+        case 0x03:
+        case 0x04:
+        case 0x05:
+        case 0x7E: /* V COUNTER */
+        case 0xBD:
+        case 0xBF: /* VDP CTRL */
+        case 0xC0: /* INPUT #0 */
+        case 0xC1: /* INPUT #1 */
+        case 0xDC:
+        case 0xDD:
+            return (1);
+    }
+    return (0);
+}
 void sms_mapper_w(int address, int data)
 {
     /* Calculate ROM page index */
@@ -29,6 +29,8 @@ extern t_sms sms;
 
 /* Function prototypes */
 void sms_frame(int skip_render);
+void sms_sync(int stop);
+int  sms_line(void);
 void sms_init(void);
 void sms_reset(void);
 int  sms_irq_callback(int param);
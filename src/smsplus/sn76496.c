@@ -80,101 +80,133 @@ void SN76496Write(int chip,int data)
 	}
 }
 
-void SN76496Update(int chip,INT16 *buffer[2],int length, unsigned char mask)
+/* Advance tone channel c by one sample, returning how long (in STEP units) */
+/* the square wave spent in the 1 position. */
+static inline int SN76496Tone(t_SN76496 *R,int c)
 {
-    int i, j;
-    int buffer_index = 0;
-    t_SN76496 *R = &sn[chip];
-
-	/* If the volume is 0, increase the counter */
-	for (i = 0;i < 4;i++)
+	int vol = 0;
+
+	if (R->Output[c]) vol += R->Count[c];
+	R->Count[c] -= STEP;
+	/* Period[c] is the half period of the square wave. Here, in each */
+	/* loop I add Period[c] twice, so that at the end of the loop the */
+	/* square wave is in the same status (0 or 1) it was at the start. */
+	/* vol is also incremented by Period[c], since the wave has been 1 */
+	/* exactly half of the time, regardless of the initial position. */
+	/* If we exit the loop in the middle, Output[c] has to be inverted */
+	/* and vol incremented only if the exit status of the square */
+	/* wave is 1. */
+	while (R->Count[c] <= 0)
 	{
-		if (R->Volume[i] == 0)
+		R->Count[c] += R->Period[c];
+		if (R->Count[c] > 0)
 		{
-			/* note that I do count += length, NOT count = length + 1. You might think */
-			/* it's the same since the volume is 0, but doing the latter could cause */
-			/* interferencies when the program is rapidly modulating the volume. */
-			if (R->Count[i] <= length*STEP) R->Count[i] += length*STEP;
+			R->Output[c] ^= 1;
+			if (R->Output[c]) vol += R->Period[c];
+			break;
 		}
+		R->Count[c] += R->Period[c];
+		vol += R->Period[c];
 	}
+	if (R->Output[c]) vol -= R->Count[c];
 
-	while (length > 0)
+	return vol;
+}
+
+/* Same for the noise channel, clocking the shift register as it goes. */
+static inline int SN76496Noise(t_SN76496 *R)
+{
+	int vol = 0;
+	int left = STEP;
+
+	do
 	{
-		int vol[4];
-        unsigned int out[2];
-		int left;
+		int nextevent;
 
 
-		/* vol[] keeps track of how long each square wave stays */
-		/* in the 1 position during the sample period. */
-		vol[0] = vol[1] = vol[2] = vol[3] = 0;
+		if (R->Count[3] < left) nextevent = R->Count[3];
+		else nextevent = left;
 
-		for (i = 0;i < 3;i++)
+		if (R->Output[3]) vol += R->Count[3];
+		R->Count[3] -= nextevent;
+		if (R->Count[3] <= 0)
 		{
-			if (R->Output[i]) vol[i] += R->Count[i];
-			R->Count[i] -= STEP;
-			/* Period[i] is the half period of the square wave. Here, in each */
-			/* loop I add Period[i] twice, so that at the end of the loop the */
-			/* square wave is in the same status (0 or 1) it was at the start. */
-			/* vol[i] is also incremented by Period[i], since the wave has been 1 */
-			/* exactly half of the time, regardless of the initial position. */
-			/* If we exit the loop in the middle, Output[i] has to be inverted */
-			/* and vol[i] incremented only if the exit status of the square */
-			/* wave is 1. */
-			while (R->Count[i] <= 0)
-			{
-				R->Count[i] += R->Period[i];
-				if (R->Count[i] > 0)
-				{
-					R->Output[i] ^= 1;
-					if (R->Output[i]) vol[i] += R->Period[i];
-					break;
-				}
-				R->Count[i] += R->Period[i];
-				vol[i] += R->Period[i];
-			}
-			if (R->Output[i]) vol[i] -= R->Count[i];
+			if (R->RNG & 1) R->RNG ^= R->NoiseFB;
+			R->RNG >>= 1;
+			R->Output[3] = R->RNG & 1;
+			R->Count[3] += R->Period[3];
+			if (R->Output[3]) vol += R->Period[3];
 		}
+		if (R->Output[3]) vol -= R->Count[3];
 
-		left = STEP;
-		do
-		{
-			int nextevent;
+		left -= nextevent;
+	} while (left > 0);
 
+	return vol;
+}
 
-			if (R->Count[3] < left) nextevent = R->Count[3];
-			else nextevent = left;
+/* Render straight into the final centered mono stream. Silent channels are */
+/* not stepped at all, the Game Gear stereo mask is only resolved when it */
+/* actually pans something, and the DC blocker runs in the same pass. */
+void SN76496Update(int chip,INT16 *buffer,int length, unsigned char mask)
+{
+    int i, j, n;
+    int active[4];
+    int stereo = (mask != 0xFF);
+    t_SN76496 *R = &sn[chip];
 
-			if (R->Output[3]) vol[3] += R->Count[3];
-			R->Count[3] -= nextevent;
-			if (R->Count[3] <= 0)
-			{
-				if (R->RNG & 1) R->RNG ^= R->NoiseFB;
-				R->RNG >>= 1;
-				R->Output[3] = R->RNG & 1;
-				R->Count[3] += R->Period[3];
-				if (R->Output[3]) vol[3] += R->Period[3];
-			}
-			if (R->Output[3]) vol[3] -= R->Count[3];
+	/* A channel at volume 0 adds nothing to the mix, so skip it and */
+	/* just leave its counter where the sample loop would have: it */
+	/* only ever counted down without reaching 0 (see the note below). */
+	n = 0;
+	for (i = 0;i < 4;i++)
+	{
+		if (R->Volume[i] == 0)
+		{
+			/* note that the counter is not reset here. You might think */
+			/* it doesn't matter since the volume is 0, but doing so could */
+			/* cause interferencies when the program is rapidly modulating */
+			/* the volume. */
+			if (R->Count[i] > length*STEP) R->Count[i] -= length*STEP;
+		}
+		else
+			active[n++] = i;
+	}
 
-			left -= nextevent;
-		} while (left > 0);
+	while (length > 0)
+	{
+        unsigned int out[2];
+        int s;
 
         out[0] = out[1] = 0;
-        for(j = 0; j < 4; j += 1)
+        for(j = 0; j < n; j += 1)
         {
-            int k = vol[j] * R->Volume[j];
-            if(mask & (1 << (4+j))) out[0] += k;
-            if(mask & (1 << (0+j))) out[1] += k;
+            int k;
+
+            i = active[j];
+            k = (i < 3 ? SN76496Tone(R, i) : SN76496Noise(R)) * R->Volume[i];
+            if(!stereo)
+                out[0] += k;
+            else
+            {
+                if(mask & (1 << (4+i))) out[0] += k;
+                if(mask & (1 << (0+i))) out[1] += k;
+            }
         }
 
         if(out[0] > MAX_OUTPUT * STEP) out[0] = MAX_OUTPUT * STEP;
-        if(out[1] > MAX_OUTPUT * STEP) out[1] = MAX_OUTPUT * STEP;
-        buffer[0][buffer_index] = out[0] / STEP;
-        buffer[1][buffer_index] = out[1] / STEP;
+        s = out[0] / STEP;
+        if(stereo)
+        {
+            /* Fold left and right together */
+            if(out[1] > MAX_OUTPUT * STEP) out[1] = MAX_OUTPUT * STEP;
+            s = (s + out[1] / STEP) >> 1;
+        }
 
-        /* Next sample set */
-        buffer_index += 1;
+        /* Remove the DC offset of the unipolar output. Both s and the */
+        /* level are 0..MAX_OUTPUT, so the difference needs no clipping. */
+        R->DCLevel = (R->DCLevel * 31 + s) >> 5;
+        *buffer++ = s - R->DCLevel;
 
 		length--;
 	}
@@ -237,6 +269,7 @@ int SN76496_init(int chip,int clock,int volume,int sample_rate)
 	}
 	R->RNG = NG_PRESET;
 	R->Output[3] = R->RNG & 1;
+	R->DCLevel = 0;
 
     SN76496_set_gain(0, (volume >> 8) & 0xFF);
 
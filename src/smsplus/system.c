@@ -23,12 +23,18 @@ t_bitmap bitmap;
 t_cart cart;                
 t_snd snd;
 t_input input;
-//OPLL *opll;
 
-struct
+/* YM2413 writes are queued with the sample they land on, and played back
+   between blocks of FM synthesis when the frame's audio is pulled */
+#define FM_QUEUE_SIZE       (128)
+
+static struct
 {
-    char reg[64];
-}ym2413;
+    uint16 sample;
+    uint8 offset;
+    uint8 data;
+}fm_queue[FM_QUEUE_SIZE];
+static int fm_queued;
 
 void emu_system_init(int rate)
 {
@@ -66,33 +72,12 @@ void audio_init(int rate)
     /* Calculate buffer size in samples */
     snd.bufsize = rate == 15720 ? 262 : 312;   // EWWWW
 
-    /* Sound output */
-    snd.buffer[0] = (signed short int *)malloc(snd.bufsize * 2);
-    snd.buffer[1] = (signed short int *)malloc(snd.bufsize * 2);
-    if(!snd.buffer[0] || !snd.buffer[1]) return;
-    memset(snd.buffer[0], 0, snd.bufsize * 2);
-    memset(snd.buffer[1], 0, snd.bufsize * 2);
-
-    /* YM2413 sound stream */
-//    snd.fm_buffer = (signed short int *)malloc(snd.bufsize * 2);
-//    if(!snd.fm_buffer) return;
-//    memset(snd.fm_buffer, 0, snd.bufsize * 2);
-
-    /* SN76489 sound stream */
-//    snd.psg_buffer[0] = (signed short int *)malloc(snd.bufsize * 2);
-//    snd.psg_buffer[1] = (signed short int *)malloc(snd.bufsize * 2);
-//    if(!snd.psg_buffer[0] || !snd.psg_buffer[1]) return;
-//    memset(snd.psg_buffer[0], 0, snd.bufsize * 2);
-//    memset(snd.psg_buffer[1], 0, snd.bufsize * 2);
-
     /* Set up SN76489 emulation */
     SN76496_init(0, MASTER_CLOCK, 255, rate);
 
     /* Set up YM2413 emulation */
-//    OPLL_init(3579545, rate) ;
-//    opll = OPLL_new() ;
-//    OPLL_reset(opll) ;
-//    OPLL_reset_patch(opll,0) ;            /* if use default voice data. */ 
+    YM2413_init(0, MASTER_CLOCK, rate);
+    fm_queued = 0;
 
     /* Inform other functions that we can use sound */
     snd.enabled = 1;
@@ -101,11 +86,6 @@ void audio_init(int rate)
 
 void system_shutdown(void)
 {
-    if(snd.enabled)
-    {
-//        OPLL_delete(opll);
-//        OPLL_close();
-    }
 }
 
 
@@ -118,56 +98,96 @@ void system_reset(void)
    // system_load_sram();
     if(snd.enabled)
     {
-//        OPLL_reset(opll) ;
-//        OPLL_reset_patch(opll,0) ;            /* if use default voice data. */ 
+        YM2413_reset(0);
+        fm_queued = 0;
     }
 }
 
 
-void system_save_state(void *fd)
+/* Save states are chunks in the frontend's buffer, see Emu::save_state.
+   The structures are written as they are, the pointers in them are
+   put back from the running machine when a state is loaded */
+#define STATE_VERSION       (1)
+
+int system_save_state(void)
 {
-    /* Save VDP context */
-    fwrite(&vdp, sizeof(t_vdp), 1, fd);
+    uint8 *d;
+    int room;
 
-    /* Save SMS context */
-    fwrite(&sms, sizeof(t_sms), 1, fd);
+    /* Apply any FM writes still waiting on the frame's audio */
+    ym2413_flush();
 
-    /* Save Z80 context */
-    fwrite(Z80_Context, sizeof(Z80_Regs), 1, fd);
-    fwrite(&after_EI, sizeof(int), 1, fd);
+    state_put("VDP ", STATE_VERSION, &vdp, sizeof(t_vdp));
+    state_put("SMS ", STATE_VERSION, &sms, sizeof(t_sms));
 
-    /* Save YM2413 registers */
-    fwrite(&ym2413.reg[0], 0x40, 1, fd);
+    /* Z80 context and the instruction delay after EI */
+    d = state_begin("Z80 ", STATE_VERSION, &room);
+    if(d && room >= sizeof(Z80_Regs) + sizeof(int))
+    {
+        memcpy(d, Z80_Context, sizeof(Z80_Regs));
+        memcpy(d + sizeof(Z80_Regs), &after_EI, sizeof(int));
+    }
+    state_end(sizeof(Z80_Regs) + sizeof(int));
+
+    if(sms.sram)
+        state_put("SRAM", STATE_VERSION, sms.sram, 0x8000);
 
-    /* Save SN76489 context */
-   // fwrite(&sn[0], sizeof(t_SN76496), 1, fd);
+    if(snd.enabled)
+    {
+        state_put("PSG ", STATE_VERSION, &sn[0], sizeof(t_SN76496));
+        state_put("OPLL", STATE_VERSION, &opll[0], sizeof(t_YM2413));
+    }
+    return 0;
 }
 
 
-void system_load_state(void *fd)
+/* A chunk this build can read, or NULL */
+static const uint8 *state_chunk(const char *tag, int len)
+{
+    int version, n;
+    const uint8 *d = state_find(tag, &version, &n);
+    return (d && version <= STATE_VERSION && n == len) ? d : NULL;
+}
+
+int system_load_state(void)
 {
     int i;
-    uint8 reg[0x40];
+    uint8 *dummy = sms.dummy;
+    uint8 *sram = sms.sram;
+    Z80_DaisyChain irq[Z80_MAXDAISY];
+    int (*irq_callback)(int);
+    const uint8 *d_vdp = state_chunk("VDP ", sizeof(t_vdp));
+    const uint8 *d_sms = state_chunk("SMS ", sizeof(t_sms));
+    const uint8 *d_z80 = state_chunk("Z80 ", sizeof(Z80_Regs) + sizeof(int));
+    const uint8 *d_sram = state_chunk("SRAM", 0x8000);
+    const uint8 *d_psg = state_chunk("PSG ", sizeof(t_SN76496));
+    const uint8 *d_opll = state_chunk("OPLL", sizeof(t_YM2413));
+
+    /* Check everything is there before touching the machine */
+    if(!d_vdp || !d_sms || !d_z80)
+        return -1;
 
     /* Initialize everything */
     cpu_reset();
     system_reset();
 
     /* Load VDP context */
-    fread(&vdp, sizeof(t_vdp), 1, fd);
-
-    /* Load SMS context */
-    fread(&sms, sizeof(t_sms), 1, fd);
-
-    /* Load Z80 context */
-    fread(Z80_Context, sizeof(Z80_Regs), 1, fd);
-    fread(&after_EI, sizeof(int), 1, fd);
-
-    /* Load YM2413 registers */
-    fread(reg, 0x40, 1, fd);
-
-    /* Load SN76489 context */
-    //fread(&sn[0], sizeof(t_SN76496), 1, fd);
+    memcpy(&vdp, d_vdp, sizeof(t_vdp));
+
+    /* Load SMS context, keeping our own buffers */
+    memcpy(&sms, d_sms, sizeof(t_sms));
+    sms.dummy = dummy;
+    sms.sram = sram;
+    if(sram && d_sram)
+        memcpy(sram, d_sram, 0x8000);
+
+    /* Load Z80 context, keeping our own callbacks */
+    memcpy(irq, Z80_Context->irq, sizeof(irq));
+    irq_callback = Z80_Context->irq_callback;
+    memcpy(Z80_Context, d_z80, sizeof(Z80_Regs));
+    memcpy(&after_EI, d_z80 + sizeof(Z80_Regs), sizeof(int));
+    memcpy(Z80_Context->irq, irq, sizeof(irq));
+    Z80_Context->irq_callback = irq_callback;
 
     /* Restore callbacks */
     z80_set_irq_callback(sms_irq_callback);
@@ -196,68 +216,63 @@ void system_load_state(void *fd)
     sms_mapper_w(0, sms.fcr[0]);
 
     /* Force full pattern cache update */
-//    is_vram_dirty = 1;
-//    memset(vram_dirty, 1, 0x200);
+    vramMarkAllDirty();
 
     /* Restore palette */
     for(i = 0; i < PALETTE_SIZE; i += 1)
         palette_sync(i);
 
-    /* Restore sound state */
+    /* Restore sound state, as it was rather than replaying registers */
     if(snd.enabled)
     {
-#if 0
-        /* Clear YM2413 context */
-        OPLL_reset(opll) ;
-        OPLL_reset_patch(opll,0) ;            /* if use default voice data. */ 
-
-        /* Restore rhythm enable first */
-        ym2413_write(0, 0, 0x0E);
-        ym2413_write(0, 1, reg[0x0E]);
-
-        /* User instrument settings */
-        for(i = 0x00; i <= 0x07; i += 1)
-        {
-            ym2413_write(0, 0, i);
-            ym2413_write(0, 1, reg[i]);
-        }
-
-        /* Channel frequency */
-        for(i = 0x10; i <= 0x18; i += 1)
-        {
-            ym2413_write(0, 0, i);
-            ym2413_write(0, 1, reg[i]);
-        }
-
-        /* Channel frequency + ctrl. */
-        for(i = 0x20; i <= 0x28; i += 1)
-        {
-            ym2413_write(0, 0, i);
-            ym2413_write(0, 1, reg[i]);
-        }
-
-        /* Instrument and volume settings  */
-        for(i = 0x30; i <= 0x38; i += 1)
-        {
-            ym2413_write(0, 0, i);
-            ym2413_write(0, 1, reg[i]);
-        }
-#endif
+        if(d_psg)
+            memcpy(&sn[0], d_psg, sizeof(t_SN76496));
+        if(d_opll)
+            memcpy(&opll[0], d_opll, sizeof(t_YM2413));
     }
+    return 0;
 }
 
 void ym2413_write(int chip, int offset, int data)
 {
-//    static uint8 latch = 0;
-//    if(offset & 1)
-//        OPLL_writeReg(opll, latch, data);
-//    else
-//        latch = data;
+    if(fm_queued == FM_QUEUE_SIZE) ym2413_flush();
+
+    fm_queue[fm_queued].sample = sms_line() * snd.bufsize / LINES_PER_FRAME;
+    fm_queue[fm_queued].offset = offset;
+    fm_queue[fm_queued].data = data;
+    fm_queued += 1;
 }
 
 
+/* Mix the frame's FM into the buffer, applying the queued writes as
+   their samples come up */
+void ym2413_update(signed short *buffer, int length)
+{
+    int i, pos = 0;
 
+    for(i = 0; i < fm_queued; i += 1)
+    {
+        int sample = fm_queue[i].sample < length ? fm_queue[i].sample : length;
+        if(sample > pos)
+        {
+            YM2413Update(0, buffer + pos, sample - pos);
+            pos = sample;
+        }
+        YM2413Write(0, fm_queue[i].offset, fm_queue[i].data);
+    }
+    fm_queued = 0;
 
+    YM2413Update(0, buffer + pos, length - pos);
+}
 
 
+/* Apply queued writes without rendering: the queue overflowed, or the
+   frame's audio was never pulled */
+void ym2413_flush(void)
+{
+    int i;
 
+    for(i = 0; i < fm_queued; i += 1)
+        YM2413Write(0, fm_queue[i].offset, fm_queue[i].data);
+    fm_queued = 0;
+}
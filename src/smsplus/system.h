@@ -2,9 +2,6 @@
 #ifndef _SYSTEM_H_
 #define _SYSTEM_H_
 
-//void ym2413_write(int chip, int offset, int data);
-//extern OPLL *opll;
-
 #define PALETTE_SIZE        (0x20)
 
 /* Console / cartridge types */
@@ -50,9 +47,6 @@ typedef struct
 {
     int enabled;
     int bufsize;
-    signed short *buffer[2];
-    signed short *fm_buffer;        /* internal use only */
-    signed short *psg_buffer[2];    /* internal use only */
     int log;
     void (*callback)(int data);
 }t_snd;
@@ -92,8 +86,20 @@ void emu_system_init(int rate);
 void system_shutdown(void);
 void system_reset(void);
 void system_load_sram(void);
-void system_save_state(void *fd);
-void system_load_state(void *fd);
+int system_save_state(void);
+int system_load_state(void);
+void ym2413_write(int chip, int offset, int data);
+void ym2413_update(signed short *buffer, int length);
+void ym2413_flush(void);
 void audio_init(int rate);
 
+/* Provided by the frontend: a byte of battery backed RAM changed */
+void battery_write(int offset);
+
+/* Provided by the frontend: save state chunks, see Emu::save_state */
+uint8 *state_begin(const char *tag, int version, int *room);
+int state_end(int len);
+int state_put(const char *tag, int version, const void *data, int len);
+const uint8 *state_find(const char *tag, int *version, int *len);
+
 #endif /* _SYSTEM_H_ */
@@ -218,46 +218,66 @@ int vdp_data_r(void)
 
 
 /* Process frame events */
-void vdp_run(void)
+/* Advance the line counter and status flags for a line; returns non-zero
+   if the VDP asserts its interrupt line on it */
+static int vdp_line_event(int line, int *left, uint8 *status)
 {
-    if(vdp.line <= 0xC0)
+    if(line <= 0xC0)
     {
-        if(vdp.line == 0xC0)
+        if(line == 0xC0)
         {
-            vdp.status |= 0x80;
+            *status |= 0x80;
         }
 
-        if(vdp.line == 0)
+        if(line == 0)
         {
-            vdp.left = vdp.reg[10];
+            *left = vdp.reg[10];
         }
 
-        if(vdp.left == 0)
+        if(*left == 0)
         {
-            vdp.left = vdp.reg[10];
-            vdp.status |= 0x40;
+            *left = vdp.reg[10];
+            *status |= 0x40;
         }
         else
         {
-            vdp.left -= 1;
+            *left -= 1;
         }
 
-        if((vdp.status & 0x40) && (vdp.reg[0] & 0x10))
-        {
-            sms.irq = 1;
-            z80_set_irq_line(0, ASSERT_LINE);
-        }
+        return ((*status & 0x40) && (vdp.reg[0] & 0x10));
     }
     else
     {
-        vdp.left = vdp.reg[10];
+        *left = vdp.reg[10];
 
-        if((vdp.line < 0xE0) && (vdp.status & 0x80) && (vdp.reg[1] & 0x20))
-        {
-            sms.irq = 1;
-            z80_set_irq_line(0, ASSERT_LINE);
-        }
+        return ((line < 0xE0) && (*status & 0x80) && (vdp.reg[1] & 0x20));
+    }
+}
+
+
+void vdp_run(void)
+{
+    if(vdp_line_event(vdp.line, &vdp.left, &vdp.status))
+    {
+        sms.irq = 1;
+        z80_set_irq_line(0, ASSERT_LINE);
+    }
+}
+
+
+/* Return the first line from 'line' on that vdp_run() will assert the
+   interrupt line on, provided the VDP isn't accessed until then */
+int vdp_next_irq(int line)
+{
+    int left = vdp.left;
+    uint8 status = vdp.status;
+
+    for(; line < LINES_PER_FRAME; line += 1)
+    {
+        if(vdp_line_event(line, &left, &status)) break;
     }
+
+    return (line);
 }
 
 
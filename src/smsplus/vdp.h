@@ -40,6 +40,7 @@ uint8 vdp_hcounter_r(void);
 void vdp_data_w(int data);
 int vdp_data_r(void);
 void vdp_run(void);
+int vdp_next_irq(int line);
 
 #endif /* _VDP_H_ */
 
@@ -0,0 +1,406 @@
+#include "shared.h"
+
+#define PHASE_SHIFT     22              /* 32 bit phase to 10 bit wave index */
+#define EG_SHIFT        16
+#define EG_MAX          (127 << EG_SHIFT)
+#define AM_DEPTH        13              /* 4.8dB in envelope steps */
+
+#define EG_ATTACK       0
+#define EG_DECAY        1
+#define EG_SUSTAIN      2
+#define EG_RELEASE      3
+#define EG_OFF          4
+
+#define RHYTHM(R)       ((R)->reg[0x0E] & 0x20)
+
+t_YM2413 opll[MAX_2413];
+
+/* Instrument ROM: user, 15 melodic and 3 rhythm voices, 8 bytes each */
+static const unsigned char tone[19 * 16] = {
+#include "ym2413tone.h"
+};
+
+/* -log2(sin) over the first quarter of the wave, in 1/256 octaves */
+static const unsigned short logsin[256] = {
+    2137, 1731, 1543, 1419, 1326, 1252, 1190, 1137, 1091, 1050, 1013,  979,  949,  920,  894,  869,
+     846,  825,  804,  785,  767,  749,  732,  717,  701,  687,  672,  659,  646,  633,  621,  609,
+     598,  587,  576,  566,  556,  546,  536,  527,  518,  509,  501,  492,  484,  476,  468,  461,
+     453,  446,  439,  432,  425,  418,  411,  405,  399,  392,  386,  380,  375,  369,  363,  358,
+     352,  347,  341,  336,  331,  326,  321,  316,  311,  307,  302,  297,  293,  289,  284,  280,
+     276,  271,  267,  263,  259,  255,  251,  248,  244,  240,  236,  233,  229,  226,  222,  219,
+     215,  212,  209,  205,  202,  199,  196,  193,  190,  187,  184,  181,  178,  175,  172,  169,
+     167,  164,  161,  159,  156,  153,  151,  148,  146,  143,  141,  138,  136,  134,  131,  129,
+     127,  125,  122,  120,  118,  116,  114,  112,  110,  108,  106,  104,  102,  100,   98,   96,
+      94,   92,   91,   89,   87,   85,   83,   82,   80,   78,   77,   75,   74,   72,   70,   69,
+      67,   66,   64,   63,   62,   60,   59,   57,   56,   55,   53,   52,   51,   49,   48,   47,
+      46,   45,   43,   42,   41,   40,   39,   38,   37,   36,   35,   34,   33,   32,   31,   30,
+      29,   28,   27,   26,   25,   24,   23,   23,   22,   21,   20,   20,   19,   18,   17,   17,
+      16,   15,   15,   14,   13,   13,   12,   12,   11,   10,   10,    9,    9,    8,    8,    7,
+       7,    7,    6,    6,    5,    5,    5,    4,    4,    4,    3,    3,    3,    2,    2,    2,
+       2,    1,    1,    1,    1,    1,    1,    1,    0,    0,    0,    0,    0,    0,    0,    0,
+};
+
+/* 2^-x over one octave, full scale is 4096 */
+static const unsigned short exptab[256] = {
+    4096, 4085, 4074, 4063, 4052, 4041, 4030, 4019, 4008, 3997, 3987, 3976, 3965, 3954, 3944, 3933,
+    3922, 3912, 3901, 3891, 3880, 3870, 3859, 3849, 3838, 3828, 3818, 3807, 3797, 3787, 3776, 3766,
+    3756, 3746, 3736, 3726, 3716, 3706, 3696, 3686, 3676, 3666, 3656, 3646, 3636, 3626, 3616, 3607,
+    3597, 3587, 3577, 3568, 3558, 3548, 3539, 3529, 3520, 3510, 3501, 3491, 3482, 3472, 3463, 3454,
+    3444, 3435, 3426, 3416, 3407, 3398, 3389, 3380, 3371, 3361, 3352, 3343, 3334, 3325, 3316, 3307,
+    3298, 3289, 3280, 3272, 3263, 3254, 3245, 3236, 3228, 3219, 3210, 3201, 3193, 3184, 3176, 3167,
+    3158, 3150, 3141, 3133, 3124, 3116, 3108, 3099, 3091, 3082, 3074, 3066, 3057, 3049, 3041, 3033,
+    3025, 3016, 3008, 3000, 2992, 2984, 2976, 2968, 2960, 2952, 2944, 2936, 2928, 2920, 2912, 2904,
+    2896, 2888, 2881, 2873, 2865, 2857, 2850, 2842, 2834, 2827, 2819, 2811, 2804, 2796, 2789, 2781,
+    2774, 2766, 2759, 2751, 2744, 2736, 2729, 2721, 2714, 2707, 2699, 2692, 2685, 2678, 2670, 2663,
+    2656, 2649, 2642, 2634, 2627, 2620, 2613, 2606, 2599, 2592, 2585, 2578, 2571, 2564, 2557, 2550,
+    2543, 2536, 2530, 2523, 2516, 2509, 2502, 2496, 2489, 2482, 2475, 2469, 2462, 2455, 2449, 2442,
+    2435, 2429, 2422, 2416, 2409, 2403, 2396, 2390, 2383, 2377, 2370, 2364, 2358, 2351, 2345, 2339,
+    2332, 2326, 2320, 2313, 2307, 2301, 2295, 2288, 2282, 2276, 2270, 2264, 2258, 2252, 2245, 2239,
+    2233, 2227, 2221, 2215, 2209, 2203, 2197, 2191, 2186, 2180, 2174, 2168, 2162, 2156, 2150, 2144,
+    2139, 2133, 2127, 2121, 2116, 2110, 2104, 2099, 2093, 2087, 2082, 2076, 2070, 2065, 2059, 2054,
+};
+
+/* Frequency multiplier, doubled */
+static const unsigned char mul2[16] = {
+    1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+/* Key scale level by the top F-number bits, in 0.75dB steps */
+static const unsigned char ksltab[16] = {
+    0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+/* Vibrato, in 1/256ths of the pitch */
+static const signed char pmtab[8] = {
+    0, 1, 2, 1, 0, -1, -2, -1
+};
+
+/* Envelope increment per output sample for a 4 bit rate */
+static int YM2413Rate(t_YM2413 *R,int rate,int rks)
+{
+    int r4;
+
+    if(!rate) return 0;
+    r4 = (rate << 2) + rks;
+    if(r4 > 63) r4 = 63;
+    return ((4 + (r4 & 3)) * R->Ratio) >> (16 - (r4 >> 2));
+}
+
+/* Load an operator from its instrument and the channel's pitch and level */
+static void YM2413Slot(t_YM2413 *R,t_YM2413_SLOT *S,const unsigned char *p,int op,int fnum,int block,int level,int sus)
+{
+    int b = p[op];
+    int ksl = p[2 + op] >> 6;
+    int rks = (b & 0x10) ? (block << 1) | (fnum >> 8) : block >> 1;
+    int rr = p[6 + op] & 0x0F;
+    int k;
+
+    S->am = (b >> 7) & 1;
+    S->pm = (b >> 6) & 1;
+    S->wf = (p[3] >> (3 + op)) & 1;
+    S->fb = op ? 0 : p[3] & 7;
+    S->dphase = (unsigned int)(((unsigned long long)((fnum << block) * mul2[b & 0x0F]) * R->Ratio) >> 4);
+
+    /* 1.5, 3 or 6dB per octave */
+    k = ksltab[fnum >> 5] - ((8 - block) << 3);
+    S->tll = level + ((k > 0 && ksl) ? (k << 1) >> (3 - ksl) : 0);
+
+    S->ar = YM2413Rate(R, p[4 + op] >> 4, rks);
+    S->dr = YM2413Rate(R, p[4 + op] & 0x0F, rks);
+    S->sl = (p[6 + op] >> 4) << (3 + EG_SHIFT);
+
+    /* Percussive tones keep decaying while the key is held */
+    S->ss = (b & 0x20) ? 0 : YM2413Rate(R, rr, rks);
+    S->rr = YM2413Rate(R, sus ? 5 : (b & 0x20) ? rr : 7, rks);
+}
+
+static void YM2413Key(t_YM2413_SLOT *S,int key)
+{
+    if(key && !S->key)
+    {
+        S->phase = 0;
+        S->out[0] = S->out[1] = 0;
+        S->state = EG_ATTACK;
+    }
+    else if(!key && S->key && S->state != EG_OFF)
+        S->state = EG_RELEASE;
+    S->key = key;
+}
+
+/* Reload both operators of a channel after a register write */
+static void YM2413Channel(t_YM2413 *R,int ch)
+{
+    static const unsigned char rhythm_key[3][2] = {
+        { 0x10, 0x10 },     /* Bass drum */
+        { 0x01, 0x08 },     /* Hi-hat, snare drum */
+        { 0x04, 0x02 }      /* Tom-tom, top cymbal */
+    };
+    int fnum  = R->reg[0x10 + ch] | ((R->reg[0x20 + ch] & 1) << 8);
+    int block = (R->reg[0x20 + ch] >> 1) & 7;
+    int sus   = R->reg[0x20 + ch] & 0x20;
+    int key   = R->reg[0x20 + ch] & 0x10;
+    int inst  = R->reg[0x30 + ch] >> 4;
+    int vol   = R->reg[0x30 + ch] & 0x0F;
+    const unsigned char *p = inst ? &tone[inst * 16] : R->reg;
+    t_YM2413_SLOT *M = &R->slot[ch * 2];
+    int mkey = key, ckey = key;
+    int mlevel;
+
+    if(RHYTHM(R) && ch >= 6)
+    {
+        p = &tone[(ch + 10) * 16];
+        mkey |= R->reg[0x0E] & rhythm_key[ch - 6][0];
+        ckey |= R->reg[0x0E] & rhythm_key[ch - 6][1];
+    }
+
+    /* Hi-hat and tom-tom take their level from the instrument nibble */
+    if(RHYTHM(R) && ch >= 7)
+        mlevel = inst << 3;
+    else
+        mlevel = (p[2] & 0x3F) << 1;
+
+    YM2413Slot(R, M, p, 0, fnum, block, mlevel, sus);
+    YM2413Slot(R, M + 1, p, 1, fnum, block, vol << 3, sus);
+    YM2413Key(M, mkey != 0);
+    YM2413Key(M + 1, ckey != 0);
+}
+
+void YM2413Write(int chip,int offset,int data)
+{
+    t_YM2413 *R = &opll[chip];
+    int r, ch;
+
+    if(!(offset & 1))
+    {
+        R->address = data & 0x3F;
+        return;
+    }
+
+    r = R->address;
+    R->reg[r] = data;
+
+    if(r < 0x08)
+    {
+        /* User instrument: reload the channels playing it */
+        for(ch = 0; ch < 9; ch += 1)
+            if(!(R->reg[0x30 + ch] & 0xF0)) YM2413Channel(R, ch);
+    }
+    else if(r == 0x0E)
+    {
+        for(ch = 6; ch < 9; ch += 1)
+            YM2413Channel(R, ch);
+    }
+    else if(r >= 0x10 && r <= 0x38 && (r & 0x0F) < 9)
+        YM2413Channel(R, r & 0x0F);
+}
+
+static inline void YM2413Phase(t_YM2413_SLOT *S,int pm)
+{
+    S->phase += S->dphase;
+    if(S->pm) S->phase += (int)(S->dphase >> 8) * pm;
+}
+
+static inline void YM2413Envelope(t_YM2413_SLOT *S)
+{
+    switch(S->state)
+    {
+        case EG_ATTACK:
+            /* Exponential approach: fast from silence, slowing near full level */
+            S->eg -= (((S->eg >> EG_SHIFT) + 1) * S->ar) >> 1;
+            if(S->eg <= 0)
+            {
+                S->eg = 0;
+                S->state = EG_DECAY;
+            }
+            break;
+
+        case EG_DECAY:
+            S->eg += S->dr;
+            if(S->eg >= S->sl)
+            {
+                S->eg = S->sl;
+                S->state = EG_SUSTAIN;
+            }
+            break;
+
+        case EG_SUSTAIN:
+        case EG_RELEASE:
+            S->eg += (S->state == EG_SUSTAIN) ? S->ss : S->rr;
+            if(S->eg >= EG_MAX)
+            {
+                S->eg = EG_MAX;
+                S->state = EG_OFF;
+            }
+            break;
+    }
+}
+
+/* Operator output for a 10 bit wave index, +/-4096 */
+static inline int YM2413Op(t_YM2413_SLOT *S,int idx,int am)
+{
+    int att = (S->eg >> EG_SHIFT) + S->tll + (S->am ? am : 0);
+    int out;
+
+    /* Beyond the 7 bit attenuation range, or the muted half of the wave */
+    if(att > 127 || (S->wf && (idx & 0x200))) return 0;
+
+    att = logsin[(idx & 0x100) ? ~idx & 0xFF : idx & 0xFF] + (att << 4);
+    out = exptab[att & 0xFF] >> (att >> 8);
+    return (idx & 0x200) ? -out : out;
+}
+
+/* Two operator FM: the modulator (with feedback) drives the carrier */
+static inline int YM2413Melody(t_YM2413_SLOT *M,int am,int pm)
+{
+    t_YM2413_SLOT *C = M + 1;
+    int fb = M->fb ? (M->out[0] + M->out[1]) >> (9 - M->fb) : 0;
+    int mod, out;
+
+    YM2413Phase(M, pm);
+    YM2413Phase(C, pm);
+
+    mod = YM2413Op(M, (M->phase >> PHASE_SHIFT) + fb, am);
+    M->out[1] = M->out[0];
+    M->out[0] = mod;
+    out = YM2413Op(C, (C->phase >> PHASE_SHIFT) + mod, am);
+
+    YM2413Envelope(M);
+    YM2413Envelope(C);
+    return out;
+}
+
+/* Bass drum on channel 6, hi-hat and snare drum on 7, tom-tom and top
+   cymbal on 8. The metallic sounds mix bits of the hi-hat and cymbal
+   phases with noise instead of using FM. */
+static int YM2413Rhythm(t_YM2413 *R,int am,int pm)
+{
+    t_YM2413_SLOT *HH = &R->slot[14], *SD = HH + 1, *TOM = HH + 2, *CYM = HH + 3;
+    int out = 0;
+    int noise, hh, cym, metal, idx;
+
+    if(R->slot[13].state != EG_OFF)
+        out += YM2413Melody(&R->slot[12], am, pm);
+
+    if(R->noise & 1) R->noise ^= 0x800200;
+    R->noise >>= 1;
+    noise = R->noise & 1;
+
+    YM2413Phase(HH, pm);
+    YM2413Phase(SD, pm);
+    YM2413Phase(TOM, pm);
+    YM2413Phase(CYM, pm);
+    hh = HH->phase >> PHASE_SHIFT;
+    cym = CYM->phase >> PHASE_SHIFT;
+    metal = (((hh >> 2) ^ (hh >> 7)) | (hh >> 3) | ((cym >> 3) ^ (cym >> 5))) & 1;
+
+    if(HH->state != EG_OFF)
+    {
+        idx = metal ? 0x200 | (0xD0 >> 2) : 0xD0;
+        if(noise) idx = (idx & 0x200) ? 0x200 | 0xD0 : 0xD0 >> 2;
+        out += YM2413Op(HH, idx, am);
+        YM2413Envelope(HH);
+    }
+    if(SD->state != EG_OFF)
+    {
+        idx = (hh & 0x100) ? 0x200 : 0x100;
+        if(noise) idx ^= 0x100;
+        out += YM2413Op(SD, idx, am);
+        YM2413Envelope(SD);
+    }
+    if(TOM->state != EG_OFF)
+    {
+        out += YM2413Op(TOM, TOM->phase >> PHASE_SHIFT, am);
+        YM2413Envelope(TOM);
+    }
+    if(CYM->state != EG_OFF)
+    {
+        out += YM2413Op(CYM, metal ? 0x300 : 0x100, am);
+        YM2413Envelope(CYM);
+    }
+
+    /* The rhythm section plays at twice the level */
+    return out << 1;
+}
+
+/* Mix a block into the buffer. Channels that are silent at the start of
+   the block are skipped for all of it. */
+void YM2413Update(int chip,INT16 *buffer,int length)
+{
+    t_YM2413 *R = &opll[chip];
+    int active[9];
+    int i, n = 0;
+    int rhythm = 0;
+
+    for(i = 0; i < (RHYTHM(R) ? 6 : 9); i += 1)
+        if(R->slot[i * 2 + 1].state != EG_OFF) active[n++] = i * 2;
+    if(RHYTHM(R))
+        for(i = 13; i < 18; i += 1)
+            if(R->slot[i].state != EG_OFF) rhythm = 1;
+
+    if(!n && !rhythm)
+    {
+        R->am_phase += R->am_step * length;
+        R->pm_phase += R->pm_step * length;
+        return;
+    }
+
+    while (length > 0)
+    {
+        int tri = R->am_phase >> 24;
+        int am, pm, out = 0;
+
+        if(tri & 0x80) tri ^= 0xFF;
+        am = (tri * AM_DEPTH) >> 7;
+        pm = pmtab[R->pm_phase >> 29];
+        R->am_phase += R->am_step;
+        R->pm_phase += R->pm_step;
+
+        for(i = 0; i < n; i += 1)
+            out += YM2413Melody(&R->slot[active[i]], am, pm);
+        if(rhythm)
+            out += YM2413Rhythm(R, am, pm);
+
+        out += *buffer;
+        if(out > 32767) out = 32767;
+        if(out < -32767) out = -32767;
+        *buffer++ = out;
+
+        length--;
+    }
+}
+
+void YM2413_reset(int chip)
+{
+    t_YM2413 *R = &opll[chip];
+    int i;
+
+    memset(R->reg, 0, sizeof(R->reg));
+    memset(R->slot, 0, sizeof(R->slot));
+    for(i = 0; i < 18; i += 1)
+    {
+        R->slot[i].eg = EG_MAX;
+        R->slot[i].state = EG_OFF;
+    }
+    R->address = 0;
+    R->am_phase = R->pm_phase = 0;
+    R->noise = 1;
+
+    for(i = 0; i < 9; i += 1)
+        YM2413Channel(R, i);
+}
+
+int YM2413_init(int chip,int clock,int sample_rate)
+{
+    t_YM2413 *R = &opll[chip];
+
+    R->SampleRate = sample_rate;
+    R->Ratio = ((unsigned int)(clock / 72) << 16) / sample_rate;
+
+    /* 3.7Hz tremolo and 6.4Hz vibrato */
+    R->am_step = ((37u << 24) / (10 * sample_rate)) << 8;
+    R->pm_step = ((64u << 24) / (10 * sample_rate)) << 8;
+
+    YM2413_reset(chip);
+
+    return 0;
+}
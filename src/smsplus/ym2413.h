@@ -0,0 +1,45 @@
+#ifndef YM2413_H
+#define YM2413_H
+
+#define MAX_2413 1
+
+/* Operator */
+typedef struct
+{
+    unsigned int phase;     /* Top 10 bits index the wave */
+    unsigned int dphase;    /* Phase increment per output sample */
+    int eg;                 /* Attenuation in 0.375dB steps, 16 bit fraction */
+    int state;
+    int sl;                 /* End of the decay phase, same units as eg */
+    int ar, dr, ss, rr;     /* Envelope increments per output sample */
+    int tll;                /* Total level and key scaling, 0.375dB steps */
+    int out[2];             /* Last two outputs, for feedback */
+    unsigned char key;
+    unsigned char am;
+    unsigned char pm;
+    unsigned char wf;       /* Half-wave rectified sine */
+    unsigned char fb;
+}t_YM2413_SLOT;
+
+typedef struct
+{
+    int SampleRate;
+    unsigned int Ratio;     /* Chip samples per output sample, 16.16 */
+    unsigned char reg[0x40];
+    int address;
+    unsigned int am_phase;
+    unsigned int pm_phase;
+    unsigned int am_step;
+    unsigned int pm_step;
+    unsigned int noise;
+    t_YM2413_SLOT slot[18];
+}t_YM2413;
+
+extern t_YM2413 opll[MAX_2413];
+
+void YM2413Write(int chip,int offset,int data);
+void YM2413Update(int chip, signed short int *buffer,int length);
+void YM2413_reset(int chip);
+int YM2413_init(int chip,int clock,int sample_rate);
+
+#endif
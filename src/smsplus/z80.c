@@ -64,6 +64,7 @@
 extern void cpu_writemem16(int address, int data);
 extern void cpu_writeport(int port, int data);
 extern int cpu_readport(int port);
+extern int cpu_pollport(int port);
 unsigned char *cpu_readmap[8];
 unsigned char *cpu_writemap[8];
 
@@ -100,6 +101,9 @@ unsigned char *cpu_writemap[8];
 /* check for delay loops counting down BC */
 #define TIME_LOOP_HACKS 	1
 
+/* on conditional JP and JR opcodes check for loops polling a port or memory */
+#define IDLE_LOOP_HACKS 	1
+
 #ifdef X86_ASM
 #undef	BIG_FLAGS_ARRAY
 #define BIG_FLAGS_ARRAY 	0
@@ -174,6 +178,7 @@ static Z80_Regs Z80;
 Z80_Regs *Z80_Context = &Z80;
 static UINT32 EA;
 int after_EI = 0;
+int z80_idle_cycles = 0;
 
 static UINT8 SZ[256];		/* zero and sign flags */
 static UINT8 SZ_BIT[256];	/* zero, sign and parity/overflow (=zero) flags for BIT opcode */
@@ -432,9 +437,88 @@ static __inline__ void BURNODD(int cycles, int opcodes, int cyclesum)
     {
 		_R += (cycles / cyclesum) * opcodes;
 		z80_ICount -= (cycles / cyclesum) * cyclesum;
+		z80_idle_cycles += (cycles / cyclesum) * cyclesum;
     }
 }
 
+#if IDLE_LOOP_HACKS
+/****************************************************************************/
+/* A loop of IN A,(n) or LD A,(nn), optionally AND n, CP n, AND A, OR A or  */
+/* BIT b,A, and a conditional JR or JP back does the same thing every time  */
+/* round until the port or memory location read changes. Memory and the     */
+/* ports cpu_pollport() accepts only change between z80_execute() calls.    */
+/* The flags the jump tests may predate an interrupt, so nothing is skipped */
+/* until a whole iteration has run back to back with the previous one.     */
+/****************************************************************************/
+#define IDLE_MAX_BODY	5
+
+static unsigned idle_pc;	/* jump of the last polling loop iteration seen */
+static int idle_icount; 	/* and z80_ICount after it */
+
+static void IDLE_SKIP(unsigned target, unsigned jump)
+{
+	unsigned pc = target;
+	int loop, opcodes = 2;
+	UINT8 op = cpu_readop(pc);
+
+	if( op == 0xdb )
+	{
+		if( !cpu_pollport(cpu_readop_arg(pc + 1)) )
+			return;
+		pc += 2;
+	}
+	else
+	if( op == 0x3a )
+		pc += 3;
+	else
+		return;
+	loop = cc_op[op];
+
+	op = cpu_readop(pc);
+	if( op == 0xe6 || op == 0xfe )
+	{
+		loop += cc_op[op];
+		opcodes++;
+		pc += 2;
+	}
+	else
+	if( op == 0xa7 || op == 0xb7 )
+	{
+		loop += cc_op[op];
+		opcodes++;
+		pc++;
+	}
+	else
+	if( op == 0xcb && (cpu_readop_arg(pc + 1) & 0xc7) == 0x47 )
+	{
+		loop += cc_op[op] + cc_cb[cpu_readop_arg(pc + 1)];
+		opcodes += 2;
+		pc += 2;
+	}
+
+	if( pc != jump )
+		return;
+	op = cpu_readop(jump);
+	/* taken JR cc: 5 more T-states */
+	loop += cc_op[op] + ((op & 0xc7) == 0xc2 ? 0 : 5);
+
+	if( jump != idle_pc || idle_icount - z80_ICount != loop )
+	{
+		idle_pc = jump;
+		idle_icount = z80_ICount;
+		return;
+	}
+	BURNODD( z80_ICount - 1, opcodes, loop );
+	idle_icount = z80_ICount;
+}
+
+#define IDLE_LOOP(jump) 										\
+	if( _PCD < (jump) && (jump) - _PCD <= IDLE_MAX_BODY && !after_EI ) \
+		IDLE_SKIP( _PCD, jump )
+#else
+#define IDLE_LOOP(jump)
+#endif
+
 /***************************************************************
  * define an opcode function
  ***************************************************************/
@@ -688,7 +772,9 @@ static __inline__ UINT32 ARG16(void)
 #define JP_COND(cond)											\
 	if( cond )													\
 	{															\
+		unsigned oldpc = _PCD-1;								\
 		_PCD = ARG16(); 										\
+		IDLE_LOOP( oldpc ); 									\
 	}															\
 	else														\
 	{															\
@@ -740,6 +826,7 @@ static __inline__ UINT32 ARG16(void)
 		INT8 arg = (INT8)ARG(); /* ARG() also increments _PC */ \
 		_PC += arg; 			/* so don't do _PC += ARG() */  \
         CY(5);                                                  \
+		IDLE_LOOP( (unsigned)(_PC - arg - 2) ); 				\
 	}															\
 	else _PC++; 												\
 
@@ -4151,20 +4238,48 @@ void z80_exit(void)
  ****************************************************************************/
 int z80_execute(int cycles)
 {
-	z80_ICount = cycles - Z80.extra_cycles;
-	Z80.extra_cycles = 0;
+	z80_execute_slices(cycles, 1);
 
-    do
+    return cycles - z80_ICount;
+}
+
+/****************************************************************************
+ * Execute up to 'count' slices of 'cycles' T-states each, exactly like as
+ * many z80_execute() calls would: every slice starts from a full budget and
+ * the cycles an instruction overshoots it by are dropped at the boundary.
+ * z80_stop() ends the run with the slice in progress. Returns the number of
+ * slices executed.
+ ****************************************************************************/
+int z80_slice;
+static int z80_stopped;
+
+int z80_execute_slices(int cycles, int count)
+{
+	z80_stopped = 0;
+	for( z80_slice = 0; z80_slice < count && !z80_stopped; z80_slice++ )
 	{
-        _PPC = _PCD;
-		_R++;
-        EXEC_INLINE(op,ROP());
-	} while( z80_ICount > 0 );
+		z80_ICount = cycles - Z80.extra_cycles;
+		Z80.extra_cycles = 0;
+#if IDLE_LOOP_HACKS
+		idle_pc = ~0;
+#endif
 
-	z80_ICount -= Z80.extra_cycles;
-    Z80.extra_cycles = 0;
+		do
+		{
+			_PPC = _PCD;
+			_R++;
+			EXEC_INLINE(op,ROP());
+		} while( z80_ICount > 0 );
 
-    return cycles - z80_ICount;
+		z80_ICount -= Z80.extra_cycles;
+		Z80.extra_cycles = 0;
+	}
+	return z80_slice;
+}
+
+void z80_stop(void)
+{
+	z80_stopped = 1;
 }
 
 /****************************************************************************
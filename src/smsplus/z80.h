@@ -17,6 +17,7 @@ enum {
 };
 
 extern int z80_ICount;              /* T-state count                        */
+extern int z80_idle_cycles;         /* T-states burnt in busy/polling loops */
 
 #define Z80_IGNORE_INT  -1          /* Ignore interrupt                     */
 #define Z80_NMI_INT 	-2			/* Execute NMI							*/
@@ -28,6 +29,9 @@ extern int z80_ICount;              /* T-state count                        */
 extern void z80_reset (void *param);
 extern void z80_exit (void);
 extern int z80_execute(int cycles);
+extern int z80_execute_slices(int cycles, int count);
+extern void z80_stop(void);
+extern int z80_slice;               /* slice z80_execute_slices() is on     */
 extern void z80_burn(int cycles);
 extern unsigned z80_get_context (void *dst);
 extern void z80_set_context (void *src);
@@ -174,6 +174,7 @@ void video_init_hw(int line_width, int samples_per_cc)
     //  IR input if used
 #ifdef IR_PIN
     pinMode(IR_PIN,INPUT);
+    ir_begin();
 #endif
 }
 
@@ -219,21 +220,6 @@ static void freqs()
 }
 */
 
-extern "C"
-void* MALLOC32(int x, const char* label)
-{
-    printf("MALLOC32 %d free, %d biggest, allocating %s:%d\n",
-      heap_caps_get_free_size(MALLOC_CAP_32BIT),heap_caps_get_largest_free_block(MALLOC_CAP_32BIT),label,x);
-    void * r = heap_caps_malloc(x,MALLOC_CAP_32BIT);
-    if (!r) {
-        printf("MALLOC32 FAILED allocation of %s:%d!!!!####################\n",label,x);
-        esp_restart();
-    }
-    else
-        printf("MALLOC32 allocation of %s:%d %08X\n",label,x,r);
-    return r;
-}
-
 #else
 
 //====================================================================================================
@@ -359,6 +345,13 @@ void video_init(int samples_per_cc, int machine, const uint32_t* palette, int nt
     video_init_hw(_line_width,_samples_per_cc);    // init the hardware
 }
 
+// another core takes over the running video, all of them use 4 samples per color clock
+void video_switch(int machine, const uint32_t* palette)
+{
+    _machine = machine;
+    _palette = palette;
+}
+
 //===================================================================================================
 //===================================================================================================
 // PAL
@@ -786,9 +779,6 @@ void video_sync()
 extern "C"
 void IRAM_ATTR video_isr(volatile void* vbuf)
 {
-    if (!_lines)
-        return;
-
     ISR_BEGIN();
 
     uint8_t s = _audio_r < _audio_w ? _audio_buffer[_audio_r++ & (sizeof(_audio_buffer)-1)] : 0x20;
@@ -801,14 +791,15 @@ void IRAM_ATTR video_isr(volatile void* vbuf)
 
     int i = _line_counter++;
     uint16_t* buf = (uint16_t*)vbuf;
+    uint8_t** lines = _lines;                   // cleared while cores switch
     if (_pal_) {
         // pal
         if (i < 32) {
             blanking(buf,false);                // pre render/black 0-32
-        } else if (i < _active_lines + 32) {    // active video 32-272
+        } else if (i < _active_lines + 32 && lines) {   // active video 32-272
             sync(buf,_hsync);
             burst(buf);
-            blit(_lines[i-32],buf + _active_start);
+            blit(gui_line(lines[i-32],i-32),buf + _active_start);
         } else if (i < 304) {                   // post render/black 272-304
             if (i < 272)                        // slight optimization here, once you have 2 blanking buffers
                 blanking(buf,false);
@@ -817,10 +808,10 @@ void IRAM_ATTR video_isr(volatile void* vbuf)
         }
     } else {
         // ntsc
-        if (i < _active_lines) {                // active video
+        if (i < _active_lines && lines) {       // active video
             sync(buf,_hsync);
             burst(buf);
-            blit(_lines[i],buf + _active_start);
+            blit(gui_line(lines[i],i),buf + _active_start);
 
         } else if (i < (_active_lines + 5)) {   // post render/black
             blanking(buf,false);